@@ -39,6 +39,11 @@ using shader_bool  = uint32_t;
 
 #define IOR 1.45f // index of refraction
 
+// Order of the spherical harmonics expansion baked into every vertex, 0 to 4.
+// Every coefficient takes a vertex attribute location, orders above 2 need more than the 16 guaranteed by Vulkan.
+#define SH_ORDER 2
+#define SH_COEFFS_NUM ((SH_ORDER + 1) * (SH_ORDER + 1))
+
 struct RenderParams
 {
   shader_float aspectRatio;
@@ -60,4 +65,11 @@ struct CameraMatrices
   shader_mat4 viewProjection;
 };
 
+// Placement of one instance, which is uniformly scaled and then translated
+struct InstanceTransform
+{
+  shader_vec3 position;
+  shader_float scale;
+};
+
 #endif // COMMON_DEFINITIONS_H
\ No newline at end of file
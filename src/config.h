@@ -20,6 +20,16 @@
 #include <thread>
 #include <mutex>
 
+// A range of a device memory block, handed out by vkutil::MemoryAllocator
+struct MemoryAllocation {
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	// Bytes reserved for the resource, at least its requested size
+	vk::DeviceSize size = 0;
+	// Start of the range if the memory is host visible, blocks stay mapped while they exist
+	void* mappedData = nullptr;
+};
+
 // Data structures used for creating buffers
 // and allocating memory
 struct BufferInputChunk {
@@ -28,12 +38,14 @@ struct BufferInputChunk {
 	vk::Device logicalDevice;
 	vk::PhysicalDevice physicalDevice;
 	vk::MemoryPropertyFlags memoryProperties;
+	// Queue families using the buffer, with more than one it is shared concurrently
+	std::vector<uint32_t> queueFamilyIndices;
 };
 
 // Holds a vulkan buffer and memory allocation
 struct Buffer {
 	vk::Buffer buffer;
-	vk::DeviceMemory bufferMemory;
+	MemoryAllocation bufferMemory;
 };
 
 //--------- Assets -------------//
@@ -52,7 +64,11 @@ enum class pipelineType {
 };
 
 // Encoding
-#define SINGLE_VERTEX_FLOAT_NUM 47
+#include "common/common_definitions.h"
+
+// Position, color, texcoord and normal come first, then a vec4 of (width, x, y, z) for every SH coefficient
+#define SH_COEFFS_OFFSET 11
+#define SINGLE_VERTEX_FLOAT_NUM (SH_COEFFS_OFFSET + 4 * SH_COEFFS_NUM)
 
 struct DataToEncode {
 	float width, x, y, z;
@@ -4,17 +4,22 @@
 
 
 // Construct a new App.
-App::App(int width, int height)
+App::App(int width, int height, size_t instanceCount, int framesInFlight, RayMarchSettings rayMarch)
 {
 	buildGlfwWindow(width, height);
-	graphicsEngine = new Engine(width, height, window);
-	scene = new Scene();
+	graphicsEngine = new Engine(width, height, window, framesInFlight, rayMarch);
+	scene = new Scene(instanceCount);
+
+	// Only set once there is something to draw
+	glfwSetWindowUserPointer(window, this);
+	glfwSetWindowRefreshCallback(window, onWindowRefresh);
 }
 
 static Camera camera;
 static uint32_t distance_calculation_mode = 1;
+static bool uniform_branching = false;
 
-static void on_keyboard_pressed(GLFWwindow* window, int , int, int , int)
+static void on_keyboard_pressed(GLFWwindow* window, int key, int, int action, int)
 {
 	camera.resetSpeedVector();
 	
@@ -44,6 +49,10 @@ static void on_keyboard_pressed(GLFWwindow* window, int , int, int , int)
 
 	if (glfwGetKey(window, '3'))
 		distance_calculation_mode = 3;
+
+	// Toggles between the specialized sky and the one branching on the mode, to compare their GPU time
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		uniform_branching = !uniform_branching;
 }
 
 
@@ -78,14 +87,32 @@ void App::run()
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwPollEvents();
+		drawFrame();
+	}
+}
 
-		graphicsEngine->setDistanceCalculationMode(distance_calculation_mode);
-		graphicsEngine->render(scene);
+void App::drawFrame()
+{
+	drawing = true;
 
-		camera.move(static_cast<float>(glfwGetTime() - lastTime));
-		graphicsEngine->updateCameraData(camera);
-		calculateFrameRate();
-	}
+	graphicsEngine->setDistanceCalculationMode(distance_calculation_mode);
+	graphicsEngine->setUniformBranching(uniform_branching);
+	graphicsEngine->render(scene);
+
+	camera.move(static_cast<float>(glfwGetTime() - lastTime));
+	graphicsEngine->updateCameraData(camera);
+	calculateFrameRate();
+
+	drawing = false;
+}
+
+// Some platforms stop returning from glfwPollEvents while the window is dragged or resized, but keep
+// asking for it to be redrawn. Drawing from here keeps the window live and resizing with it.
+void App::onWindowRefresh(GLFWwindow* window)
+{
+	App* app = static_cast<App*>(glfwGetWindowUserPointer(window));
+	if (!app->drawing)
+		app->drawFrame();
 }
 
 // Calculates the App's framerate and updates the window title
@@ -97,8 +124,18 @@ void App::calculateFrameRate()
 	if (delta >= 1)
 	{
 		int framerate{ std::max(1, int(numFrames / delta)) };
+		FrameStatistics statistics = graphicsEngine->takeFrameStatistics();
 		std::stringstream title;
-		title << "Running at " << framerate << " fps.";
+		title << "Running at " << framerate << " fps with " << graphicsEngine->getFramesInFlight()
+			<< " frames in flight, preparing a frame takes " << statistics.prepareSeconds * 1e6
+			<< " us, waiting for one " << statistics.fenceWaitSeconds * 1e6
+			<< " us, latency " << statistics.latencySeconds * 1e3 << " ms";
+		if (statistics.skyPassSeconds > 0)
+			title << ", sky pass " << statistics.skyPassSeconds * 1e6 << " us on the GPU "
+				<< (uniform_branching ? "branching on the mode" : "specialized");
+		if (statistics.resizes > 0)
+			title << ", " << statistics.resizes << " resizes taking " << statistics.resizeSeconds * 1e3 << " ms each";
+		title << ".";
 		glfwSetWindowTitle(window, title.str().c_str());
 		lastTime = currentTime;
 		numFrames = -1;
@@ -13,12 +13,17 @@ class App {
 		double lastTime, currentTime;
 		int numFrames;
 		float frameTime;
+		// Set while a frame is drawn, the window callbacks may run from inside it
+		bool drawing = false;
 
 		void buildGlfwWindow(int width, int height);
 		void calculateFrameRate();
+		void drawFrame();
+
+		static void onWindowRefresh(GLFWwindow* window);
 
 	public:
-		App(int width, int height);
+		App(int width, int height, size_t instanceCount = 1, int framesInFlight = 2, RayMarchSettings rayMarch = {});
 		~App();
 		void run();
 };
\ No newline at end of file
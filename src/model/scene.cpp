@@ -1,19 +1,164 @@
 #include "scene.h"
+#include <algorithm>
+#include <cmath>
 
-Scene::Scene()
+// Slots sharing a version, changes are uploaded in whole blocks
+static constexpr uint32_t DIRTY_BLOCK_SIZE = 64;
+
+Scene::Scene(size_t instanceCount)
 {
 	// Turn off scene for now
-	
-	// positions.insert({ meshTypes::GROUND, {} });
-	// positions.insert({ meshTypes::GIRL, {} });
-	// positions.insert({ meshTypes::SKULL, {} });
-	// positions.insert({ meshTypes::VIKING_ROOM, {} });
-	positions.insert({ meshTypes::CUBE, {} });
-	positions[meshTypes::CUBE].push_back(glm::vec3(0.f, 0.f, 0.f));
-
-	// positions[meshTypes::GROUND].push_back(glm::vec3(10.f, 0.f, 0.f));
-	// positions[meshTypes::GIRL].push_back(glm::vec3(5.f, 0.f, 0.f));
-	// positions[meshTypes::SKULL].push_back(glm::vec3(15.f, -5.f, 1.f));
-	// positions[meshTypes::SKULL].push_back(glm::vec3(15.f, 5.f, 1.f));
-	// positions[meshTypes::VIKING_ROOM].push_back(glm::vec3(3.f, 1.5f, 4.f));
-};
\ No newline at end of file
+
+	// addInstance(meshTypes::GROUND, glm::vec3(10.f, 0.f, 0.f));
+	// addInstance(meshTypes::GIRL, glm::vec3(5.f, 0.f, 0.f));
+	// addInstance(meshTypes::SKULL, glm::vec3(15.f, -5.f, 1.f));
+	// addInstance(meshTypes::SKULL, glm::vec3(15.f, 5.f, 1.f));
+	// addInstance(meshTypes::VIKING_ROOM, glm::vec3(3.f, 1.5f, 4.f));
+
+	// Cubes on a grid centered on the origin, a single one sits at the origin
+	int side = static_cast<int>(std::ceil(std::cbrt(static_cast<double>(instanceCount)) - 1e-9));
+	float center = (side - 1) / 2.f;
+	for (size_t i = 0; i < instanceCount; i++)
+	{
+		glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+		addInstance(meshTypes::CUBE, 3.f * (cell - center));
+	}
+};
+
+InstanceHandle Scene::addInstance(meshTypes type, glm::vec3 position, float scale)
+{
+	uint32_t index;
+	if (!freeIndices.empty())
+	{
+		index = freeIndices.back();
+		freeIndices.pop_back();
+	}
+	else
+	{
+		index = static_cast<uint32_t>(instanceSlots.size());
+		instanceSlots.push_back(0);
+		generations.push_back(0);
+	}
+
+	auto range = std::find_if(ranges.begin(), ranges.end(), [type](const MeshRange& range) { return range.type == type; });
+	if (range == ranges.end())
+		range = ranges.insert(ranges.end(), { type, static_cast<uint32_t>(positions.size()), 0 });
+
+	// Open a slot at the end of the store, then pass it down to the end of the mesh's range by moving
+	// the first instance of every later range behind its last one
+	uint32_t hole = static_cast<uint32_t>(positions.size());
+	positions.emplace_back();
+	scales.emplace_back();
+	slotInstances.emplace_back();
+	for (auto later = ranges.end() - 1; later != range; --later)
+	{
+		moveSlot(later->first, hole);
+		hole = later->first++;
+	}
+
+	positions[hole] = position;
+	scales[hole] = scale;
+	slotInstances[hole] = index;
+	instanceSlots[index] = hole;
+	range->count++;
+	markDirty(hole);
+
+	return { index, generations[index] };
+}
+
+bool Scene::removeInstance(InstanceHandle instance)
+{
+	if (!isAlive(instance))
+		return false;
+
+	uint32_t slot = instanceSlots[instance.index];
+	generations[instance.index]++;
+	freeIndices.push_back(instance.index);
+
+	auto range = std::find_if(ranges.begin(), ranges.end(),
+		[slot](const MeshRange& range) { return slot >= range.first && slot < range.first + range.count; });
+
+	// Fill the slot with the last instance of the range, then pass the hole on to the end of the store
+	// by moving the last instance of every later range in front of its first one
+	uint32_t hole = range->first + --range->count;
+	if (slot != hole)
+		moveSlot(hole, slot);
+	for (auto later = range + 1; later != ranges.end(); ++later)
+	{
+		uint32_t last = later->first + later->count - 1;
+		moveSlot(last, hole);
+		later->first--;
+		hole = last;
+	}
+
+	positions.pop_back();
+	scales.pop_back();
+	slotInstances.pop_back();
+	blockVersions.resize((positions.size() + DIRTY_BLOCK_SIZE - 1) / DIRTY_BLOCK_SIZE);
+	if (range->count == 0)
+		ranges.erase(range);
+	return true;
+}
+
+bool Scene::setPosition(InstanceHandle instance, glm::vec3 position)
+{
+	if (!isAlive(instance))
+		return false;
+
+	uint32_t slot = instanceSlots[instance.index];
+	positions[slot] = position;
+	markDirty(slot);
+	return true;
+}
+
+bool Scene::isAlive(InstanceHandle instance) const
+{
+	return instance.index < generations.size() && generations[instance.index] == instance.generation;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> Scene::dirtyRangesSince(uint64_t seenVersion) const
+{
+	uint32_t size = static_cast<uint32_t>(positions.size());
+
+	// Neighbouring dirty blocks are joined into one range
+	std::vector<std::pair<uint32_t, uint32_t>> result;
+	for (uint32_t block = 0; block < blockVersions.size(); block++)
+	{
+		if (blockVersions[block] <= seenVersion)
+			continue;
+
+		uint32_t first = block * DIRTY_BLOCK_SIZE;
+		uint32_t end = std::min(first + DIRTY_BLOCK_SIZE, size);
+		if (!result.empty() && result.back().second == first)
+			result.back().second = end;
+		else
+			result.emplace_back(first, end);
+	}
+	return result;
+}
+
+void Scene::writeTransforms(uint32_t first, uint32_t end, InstanceTransform* destination) const
+{
+	for (uint32_t slot = first; slot < end; slot++)
+	{
+		destination[slot - first].position = positions[slot];
+		destination[slot - first].scale = scales[slot];
+	}
+}
+
+void Scene::moveSlot(uint32_t from, uint32_t to)
+{
+	positions[to] = positions[from];
+	scales[to] = scales[from];
+	slotInstances[to] = slotInstances[from];
+	instanceSlots[slotInstances[to]] = to;
+	markDirty(to);
+}
+
+void Scene::markDirty(uint32_t slot)
+{
+	uint32_t block = slot / DIRTY_BLOCK_SIZE;
+	if (block >= blockVersions.size())
+		blockVersions.resize(block + 1);
+	blockVersions[block] = ++version;
+}
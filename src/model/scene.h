@@ -1,8 +1,68 @@
 #pragma once
 #include "../config.h"
 
+// Refers to an instance of the scene, it goes stale once the instance is removed
+struct InstanceHandle {
+	uint32_t index;
+	uint32_t generation;
+};
+
+// Holds the instances of the scene as a structure of arrays. The instances of every mesh occupy one
+// contiguous range, so a mesh is drawn with a single instanced call. Every block of slots remembers
+// the version of its latest change, so that copies of the store only need patching where it changed.
 class Scene {
 	public:
-		Scene();
-		std::unordered_map<meshTypes, std::vector<glm::vec3>> positions;
-};
\ No newline at end of file
+		// Where the instances of a mesh are
+		struct MeshRange {
+			meshTypes type;
+			uint32_t first, count;
+		};
+
+		// \param instanceCount number of cubes to place on a grid
+		Scene(size_t instanceCount = 1);
+
+		// \returns the handle of the new instance
+		InstanceHandle addInstance(meshTypes type, glm::vec3 position, float scale = 1.f);
+
+		// \returns whether the instance was still there
+		bool removeInstance(InstanceHandle instance);
+
+		// \returns whether the instance was still there
+		bool setPosition(InstanceHandle instance, glm::vec3 position);
+
+		bool isAlive(InstanceHandle instance) const;
+
+		size_t instanceCount() const { return positions.size(); }
+
+		// \returns the ranges of every mesh with instances, in the order of the store
+		const std::vector<MeshRange>& meshRanges() const { return ranges; }
+
+		// \returns a number which grows with every change
+		uint64_t currentVersion() const { return version; }
+
+		// \param seenVersion the version the caller is up to date with, 0 for none
+		// \returns the slots changed since, as disjoint [first, end) pairs in slot order
+		std::vector<std::pair<uint32_t, uint32_t>> dirtyRangesSince(uint64_t seenVersion) const;
+
+		// Pack the transforms of the slots [first, end) in the layout of the shaders.
+		void writeTransforms(uint32_t first, uint32_t end, InstanceTransform* destination) const;
+
+	private:
+		// Per slot
+		std::vector<glm::vec3> positions;
+		std::vector<float> scales;
+		std::vector<uint32_t> slotInstances;
+
+		// Per instance index: the slot, and how often the index was reused
+		std::vector<uint32_t> instanceSlots;
+		std::vector<uint32_t> generations;
+		std::vector<uint32_t> freeIndices;
+
+		std::vector<MeshRange> ranges;
+		// Version of the latest change in every block of DIRTY_BLOCK_SIZE slots
+		std::vector<uint64_t> blockVersions;
+		uint64_t version = 0;
+
+		void moveSlot(uint32_t from, uint32_t to);
+		void markDirty(uint32_t slot);
+};
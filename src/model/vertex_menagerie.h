@@ -1,29 +1,47 @@
 #pragma once
 #include "../config.h"
 #include "../view/vkUtil/memory.h"
+#include "../view/vkUtil/staging.h"
 
 struct vertexBufferFinalizationChunk {
 	vk::Device logicalDevice;
 	vk::PhysicalDevice physicalDevice;
-	vk::CommandBuffer commandBuffer;
-	vk::Queue queue;
+	// Vertices and indices are staged here, they have arrived once the ring is finished
+	vkutil::StagingRing* stagingRing;
+	// Queue families using the vertex and index buffers, left empty for the family of the upload queue alone
+	std::vector<uint32_t> queueFamilyIndices;
 };
 
 class VertexMenagerie {
 	public:
 		VertexMenagerie();
 		~VertexMenagerie();
+
+		// Register the vertices and indices of a mesh. Nothing is copied until finalize,
+		// so the data has to stay alive until then. Indices are relative to the mesh.
+		void consume(meshTypes type,
+			const float* vertexData, size_t vertexFloatCount,
+			const uint32_t* indexData, size_t indexCount);
 		void consume(meshTypes type, 
 			std::vector<float>& vertexData, 
 			std::vector<uint32_t>& indexData);
+
+		// Make the vertex and index buffers and stage every consumed mesh straight into them.
 		void finalize(vertexBufferFinalizationChunk finalizationChunk);
 		Buffer vertexBuffer, indexBuffer;
 		std::unordered_map<meshTypes, int> firstIndices;
 		std::unordered_map<meshTypes, int> indexCounts;
+		std::unordered_map<meshTypes, int> vertexOffsets;
 		
 	private:
-		int indexOffset;
+		struct MeshSource {
+			const float* vertexData;
+			size_t vertexFloatCount;
+			const uint32_t* indexData;
+			size_t indexCount;
+		};
+
+		int vertexOffset, indexOffset;
 		vk::Device logicalDevice;
-		std::vector<float> vertexLump;
-		std::vector<uint32_t> indexLump;
-};
\ No newline at end of file
+		std::vector<MeshSource> sources;
+};
@@ -0,0 +1,349 @@
+#include "bake.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <numeric>
+
+#include <glm/ext.hpp>
+
+#include "bake_cache.h"
+#include "bvh.h"
+#include "preprocessing_common.h"
+#include "thread_pool.h"
+#include "triangle_store.h"
+#include "../common/common_definitions.h"
+
+// How often the throughput is reported while baking
+static constexpr std::chrono::seconds REPORT_INTERVAL = std::chrono::seconds(2);
+
+// Counts baked vertices and periodically prints the throughput.
+class BakeProgress {
+  public:
+    BakeProgress(size_t vertexCount, uint32_t raysPerVertex)
+      : vertexCount(vertexCount), raysPerVertex(raysPerVertex)
+      , start(std::chrono::steady_clock::now()), lastReport(0)
+    {}
+
+    void add(size_t vertices)
+    {
+      size_t done = (bakedVertices += vertices);
+
+      // Only one thread gets to print a given report
+      int64_t now = elapsed().count();
+      int64_t last = lastReport.load();
+      if (now - last >= std::chrono::duration_cast<std::chrono::nanoseconds>(REPORT_INTERVAL).count()
+          && lastReport.compare_exchange_strong(last, now))
+        print("Baking", done);
+    }
+
+    void finish() { print("Baked", bakedVertices.load()); }
+
+  private:
+    size_t vertexCount;
+    uint32_t raysPerVertex;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<size_t> bakedVertices = 0;
+    std::atomic<int64_t> lastReport;
+
+    std::chrono::nanoseconds elapsed() const { return std::chrono::steady_clock::now() - start; }
+
+    void print(const char* label, size_t done) const
+    {
+      double seconds = std::chrono::duration<double>(elapsed()).count();
+      std::stringstream message;
+      message << label << ": " << done << "/" << vertexCount << " vertices in " << seconds << " s, "
+        << done / seconds << " vertices/s, " << double(done) * raysPerVertex / seconds << " rays/s\n";
+      std::cout << message.str();
+    }
+};
+
+// Trace the sample directions of a single vertex.
+// \param tracer a BVH or a TriangleStore, anything finding the farthest hit of a ray
+// \param samples receives the data to encode for every direction
+template <typename Tracer>
+static void sample_vertex(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData,
+  const Tracer& tracer, const std::vector<glm::dvec3>& hammersleySequence, float ior, size_t vertexNo, DataToEncode* samples)
+{
+  glm::vec3 vertexPos = {vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo],
+                         vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 1],
+                         vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 2]};
+  glm::vec3 inVertexNormal = {-vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 8],
+                              -vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 9],
+                              -vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 10]};
+
+  // Constructing right-handed orthonormal basis
+  static constexpr glm::vec3 UP = glm::vec3(0.f, 1.f, 0.f);
+  glm::vec3 x_axis = (abs(glm::dot(UP, inVertexNormal)) == 1.f) ? glm::vec3(1.f, 0.f, 0.f) : glm::normalize(glm::cross(UP, inVertexNormal));
+  glm::vec3 y_axis = glm::normalize(cross(inVertexNormal, x_axis));
+  glm::mat3 transform = glm::mat3(x_axis, y_axis, inVertexNormal);
+
+  for (size_t directionNo = 0; directionNo < hammersleySequence.size(); directionNo++)
+  {
+    const glm::dvec3& direction = hammersleySequence[directionNo];
+    float maxWidth = 0.f;
+    uint32_t triangleNo;
+    glm::vec3 refractedDirection = {0.f, 0.f, 0.f};
+
+    // Here we go from vertex reference frame to object reference frame
+    glm::vec3 globalDirection = transform * direction;
+    if (tracer.farthestHit(vertexPos, globalDirection, maxWidth, triangleNo))
+    {
+      uint32_t triangleIndexNo = 3 * triangleNo;
+
+      glm::vec3 triangleNormal0 = {
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo] + 8 ],  // x
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo] + 9 ],  // y
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo] + 10]}; // z
+
+      glm::vec3 triangleNormal1 = {
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 1] + 8 ],
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 1] + 9 ],
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 1] + 10]};
+
+      glm::vec3 triangleNormal2 = {
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 2] + 8 ],
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 2] + 9 ],
+        vertexData[SINGLE_VERTEX_FLOAT_NUM * indexData[triangleIndexNo + 2] + 10]};
+
+      glm::vec3 triangleNormalAvg = glm::normalize((triangleNormal0 + triangleNormal1 + triangleNormal2) / 3.f);
+
+      // Normal is directed inward, eta = IOR of glass since we go from glass to air
+      refractedDirection = glm::refract(globalDirection, -triangleNormalAvg, ior);
+      if (glm::dot(refractedDirection, refractedDirection) > FLT_EPSILON)
+        refractedDirection = glm::normalize(refractedDirection);
+    }
+    samples[directionNo] = DataToEncode(maxWidth, refractedDirection.x, refractedDirection.y, refractedDirection.z);
+  }
+}
+
+// Relative size of the grid positions and normals are snapped to before comparing them,
+// small enough to only merge vertices which are the same up to rounding
+static constexpr double DEDUPLICATION_PRECISION = 1e-6;
+
+// Group the vertices of a mesh which give the same bake results: those split on UV or material seams
+// share their position and normal, which is all the bake depends on.
+// \param uniqueVertices receives the first vertex of every group, in increasing order
+// \param representatives receives the first vertex of the group of every vertex
+static void group_vertices(const std::vector<float>& vertexData,
+  std::vector<uint32_t>& uniqueVertices, std::vector<uint32_t>& representatives)
+{
+  size_t vertexCount = vertexData.size() / SINGLE_VERTEX_FLOAT_NUM;
+  auto attribute = [&](size_t vertexNo, size_t component) { return vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + component]; };
+
+  // Positions are snapped relative to the size of the mesh, normals are unit length
+  float extent = 0.f;
+  for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    for (size_t component = 0; component < 3; component++)
+      extent = std::max(extent, std::abs(attribute(vertexNo, component)));
+  double positionStep = std::max(double(extent), 1e-30) * DEDUPLICATION_PRECISION;
+
+  using Key = std::array<int64_t, 6>;
+  std::vector<Key> keys(vertexCount);
+  for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    for (size_t component = 0; component < 3; component++)
+    {
+      keys[vertexNo][component] = std::llround(attribute(vertexNo, component) / positionStep);
+      keys[vertexNo][3 + component] = std::llround(attribute(vertexNo, 8 + component) / DEDUPLICATION_PRECISION);
+    }
+
+  // Sorting instead of hashing keeps the groups deterministic, the stable sort makes the first vertex lead its group
+  std::vector<uint32_t> order(vertexCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+  representatives.resize(vertexCount);
+  for (size_t orderNo = 0; orderNo < vertexCount; orderNo++)
+    representatives[order[orderNo]] = (orderNo > 0 && keys[order[orderNo]] == keys[order[orderNo - 1]])
+      ? representatives[order[orderNo - 1]] : order[orderNo];
+
+  uniqueVertices.clear();
+  for (uint32_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    if (representatives[vertexNo] == vertexNo)
+      uniqueVertices.push_back(vertexNo);
+}
+
+// Span of time a mesh was worked on, in nanoseconds since the start of the bake.
+// Updated concurrently by every thread which touches the mesh.
+struct MeshTimeSpan {
+  std::atomic<int64_t> first = INT64_MAX;
+  std::atomic<int64_t> last = 0;
+
+  void add(int64_t begin, int64_t end)
+  {
+    int64_t value = first.load();
+    while (begin < value && !first.compare_exchange_weak(value, begin)) {}
+    value = last.load();
+    while (end > value && !last.compare_exchange_weak(value, end)) {}
+  }
+};
+
+static void bake_meshes(std::vector<MeshBakeInput>& meshes, const BakeSettings& settings, std::vector<MeshBakeStats>& stats)
+{
+  auto bakeStart = std::chrono::steady_clock::now();
+  auto sinceStart = [&bakeStart]()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - bakeStart).count();
+  };
+  std::vector<MeshTimeSpan> timeSpans(meshes.size());
+
+  std::vector<glm::dvec3> hammersleySequence = construct_hemisphere_hammersley_sequence(settings.sampleCount);
+  SHBasis basis = make_sh_basis(hammersleySequence);
+  ThreadPool pool(settings.threadCount);
+
+  // The hierarchies or triangle stores are built once per mesh and shared by all vertices and directions.
+  // Only one vertex of every group with the same position and normal is traced.
+  std::vector<std::unique_ptr<BVH>> hierarchies(meshes.size());
+  std::vector<TriangleStore> stores(meshes.size());
+  std::vector<std::vector<uint32_t>> uniqueVertices(meshes.size()), representatives(meshes.size());
+  pool.parallelFor(meshes.size(), 1, [&](size_t begin, size_t end)
+  {
+    for (size_t meshNo = begin; meshNo < end; meshNo++)
+    {
+      int64_t buildStart = sinceStart();
+      if (settings.useBVH)
+        hierarchies[meshNo] = std::make_unique<BVH>(meshes[meshNo].vertexData, meshes[meshNo].indexData);
+      else
+        stores[meshNo] = make_triangle_store(meshes[meshNo].vertexData, meshes[meshNo].indexData);
+      group_vertices(meshes[meshNo].vertexData, uniqueVertices[meshNo], representatives[meshNo]);
+      timeSpans[meshNo].add(buildStart, sinceStart());
+    }
+  });
+
+  // Traced vertices of all meshes form a single index space, so small meshes don't leave threads idle.
+  std::vector<size_t> firstVertices = { 0 };
+  for (const std::vector<uint32_t>& meshUniqueVertices : uniqueVertices)
+    firstVertices.push_back(firstVertices.back() + meshUniqueVertices.size());
+  size_t tracedVertexCount = firstVertices.back();
+
+  BakeProgress progress(tracedVertexCount, settings.sampleCount);
+  pool.parallelFor(tracedVertexCount, settings.chunkSize, [&](size_t begin, size_t end)
+  {
+    int64_t chunkStart = sinceStart();
+
+    // A chunk is sampled first and then projected as a single batch.
+    std::vector<DataToEncode> samples((end - begin) * hammersleySequence.size());
+    std::vector<float> shTerms((end - begin) * SH_COEFFS_NUM * 4);
+
+    size_t firstMeshNo = std::upper_bound(firstVertices.begin(), firstVertices.end(), begin) - firstVertices.begin() - 1;
+    size_t meshNo = firstMeshNo;
+    for (size_t tracedNo = begin; tracedNo < end; tracedNo++)
+    {
+      while (tracedNo >= firstVertices[meshNo + 1])
+        meshNo++;
+      uint32_t vertexNo = uniqueVertices[meshNo][tracedNo - firstVertices[meshNo]];
+      DataToEncode* vertexSamples = &samples[(tracedNo - begin) * hammersleySequence.size()];
+      if (settings.useBVH)
+        sample_vertex(meshes[meshNo].vertexData, meshes[meshNo].indexData, *hierarchies[meshNo],
+          hammersleySequence, settings.ior, vertexNo, vertexSamples);
+      else
+        sample_vertex(meshes[meshNo].vertexData, meshes[meshNo].indexData, stores[meshNo],
+          hammersleySequence, settings.ior, vertexNo, vertexSamples);
+    }
+
+    project_sh_terms(basis, samples.data(), end - begin, shTerms.data());
+
+    meshNo = firstMeshNo;
+    for (size_t tracedNo = begin; tracedNo < end; tracedNo++)
+    {
+      while (tracedNo >= firstVertices[meshNo + 1])
+        meshNo++;
+      uint32_t vertexNo = uniqueVertices[meshNo][tracedNo - firstVertices[meshNo]];
+      std::copy_n(&shTerms[(tracedNo - begin) * SH_COEFFS_NUM * 4], SH_COEFFS_NUM * 4,
+        &meshes[meshNo].vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + SH_COEFFS_OFFSET]);
+    }
+
+    int64_t chunkEnd = sinceStart();
+    for (size_t chunkMeshNo = firstMeshNo; chunkMeshNo <= meshNo; chunkMeshNo++)
+      timeSpans[chunkMeshNo].add(chunkStart, chunkEnd);
+    progress.add(end - begin);
+  });
+  progress.finish();
+
+  // Duplicates get the coefficients of the vertex traced for their group
+  stats.resize(meshes.size());
+  for (size_t meshNo = 0; meshNo < meshes.size(); meshNo++)
+  {
+    std::vector<float>& vertexData = meshes[meshNo].vertexData;
+    const std::vector<uint32_t>& meshRepresentatives = representatives[meshNo];
+    for (size_t vertexNo = 0; vertexNo < meshRepresentatives.size(); vertexNo++)
+      if (meshRepresentatives[vertexNo] != vertexNo)
+        std::copy_n(&vertexData[SINGLE_VERTEX_FLOAT_NUM * meshRepresentatives[vertexNo] + SH_COEFFS_OFFSET], SH_COEFFS_NUM * 4,
+          &vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + SH_COEFFS_OFFSET]);
+
+    size_t vertexCount = meshRepresentatives.size();
+    size_t uniqueCount = uniqueVertices[meshNo].size();
+    std::cout << "Deduplicated " << (meshes[meshNo].objFilepath ? meshes[meshNo].objFilepath : "mesh") << ": "
+      << uniqueCount << "/" << vertexCount << " vertices traced, "
+      << double(vertexCount - uniqueCount) * settings.sampleCount << " rays saved ("
+      << (vertexCount ? 100. * (vertexCount - uniqueCount) / vertexCount : 0.) << "%)\n";
+
+    stats[meshNo].vertexCount = vertexCount;
+    stats[meshNo].tracedVertexCount = uniqueCount;
+    stats[meshNo].seconds = std::max<int64_t>(0, timeSpans[meshNo].last - timeSpans[meshNo].first) * 1.e-9;
+  }
+}
+
+void bake_sh_terms(std::vector<MeshBakeInput>& meshes, const BakeSettings& settings, std::vector<MeshBakeStats>* stats)
+{
+  std::vector<MeshBakeStats> meshStats(meshes.size());
+  std::vector<MeshBakeInput> missedMeshes;
+  std::vector<size_t> missedMeshNos;
+  std::vector<std::optional<uint64_t>> missedKeys; // empty for meshes which aren't cached
+  for (size_t meshNo = 0; meshNo < meshes.size(); meshNo++)
+  {
+    MeshBakeInput& mesh = meshes[meshNo];
+    meshStats[meshNo].vertexCount = mesh.vertexData.size() / SINGLE_VERTEX_FLOAT_NUM;
+
+    // Hashing the OBJ is part of the cost of a warm start, so it counts towards the load time
+    auto start = std::chrono::steady_clock::now();
+    uint64_t key = 0;
+    if (!settings.useCache || mesh.objFilepath == nullptr
+        || !make_bake_cache_key(mesh.objFilepath, mesh.preTransform, settings, key))
+    {
+      missedMeshes.push_back(mesh);
+      missedMeshNos.push_back(meshNo);
+      missedKeys.push_back(std::nullopt);
+      continue;
+    }
+
+    std::string cachePath = bake_cache_path(mesh.objFilepath);
+    if (load_baked_sh_terms(cachePath, key, mesh.vertexData))
+    {
+      meshStats[meshNo].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      meshStats[meshNo].cached = true;
+      std::cout << "Bake cache hit: " << cachePath << " loaded in " << meshStats[meshNo].seconds * 1000. << " ms\n";
+      continue;
+    }
+
+    std::cout << "Bake cache miss: " << mesh.objFilepath << "\n";
+    missedMeshes.push_back(mesh);
+    missedMeshNos.push_back(meshNo);
+    missedKeys.push_back(key);
+  }
+
+  if (!missedMeshes.empty())
+  {
+    std::vector<MeshBakeStats> missedStats;
+    bake_meshes(missedMeshes, settings, missedStats);
+    for (size_t missNo = 0; missNo < missedMeshes.size(); missNo++)
+      meshStats[missedMeshNos[missNo]] = missedStats[missNo];
+  }
+
+  if (stats != nullptr)
+    *stats = meshStats;
+
+  for (size_t meshNo = 0; meshNo < missedMeshes.size(); meshNo++)
+  {
+    const MeshBakeInput& mesh = missedMeshes[meshNo];
+    if (!missedKeys[meshNo])
+      continue;
+
+    std::string cachePath = bake_cache_path(mesh.objFilepath);
+    if (!store_baked_sh_terms(cachePath, *missedKeys[meshNo], mesh.vertexData))
+      std::cout << "Failed to write bake cache " << cachePath << "\n";
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "../config.h"
+
+// Parameters of the spherical harmonics bake
+struct BakeSettings {
+  uint32_t sampleCount = 500;  // directions per vertex
+  float ior = IOR;             // index of refraction of the baked material
+  uint32_t threadCount = 0;    // 0 means one per hardware thread
+  uint32_t chunkSize = 16;     // vertices handed to a thread at once
+  bool useBVH = true;          // false tests every ray against every triangle
+  bool useCache = true;        // reuse results stored next to the assets by earlier bakes
+};
+
+// A mesh to be baked in place. SH coefficients are written into vertexData.
+struct MeshBakeInput {
+  std::vector<float>& vertexData;
+  const std::vector<uint32_t>& indexData;
+  // Source of the mesh, identifies the cached results. Meshes without one are always baked.
+  const char* objFilepath = nullptr;
+  glm::mat4 preTransform = glm::mat4(1.f);
+};
+
+// Timing of a single mesh of a bake
+struct MeshBakeStats {
+  size_t vertexCount = 0;
+  size_t tracedVertexCount = 0; // vertices with distinct positions and normals, the others reuse their results
+  double seconds = 0.;    // from the first to the last piece of work on the mesh, or the cache load time
+  bool cached = false;
+};
+
+// Bake spherical harmonics expansion of width and refracted direction for every vertex of every mesh.
+// Meshes whose inputs didn't change since their last bake are loaded from the cache instead.
+// All vertices of the remaining meshes are distributed over a single pool of threads.
+// \param meshes the meshes to bake
+// \param settings the bake parameters
+// \param stats receives the timing of every mesh if not null
+void bake_sh_terms(std::vector<MeshBakeInput>& meshes, const BakeSettings& settings,
+  std::vector<MeshBakeStats>* stats = nullptr);
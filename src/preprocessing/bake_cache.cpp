@@ -0,0 +1,120 @@
+#include "bake_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "bake.h"
+
+// Bump whenever the bake itself changes in a way which changes its results
+static constexpr uint32_t BAKE_CACHE_VERSION = 1;
+static constexpr char BAKE_CACHE_MAGIC[4] = { 'S', 'H', 'B', 'C' };
+
+struct BakeCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t vertexCount;
+  uint32_t floatsPerVertex;
+  uint32_t reserved;
+};
+
+// 64-bit FNV-1a
+class Hasher {
+  public:
+    void add(const void* data, size_t size)
+    {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    template <typename T>
+    void add(const T& value) { add(&value, sizeof(T)); }
+
+    uint64_t value() const { return hash; }
+
+  private:
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+bool make_bake_cache_key(const char* objFilepath, const glm::mat4& preTransform, const BakeSettings& settings, uint64_t& key)
+{
+  std::ifstream file(objFilepath, std::ios::binary);
+  if (!file)
+    return false;
+
+  Hasher hasher;
+  hasher.add(BAKE_CACHE_VERSION);
+
+  std::vector<char> buffer(1 << 16);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+    hasher.add(buffer.data(), static_cast<size_t>(file.gcount()));
+
+  hasher.add(preTransform);
+  hasher.add(settings.ior);
+  hasher.add(settings.sampleCount);
+  hasher.add(SH_ORDER);
+
+  key = hasher.value();
+  return true;
+}
+
+std::string bake_cache_path(const char* objFilepath)
+{
+  return std::string(objFilepath) + ".shcache";
+}
+
+bool load_baked_sh_terms(const std::string& cachePath, uint64_t key, std::vector<float>& vertexData)
+{
+  std::ifstream file(cachePath, std::ios::binary);
+  if (!file)
+    return false;
+
+  size_t vertexCount = vertexData.size() / SINGLE_VERTEX_FLOAT_NUM;
+  BakeCacheHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+      || std::memcmp(header.magic, BAKE_CACHE_MAGIC, sizeof(BAKE_CACHE_MAGIC)) != 0
+      || header.version != BAKE_CACHE_VERSION || header.key != key
+      || header.vertexCount != vertexCount || header.floatsPerVertex != 4 * SH_COEFFS_NUM)
+    return false;
+
+  std::vector<float> shTerms(vertexCount * 4 * SH_COEFFS_NUM);
+  if (!file.read(reinterpret_cast<char*>(shTerms.data()), shTerms.size() * sizeof(float)))
+    return false;
+
+  for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    std::copy_n(&shTerms[vertexNo * 4 * SH_COEFFS_NUM], 4 * SH_COEFFS_NUM,
+      &vertexData[vertexNo * SINGLE_VERTEX_FLOAT_NUM + SH_COEFFS_OFFSET]);
+  return true;
+}
+
+bool store_baked_sh_terms(const std::string& cachePath, uint64_t key, const std::vector<float>& vertexData)
+{
+  size_t vertexCount = vertexData.size() / SINGLE_VERTEX_FLOAT_NUM;
+  BakeCacheHeader header = {};
+  std::memcpy(header.magic, BAKE_CACHE_MAGIC, sizeof(BAKE_CACHE_MAGIC));
+  header.version = BAKE_CACHE_VERSION;
+  header.key = key;
+  header.vertexCount = vertexCount;
+  header.floatsPerVertex = 4 * SH_COEFFS_NUM;
+
+  std::vector<float> shTerms(vertexCount * 4 * SH_COEFFS_NUM);
+  for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    std::copy_n(&vertexData[vertexNo * SINGLE_VERTEX_FLOAT_NUM + SH_COEFFS_OFFSET], 4 * SH_COEFFS_NUM,
+      &shTerms[vertexNo * 4 * SH_COEFFS_NUM]);
+
+  // Written under a temporary name first, so an interrupted write never leaves a truncated cache behind
+  std::string temporaryPath = cachePath + ".tmp";
+  {
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(shTerms.data()), shTerms.size() * sizeof(float));
+    if (!file)
+      return false;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, cachePath, error);
+  return !error;
+}
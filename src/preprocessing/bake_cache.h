@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../config.h"
+
+struct BakeSettings;
+
+// Hash of everything the baked coefficients of a mesh depend on: the OBJ bytes, the pre-transform,
+// the index of refraction, the sample count and the SH order. A cached bake is only reused when its key matches.
+// \param objFilepath the OBJ file the mesh was loaded from
+// \param preTransform the transform applied to the mesh while loading
+// \param settings the bake parameters
+// \param key receives the hash
+// \returns whether the OBJ file could be read
+bool make_bake_cache_key(const char* objFilepath, const glm::mat4& preTransform, const BakeSettings& settings, uint64_t& key);
+
+// \returns the cache file path of an asset, the cache is stored next to it
+std::string bake_cache_path(const char* objFilepath);
+
+// Copy cached SH coefficients into the vertices of a mesh.
+// \param cachePath the cache file
+// \param key the key of the current inputs
+// \param vertexData interleaved vertex attributes, SINGLE_VERTEX_FLOAT_NUM floats per vertex
+// \returns whether the cache exists, matches the key and the vertex count and was read completely
+bool load_baked_sh_terms(const std::string& cachePath, uint64_t key, std::vector<float>& vertexData);
+
+// Write the SH coefficients of a baked mesh, replacing any previous cache of the asset.
+// \returns whether the cache was written
+bool store_baked_sh_terms(const std::string& cachePath, uint64_t key, const std::vector<float>& vertexData);
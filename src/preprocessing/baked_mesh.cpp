@@ -0,0 +1,95 @@
+#include "baked_mesh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "bake_cache.h"
+
+static constexpr char BAKED_MESH_MAGIC[4] = { 'B', 'A', 'K', 'D' };
+
+static uint64_t align_offset(uint64_t offset)
+{
+  return (offset + BAKED_MESH_ALIGNMENT - 1) / BAKED_MESH_ALIGNMENT * BAKED_MESH_ALIGNMENT;
+}
+
+bool write_baked_mesh(const std::string& path, const BakedMesh& mesh)
+{
+  BakedMeshHeader header = {};
+  std::memcpy(header.magic, BAKED_MESH_MAGIC, sizeof(BAKED_MESH_MAGIC));
+  header.version = BAKED_MESH_VERSION;
+  header.headerSize = sizeof(BakedMeshHeader);
+  header.vertexCount = mesh.vertexData.size() / mesh.floatsPerVertex;
+  header.indexCount = mesh.indexData.size();
+  header.vertexOffset = align_offset(sizeof(BakedMeshHeader));
+  header.indexOffset = align_offset(header.vertexOffset + mesh.vertexData.size() * sizeof(float));
+  header.floatsPerVertex = mesh.floatsPerVertex;
+  header.shOrder = mesh.shOrder;
+  header.ior = mesh.ior;
+  header.sampleCount = mesh.sampleCount;
+  std::memcpy(header.preTransform, &mesh.preTransform[0][0], sizeof(header.preTransform));
+  header.bakeKey = mesh.bakeKey;
+
+  const char padding[BAKED_MESH_ALIGNMENT] = {};
+  uint64_t vertexEnd = header.vertexOffset + mesh.vertexData.size() * sizeof(float);
+
+  // Written under a temporary name first, so an interrupted write never leaves a truncated mesh behind
+  std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding, header.vertexOffset - sizeof(header));
+    file.write(reinterpret_cast<const char*>(mesh.vertexData.data()), mesh.vertexData.size() * sizeof(float));
+    file.write(padding, header.indexOffset - vertexEnd);
+    file.write(reinterpret_cast<const char*>(mesh.indexData.data()), mesh.indexData.size() * sizeof(uint32_t));
+    if (!file)
+      return false;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  return !error;
+}
+
+bool BakedMeshView::open(const std::string& path)
+{
+  if (!file.open(path))
+    return false;
+  if (file.size() < sizeof(BakedMeshHeader))
+  {
+    file.close();
+    return false;
+  }
+
+  // Every section has to lie within the file, a truncated or foreign file is never read past its end
+  const BakedMeshHeader& fileHeader = header();
+  bool valid = std::memcmp(fileHeader.magic, BAKED_MESH_MAGIC, sizeof(BAKED_MESH_MAGIC)) == 0
+    && fileHeader.version == BAKED_MESH_VERSION && fileHeader.headerSize >= sizeof(BakedMeshHeader)
+    && fileHeader.shOrder == SH_ORDER && fileHeader.floatsPerVertex == SINGLE_VERTEX_FLOAT_NUM
+    && fileHeader.vertexOffset % alignof(float) == 0 && fileHeader.indexOffset % alignof(uint32_t) == 0
+    && fileHeader.vertexOffset <= file.size()
+    && fileHeader.vertexCount <= (file.size() - fileHeader.vertexOffset) / (sizeof(float) * fileHeader.floatsPerVertex)
+    && fileHeader.indexOffset <= file.size()
+    && fileHeader.indexCount <= (file.size() - fileHeader.indexOffset) / sizeof(uint32_t);
+
+  // The indices go to the GPU as they are, one past the vertices would read outside of the vertex buffer
+  valid = valid && std::all_of(indexData(), indexData() + indexCount(),
+    [&fileHeader](uint32_t index) { return index < fileHeader.vertexCount; });
+  if (!valid)
+    file.close();
+  return valid;
+}
+
+bool BakedMeshView::bakedWith(const char* objFilepath, const BakeSettings& settings, const glm::mat4& preTransform) const
+{
+  // The key covers the OBJ bytes, the pre-transform, the IOR, the sample count and the SH order
+  uint64_t key;
+  return make_bake_cache_key(objFilepath, preTransform, settings, key) && header().bakeKey == key;
+}
+
+glm::mat4 BakedMeshView::preTransform() const
+{
+  glm::mat4 transform;
+  std::memcpy(&transform[0][0], header().preTransform, sizeof(header().preTransform));
+  return transform;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../config.h"
+#include "bake.h"
+#include "mapped_file.h"
+
+// Layout of a baked mesh file. Everything is little-endian and the sections start at multiples of
+// BAKED_MESH_ALIGNMENT, so a mapped file can be used in place:
+//   header | padding | vertices (vertexCount * floatsPerVertex floats) | padding | indices (indexCount uint32s)
+static constexpr uint32_t BAKED_MESH_VERSION = 3;
+static constexpr size_t BAKED_MESH_ALIGNMENT = 64;
+
+struct BakedMeshHeader {
+  char magic[4];          // "BAKD"
+  uint32_t version;
+  uint32_t headerSize;    // sizeof(BakedMeshHeader), lets readers skip fields added later
+  uint32_t reserved;
+  uint64_t vertexCount;
+  uint64_t indexCount;
+  uint64_t vertexOffset;  // bytes from the start of the file
+  uint64_t indexOffset;
+  // Bake metadata
+  uint32_t floatsPerVertex;
+  uint32_t shOrder;
+  float ior;
+  uint32_t sampleCount;
+  float preTransform[16]; // column-major, applied to the mesh before baking
+  uint64_t bakeKey;       // make_bake_cache_key of the inputs, changes whenever the OBJ does
+};
+static_assert(sizeof(BakedMeshHeader) == 136, "The header is part of the file format");
+
+// A mesh with its SH coefficients baked in, as written by the offline preprocessor.
+// Vertices are interleaved, floatsPerVertex floats each, in the layout of config.h.
+struct BakedMesh {
+  std::vector<float> vertexData;
+  std::vector<uint32_t> indexData;
+  uint32_t floatsPerVertex = SINGLE_VERTEX_FLOAT_NUM;
+  uint32_t shOrder = SH_ORDER;
+  float ior = IOR;
+  uint32_t sampleCount = 0;
+  glm::mat4 preTransform = glm::mat4(1.f);
+  uint64_t bakeKey = 0;
+};
+
+// Write a baked mesh, replacing any previous file.
+// \returns whether the file was written completely
+bool write_baked_mesh(const std::string& path, const BakedMesh& mesh);
+
+// A memory mapped baked mesh. Vertices and indices point into the mapping and stay valid while it is open.
+class BakedMeshView {
+  public:
+    // Map a baked mesh. The SH order of the file has to match the one the program was built with.
+    // \returns whether the file is a complete baked mesh of the current version and order, indexing only its own vertices
+    bool open(const std::string& path);
+
+    // Check that the mesh was baked from the current contents of its OBJ with these settings.
+    // The OBJ is read and hashed, a file edited after the bake gives a different key.
+    // \returns whether the key stored in the header matches the one of these inputs
+    bool bakedWith(const char* objFilepath, const BakeSettings& settings, const glm::mat4& preTransform) const;
+
+    const BakedMeshHeader& header() const { return *reinterpret_cast<const BakedMeshHeader*>(file.data()); }
+    glm::mat4 preTransform() const;
+
+    const float* vertexData() const { return reinterpret_cast<const float*>(file.data() + header().vertexOffset); }
+    size_t vertexFloatCount() const { return header().vertexCount * header().floatsPerVertex; }
+    const uint32_t* indexData() const { return reinterpret_cast<const uint32_t*>(file.data() + header().indexOffset); }
+    size_t indexCount() const { return header().indexCount; }
+
+  private:
+    MappedFile file;
+};
@@ -0,0 +1,304 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+static constexpr int SAH_BIN_COUNT = 16;
+static constexpr uint32_t MAX_LEAF_SIZE = TRIANGLE_PACKET_SIZE;
+static constexpr int MAX_TRAVERSAL_DEPTH = 64;
+
+// Relative cost of visiting a node compared to testing a packet of triangles
+static constexpr float TRAVERSAL_COST = 1.f;
+
+namespace {
+  struct AABB {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+    void grow(const AABB& box) { min = glm::min(min, box.min); max = glm::max(max, box.max); }
+
+    float area() const
+    {
+      glm::vec3 extent = max - min;
+      return (extent.x < 0.f) ? 0.f : 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+  };
+
+  struct BuildTriangle {
+    AABB bounds;
+    glm::vec3 centroid;
+    uint32_t index;
+  };
+
+  struct Bin {
+    AABB bounds;
+    uint32_t count = 0;
+  };
+
+  struct BuildContext {
+    std::vector<BuildTriangle>& buildTriangles;
+    std::vector<BVHNode>& nodes;
+    float padding;
+  };
+}
+
+// Leaves are tested a whole packet at a time, so that's what their cost is counted in.
+static float packet_count(uint32_t triangleCount)
+{
+  return static_cast<float>((triangleCount + TRIANGLE_PACKET_SIZE - 1) / TRIANGLE_PACKET_SIZE);
+}
+
+// Slab test. NaNs produced by rays starting exactly on a slab plane are treated as overlaps,
+// which keeps the test conservative.
+// \returns whether the ray overlaps the node, tFar is set to the exit distance
+static bool ray_intersects_node(
+  const glm::vec3& origin, const glm::vec3& invDirection, const BVHNode& node, float& tFar)
+{
+  float tNear = 0.f;
+  tFar = std::numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float t0 = (node.boundsMin[axis] - origin[axis]) * invDirection[axis];
+    float t1 = (node.boundsMax[axis] - origin[axis]) * invDirection[axis];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    tNear = t0 > tNear ? t0 : tNear;
+    tFar  = t1 < tFar  ? t1 : tFar;
+  }
+  return tNear <= tFar;
+}
+
+static uint32_t build_recursive(BuildContext& context, uint32_t begin, uint32_t end, int depth)
+{
+  std::vector<BuildTriangle>& buildTriangles = context.buildTriangles;
+
+  AABB bounds, centroidBounds;
+  for (uint32_t i = begin; i < end; i++)
+  {
+    bounds.grow(buildTriangles[i].bounds);
+    centroidBounds.grow(buildTriangles[i].centroid);
+  }
+
+  uint32_t nodeIndex = static_cast<uint32_t>(context.nodes.size());
+  context.nodes.push_back({});
+  BVHNode node;
+  node.boundsMin = bounds.min - context.padding;
+  node.boundsMax = bounds.max + context.padding;
+
+  uint32_t triangleCount = end - begin;
+  auto makeLeaf = [&]()
+  {
+    node.offset = begin;
+    node.triangleCount = triangleCount;
+    context.nodes[nodeIndex] = node;
+    return nodeIndex;
+  };
+
+  // The depth limit keeps the traversal stack bounded even for degenerate inputs.
+  if (triangleCount <= 2 || depth >= MAX_TRAVERSAL_DEPTH - 1)
+    return makeLeaf();
+
+  // Binned SAH: find the cheapest split plane among SAH_BIN_COUNT candidates on each axis.
+  float bestCost = std::numeric_limits<float>::max();
+  int bestAxis = -1, bestSplit = 0;
+  glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+  for (int axis = 0; axis < 3; axis++)
+  {
+    if (centroidExtent[axis] <= 0.f)
+      continue;
+
+    std::array<Bin, SAH_BIN_COUNT> bins;
+    float scale = SAH_BIN_COUNT / centroidExtent[axis];
+    for (uint32_t i = begin; i < end; i++)
+    {
+      int binIndex = std::min(SAH_BIN_COUNT - 1,
+        static_cast<int>((buildTriangles[i].centroid[axis] - centroidBounds.min[axis]) * scale));
+      bins[binIndex].count++;
+      bins[binIndex].bounds.grow(buildTriangles[i].bounds);
+    }
+
+    // Sweep from the right to get the cost of every right side, then from the left to evaluate the splits.
+    std::array<float, SAH_BIN_COUNT - 1> rightAreas;
+    std::array<uint32_t, SAH_BIN_COUNT - 1> rightCounts;
+    AABB rightBox;
+    uint32_t rightCount = 0;
+    for (int i = SAH_BIN_COUNT - 1; i > 0; i--)
+    {
+      rightBox.grow(bins[i].bounds);
+      rightCount += bins[i].count;
+      rightAreas[i - 1] = rightBox.area();
+      rightCounts[i - 1] = rightCount;
+    }
+
+    AABB leftBox;
+    uint32_t leftCount = 0;
+    for (int i = 0; i < SAH_BIN_COUNT - 1; i++)
+    {
+      leftBox.grow(bins[i].bounds);
+      leftCount += bins[i].count;
+      if (leftCount == 0 || rightCounts[i] == 0)
+        continue;
+
+      float cost = leftBox.area() * packet_count(leftCount) + rightAreas[i] * packet_count(rightCounts[i]);
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i;
+      }
+    }
+  }
+
+  float leafCost = packet_count(triangleCount);
+  float splitCost = TRAVERSAL_COST + bestCost / std::max(bounds.area(), std::numeric_limits<float>::min());
+
+  uint32_t middle;
+  if (bestAxis == -1 || (splitCost >= leafCost && triangleCount <= MAX_LEAF_SIZE))
+  {
+    if (triangleCount <= MAX_LEAF_SIZE)
+      return makeLeaf();
+
+    // All centroids coincide or no split pays off, but the leaf would be too large: split by count.
+    middle = begin + triangleCount / 2;
+  }
+  else
+  {
+    float scale = SAH_BIN_COUNT / centroidExtent[bestAxis];
+    auto isLeft = [&](const BuildTriangle& triangle)
+    {
+      int binIndex = std::min(SAH_BIN_COUNT - 1,
+        static_cast<int>((triangle.centroid[bestAxis] - centroidBounds.min[bestAxis]) * scale));
+      return binIndex <= bestSplit;
+    };
+    // Stable partition keeps the build deterministic and leaves triangles in index buffer order inside leaves.
+    middle = static_cast<uint32_t>(
+      std::stable_partition(buildTriangles.begin() + begin, buildTriangles.begin() + end, isLeft)
+      - buildTriangles.begin());
+  }
+
+  node.triangleCount = 0;
+  build_recursive(context, begin, middle, depth + 1); // the first child is always nodeIndex + 1
+  node.offset = build_recursive(context, middle, end, depth + 1);
+  context.nodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+BVH::BVH(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData)
+{
+  uint32_t triangleCount = static_cast<uint32_t>(indexData.size() / 3);
+  auto getPosition = [&vertexData](uint32_t vertexNo)
+  {
+    return glm::vec3(vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo    ],
+                     vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 1],
+                     vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 2]);
+  };
+
+  std::vector<BuildTriangle> buildTriangles(triangleCount);
+  AABB sceneBounds;
+  for (uint32_t i = 0; i < triangleCount; i++)
+  {
+    BuildTriangle& triangle = buildTriangles[i];
+    triangle.index = i;
+    triangle.bounds.grow(getPosition(indexData[3 * i    ]));
+    triangle.bounds.grow(getPosition(indexData[3 * i + 1]));
+    triangle.bounds.grow(getPosition(indexData[3 * i + 2]));
+    triangle.centroid = 0.5f * (triangle.bounds.min + triangle.bounds.max);
+    sceneBounds.grow(triangle.bounds);
+  }
+
+  if (triangleCount == 0)
+    return;
+
+  // Boxes are padded a little so that rounding in the slab test never culls a triangle
+  // which the ray-triangle test would have reported as hit.
+  float padding = 1.e-4f * glm::length(sceneBounds.max - sceneBounds.min) + 1.e-6f;
+  BuildContext context = { buildTriangles, nodes, padding };
+  nodes.reserve(2 * triangleCount);
+  build_recursive(context, 0, triangleCount, 0);
+  nodes.shrink_to_fit();
+
+  // Every leaf gets packets of its own, so a leaf is tested without touching triangles of other leaves.
+  for (BVHNode& node : nodes)
+  {
+    if (node.triangleCount == 0)
+      continue;
+
+    uint32_t firstPacket = triangles.packetCount();
+    for (uint32_t i = node.offset; i < node.offset + node.triangleCount; i++)
+    {
+      const BuildTriangle& triangle = buildTriangles[i];
+      triangles.add(getPosition(indexData[3 * triangle.index    ]),
+                    getPosition(indexData[3 * triangle.index + 1]),
+                    getPosition(indexData[3 * triangle.index + 2]), triangle.index);
+    }
+    triangles.finishPacket();
+    node.offset = firstPacket;
+  }
+}
+
+bool BVH::farthestHit(const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& triangle) const
+{
+  if (nodes.empty())
+    return false;
+
+  glm::vec3 invDirection = 1.f / direction;
+
+  // Unlike the usual closest hit query, the current best distance doesn't shrink the ray,
+  // it only allows skipping nodes which the ray leaves before reaching it.
+  float maxDistance = 0.f;
+  uint32_t hitTriangle = std::numeric_limits<uint32_t>::max();
+
+  struct StackEntry { uint32_t node; float tFar; };
+  StackEntry stack[MAX_TRAVERSAL_DEPTH];
+  int stackSize = 0;
+
+  float rootFar;
+  if (!ray_intersects_node(origin, invDirection, nodes[0], rootFar))
+    return false;
+  stack[stackSize++] = { 0, rootFar };
+
+  while (stackSize > 0)
+  {
+    StackEntry entry = stack[--stackSize];
+    if (entry.tFar < maxDistance)
+      continue;
+
+    const BVHNode& node = nodes[entry.node];
+    if (node.triangleCount > 0)
+    {
+      // The leaf is searched on its own, a tie with the best hit so far goes to the lower triangle number.
+      float width = 0.f;
+      uint32_t leafTriangle;
+      uint32_t packetCount = (node.triangleCount + TRIANGLE_PACKET_SIZE - 1) / TRIANGLE_PACKET_SIZE;
+      if (triangles.farthestHit(node.offset, packetCount, origin, direction, width, leafTriangle)) [[unlikely]]
+        if (width > maxDistance || (width == maxDistance && leafTriangle < hitTriangle))
+        {
+          maxDistance = width;
+          hitTriangle = leafTriangle;
+        }
+      continue;
+    }
+
+    uint32_t children[2] = { entry.node + 1, node.offset };
+    float tFar[2];
+    bool hit[2] = {
+      ray_intersects_node(origin, invDirection, nodes[children[0]], tFar[0]),
+      ray_intersects_node(origin, invDirection, nodes[children[1]], tFar[1])
+    };
+
+    // The child the ray leaves last is the most promising one, so it is pushed last and popped first.
+    int first = (tFar[0] > tFar[1]) ? 1 : 0;
+    for (int i : { first, 1 - first })
+      if (hit[i] && tFar[i] >= maxDistance)
+        stack[stackSize++] = { children[i], tFar[i] };
+  }
+
+  if (hitTriangle == std::numeric_limits<uint32_t>::max())
+    return false;
+
+  distance = maxDistance;
+  triangle = hitTriangle;
+  return true;
+}
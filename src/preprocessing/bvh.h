@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "triangle_store.h"
+
+// A node of a flattened bounding volume hierarchy.
+// Nodes are stored in depth-first order, so the first child of an interior node always directly follows it
+// and only the index of the second child has to be kept. This way a node takes 32 bytes and two of them
+// fit into a single cache line.
+struct BVHNode {
+  glm::vec3 boundsMin;
+  uint32_t offset; // index of the first triangle packet for a leaf, index of the second child for an interior node
+  glm::vec3 boundsMax;
+  uint32_t triangleCount; // zero for interior nodes
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is expected to take exactly half of a cache line");
+
+// Bounding volume hierarchy over the triangles of a single mesh, built once and queried by the SH bake.
+class BVH {
+  public:
+    // Build the hierarchy using the surface area heuristic.
+    // \param vertexData interleaved vertex attributes, SINGLE_VERTEX_FLOAT_NUM floats per vertex
+    // \param indexData triangle list indexing into vertexData
+    BVH(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData);
+
+    // Find the farthest intersection of a ray with the mesh.
+    // Ties are resolved in favour of the triangle which comes first in the index buffer,
+    // so the result is the same as the one of a brute force loop over all triangles.
+    // \param origin the ray origin
+    // \param direction the ray direction
+    // \param distance distance to the farthest intersection, only written on a hit
+    // \param triangle number of the hit triangle in the index buffer (first index / 3), only written on a hit
+    // \returns whether the ray intersects the mesh at all
+    bool farthestHit(const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& triangle) const;
+
+    size_t nodeCount() const { return nodes.size(); }
+
+  private:
+    std::vector<BVHNode> nodes;
+    // Triangles reordered so that every leaf references its own contiguous range of packets
+    TriangleStore triangles;
+};
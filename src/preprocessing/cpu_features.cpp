@@ -0,0 +1,20 @@
+#include "cpu_features.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+bool cpu_supports_avx()
+{
+#if !defined(PREPROCESSING_X86)
+  return false;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+  return __builtin_cpu_supports("avx");
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// SIMD kernels are compiled for instruction sets the build doesn't target and picked at runtime.
+// MSVC allows intrinsics of any instruction set anywhere, GCC and Clang need them enabled per function.
+#if defined(__x86_64__) || defined(_M_X64)
+#define PREPROCESSING_X86
+#include <immintrin.h>
+#endif
+
+#if defined(PREPROCESSING_X86) && !defined(_MSC_VER)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+
+// \returns whether both the CPU and the OS support AVX, the latter has to save the upper halves of the registers
+bool cpu_supports_avx();
@@ -0,0 +1,111 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this != &other)
+  {
+    close();
+    std::swap(bytes, other.bytes);
+    std::swap(byteCount, other.byteCount);
+#ifdef _WIN32
+    std::swap(fileHandle, other.fileHandle);
+    std::swap(mappingHandle, other.mappingHandle);
+#endif
+  }
+  return *this;
+}
+
+bool MappedFile::open(const std::string& path)
+{
+  close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (view == nullptr)
+  {
+    if (mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  fileHandle = file;
+  mappingHandle = mapping;
+  bytes = static_cast<const unsigned char*>(view);
+  byteCount = static_cast<size_t>(fileSize.QuadPart);
+#else
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return false;
+
+  struct stat status;
+  if (fstat(file, &status) != 0 || status.st_size == 0)
+  {
+    ::close(file);
+    return false;
+  }
+
+  // The mapping keeps its own reference to the file
+  void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+  ::close(file);
+  if (view == MAP_FAILED)
+    return false;
+
+  bytes = static_cast<const unsigned char*>(view);
+  byteCount = static_cast<size_t>(status.st_size);
+#endif
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (bytes == nullptr)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(bytes);
+  CloseHandle(mappingHandle);
+  CloseHandle(fileHandle);
+  fileHandle = nullptr;
+  mappingHandle = nullptr;
+#else
+  munmap(const_cast<unsigned char*>(bytes), byteCount);
+#endif
+  bytes = nullptr;
+  byteCount = 0;
+}
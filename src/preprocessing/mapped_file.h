@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A read-only memory mapping of a whole file. Pages are read from disk on first access,
+// so nothing is copied until the contents are actually used.
+class MappedFile {
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Map a file, replacing any previous mapping.
+    // \returns whether the file exists, isn't empty and could be mapped
+    bool open(const std::string& path);
+
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return byteCount; }
+
+  private:
+    const unsigned char* bytes = nullptr;
+    size_t byteCount = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
@@ -1,38 +1,18 @@
 #include "preprocessing_common.h"
 
 #include <algorithm>
-#include <execution>
 
 #include <glm/ext.hpp>
 
-// Spherical harmonics without constant terms
-static double Y00 (glm::dvec3 dir) { return 1.; }
-
-static double Y1m1(glm::dvec3 dir) { return dir.y; }
-static double Y10 (glm::dvec3 dir) { return dir.z; }
-static double Y11 (glm::dvec3 dir) { return dir.x; }
-
-static double Y2m2(glm::dvec3 dir) { return dir.x * dir.y; }
-static double Y2m1(glm::dvec3 dir) { return dir.y * dir.z; }
-static double Y20 (glm::dvec3 dir) { return 3. * dir.z * dir.z - 1.; }
-static double Y21 (glm::dvec3 dir) { return dir.x * dir.z; }
-static double Y22 (glm::dvec3 dir) { return dir.x * dir.x - dir.y * dir.y; }
-
-static const std::vector<std::function<double(glm::dvec3)>> SPHERICAL_HARMONICS = {
-  Y00, Y1m1, Y10, Y11, Y2m2, Y2m1, Y20, Y21, Y22 
-};
-
-static const std::vector<float> SH_CONSTANTS_SQUARED = {
-  1.f / (4.f * glm::pi<float>()),
-  3.f / (4.f * glm::pi<float>()),
-  3.f / (4.f * glm::pi<float>()),
-  3.f / (4.f * glm::pi<float>()),
-  15.f / (4.f * glm::pi<float>()),
-  15.f / (4.f * glm::pi<float>()),
-  5.f / (16.f * glm::pi<float>()),
-  15.f / (4.f * glm::pi<float>()),
-  15.f / (16.f * glm::pi<float>())
-};
+#include "cpu_features.h"
+#include "spherical_harmonics.h"
+
+// Number of directions of the basis multiplied against all vertices of a batch before moving on.
+// 128 directions of the basis take 9 KiB, which stays in L1 while the batch streams by.
+static constexpr size_t SH_BLOCK_DIRECTIONS = 128;
+
+// Normalization constants are computed in double at compile time and only then rounded
+static constexpr std::array<double, SH_COEFFS_NUM> SH_CONSTANTS_SQUARED = sh::normalization_squared<SH_ORDER>();
 
 static double van_der_corput_sequence(uint32_t bits)
 {
@@ -68,34 +48,80 @@ std::vector<glm::dvec3> construct_hemisphere_hammersley_sequence(uint32_t numPoi
   return hammersleySequence;
 }
 
-std::vector<float> calculate_sh_terms(
-  std::vector<glm::dvec3> hammersleySequence, std::function<DataToEncode(glm::dvec3)> getDataToEncode
-) {
-  std::vector<double> shTermsSums(SPHERICAL_HARMONICS.size() * 4, 0.);
-
-  std::for_each(
-    std::execution::par,
-    hammersleySequence.begin(),
-    hammersleySequence.end(),
-    [&getDataToEncode, &shTermsSums](auto&& direction)
-    {
-      DataToEncode data = getDataToEncode(direction);
-      for (int i = 0; i < SPHERICAL_HARMONICS.size(); i++)
-      {
-        shTermsSums[i + 0 * SPHERICAL_HARMONICS.size()] += SPHERICAL_HARMONICS[i](direction) * data.width;
-        shTermsSums[i + 1 * SPHERICAL_HARMONICS.size()] += SPHERICAL_HARMONICS[i](direction) * data.x;
-        shTermsSums[i + 2 * SPHERICAL_HARMONICS.size()] += SPHERICAL_HARMONICS[i](direction) * data.y;
-        shTermsSums[i + 3 * SPHERICAL_HARMONICS.size()] += SPHERICAL_HARMONICS[i](direction) * data.z;
-      }
-    });
-
-  std::vector<float> shTerms;
-  shTerms.reserve(shTermsSums.size());
-  for (int i = 0; i < shTermsSums.size(); i++)
-    shTerms.push_back(
-      float(shTermsSums[i] * 2. * glm::pi<double>() / double(hammersleySequence.size()))
-      * SH_CONSTANTS_SQUARED[i % SPHERICAL_HARMONICS.size()]
-    );
-
-  return shTerms;
+SHBasis make_sh_basis(const std::vector<glm::dvec3>& directions)
+{
+  SHBasis basis;
+  basis.directionCount = directions.size();
+  basis.values.resize(directions.size() * SH_COEFFS_NUM);
+  for (size_t directionNo = 0; directionNo < directions.size(); directionNo++)
+    sh::evaluate_basis<SH_ORDER>(directions[directionNo].x, directions[directionNo].y, directions[directionNo].z,
+      &basis.values[directionNo * SH_COEFFS_NUM]);
+  return basis;
+}
+
+// Accumulate a block of directions of a single vertex: sums[i][channel] += basis[d][i] * samples[d][channel].
+// Both kernels add the products of every sum in order of directions with separate multiplies and adds,
+// so they produce bit-identical results.
+static void accumulate_sh_block_scalar(const double* basis, const DataToEncode* samples, size_t directionCount, double* sums)
+{
+  for (size_t directionNo = 0; directionNo < directionCount; directionNo++)
+  {
+    const DataToEncode& sample = samples[directionNo];
+    const double channels[4] = { sample.width, sample.x, sample.y, sample.z };
+    for (uint32_t i = 0; i < SH_COEFFS_NUM; i++)
+      for (int channel = 0; channel < 4; channel++)
+        sums[4 * i + channel] += basis[SH_COEFFS_NUM * directionNo + i] * channels[channel];
+  }
+}
+
+#ifdef PREPROCESSING_X86
+// The four channels of a sample fill a register, the 9 sums are kept in registers for the whole block.
+TARGET_AVX static void accumulate_sh_block_avx(const double* basis, const DataToEncode* samples, size_t directionCount, double* sums)
+{
+  __m256d accumulators[SH_COEFFS_NUM];
+  for (uint32_t i = 0; i < SH_COEFFS_NUM; i++)
+    accumulators[i] = _mm256_loadu_pd(sums + 4 * i);
+
+  for (size_t directionNo = 0; directionNo < directionCount; directionNo++)
+  {
+    static_assert(sizeof(DataToEncode) == 4 * sizeof(float), "DataToEncode is loaded as a single vector");
+    __m256d channels = _mm256_cvtps_pd(_mm_loadu_ps(&samples[directionNo].width));
+    const double* harmonics = basis + SH_COEFFS_NUM * directionNo;
+    for (uint32_t i = 0; i < SH_COEFFS_NUM; i++)
+      accumulators[i] = _mm256_add_pd(accumulators[i], _mm256_mul_pd(_mm256_broadcast_sd(harmonics + i), channels));
+  }
+
+  for (uint32_t i = 0; i < SH_COEFFS_NUM; i++)
+    _mm256_storeu_pd(sums + 4 * i, accumulators[i]);
+}
+#endif
+
+void project_sh_terms(const SHBasis& basis, const DataToEncode* samples, size_t vertexCount, float* shTerms)
+{
+  using AccumulateBlock = void (*)(const double*, const DataToEncode*, size_t, double*);
+  static const AccumulateBlock accumulateBlock =
+#ifdef PREPROCESSING_X86
+    cpu_supports_avx() ? accumulate_sh_block_avx :
+#endif
+    accumulate_sh_block_scalar;
+
+  const size_t directionCount = basis.directionCount;
+  std::vector<double> sums(vertexCount * SH_COEFFS_NUM * 4, 0.);
+
+  // Blocking over directions keeps a slice of the basis hot in cache while every vertex of the batch uses it.
+  for (size_t blockBegin = 0; blockBegin < directionCount; blockBegin += SH_BLOCK_DIRECTIONS)
+  {
+    size_t blockSize = std::min(SH_BLOCK_DIRECTIONS, directionCount - blockBegin);
+    for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+      accumulateBlock(&basis.values[SH_COEFFS_NUM * blockBegin], samples + vertexNo * directionCount + blockBegin,
+        blockSize, &sums[vertexNo * SH_COEFFS_NUM * 4]);
+  }
+
+  // Sums are already laid out as the coefficients, (width, x, y, z) for every harmonic.
+  for (size_t vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+    for (uint32_t i = 0; i < SH_COEFFS_NUM; i++)
+      for (int channel = 0; channel < 4; channel++)
+        shTerms[vertexNo * SH_COEFFS_NUM * 4 + 4 * i + channel] =
+          float(sums[vertexNo * SH_COEFFS_NUM * 4 + 4 * i + channel] * 2. * glm::pi<double>() / double(directionCount))
+          * float(SH_CONSTANTS_SQUARED[i]);
 }
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <functional>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -11,6 +10,19 @@
 // Otherwise, precision is lost.
 std::vector<glm::dvec3> construct_hemisphere_hammersley_sequence(uint32_t numPoints);
 
-std::vector<float> calculate_sh_terms(
-  std::vector<glm::dvec3> hammersleySequence, std::function<DataToEncode(glm::dvec3)> getDataToEncode
-);
+// Spherical harmonics of order SH_ORDER evaluated once for every direction of a sample set, SH_COEFFS_NUM values per direction.
+// Projecting samples of a vertex is then a product of its directionCount x 4 samples with this matrix.
+struct SHBasis {
+  std::vector<double> values;
+  size_t directionCount = 0;
+};
+
+SHBasis make_sh_basis(const std::vector<glm::dvec3>& directions);
+
+// Project data sampled over the hemisphere by a batch of vertices onto spherical harmonics.
+// Every coefficient is summed over the directions in order, so the result doesn't depend on the batch size.
+// \param basis the basis of the sample directions
+// \param samples basis.directionCount samples for every vertex, vertex after vertex
+// \param vertexCount number of vertices in the batch
+// \param shTerms receives (width, x, y, z) for each of the SH_COEFFS_NUM coefficients of every vertex
+void project_sh_terms(const SHBasis& basis, const DataToEncode* samples, size_t vertexCount, float* shTerms);
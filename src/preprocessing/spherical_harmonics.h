@@ -0,0 +1,236 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <numbers>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// Real spherical harmonics of order L (0..4) with everything but the evaluation done at compile time.
+//
+// Every harmonic is kept as a polynomial of the direction scaled to the smallest integer coefficients:
+// P_l^m = D_l^m(z) * C_m(x, y) for m >= 0 and P_l^m = D_l^|m|(z) * S_|m|(x, y) for m < 0,
+// where D_l^m is the m-th derivative of the Legendre polynomial and C_m + i * S_m = (x + i * y)^m.
+// Then Y_l^m = K_l^m * P_l^m. Projection multiplies samples by K^2 * P, so reconstruction,
+// which is what the shaders do, only needs P.
+// Coefficients are numbered l * l + l + m. A VERY IMPORTANT NOTE: z-axis is the UP direction.
+namespace sh {
+
+  static constexpr int MAX_ORDER = 4;
+
+  constexpr uint32_t coeffs_num(int order) { return (order + 1) * (order + 1); }
+
+  // Compile-time description of a single harmonic
+  struct Term {
+    int l, m;
+    std::array<double, MAX_ORDER + 1> zPolynomial; // coefficients of D_l^|m| by power of z
+    double xyScale;                                // makes C_m or S_m integer coefficients coprime
+    double normalizationSquared;                   // K^2
+  };
+
+  namespace detail {
+
+    constexpr int64_t factorial(int n)
+    {
+      int64_t result = 1;
+      for (int i = 2; i <= n; i++)
+        result *= i;
+      return result;
+    }
+
+    constexpr int64_t binomial(int n, int k) { return factorial(n) / (factorial(k) * factorial(n - k)); }
+
+    constexpr Term make_term(int l, int m)
+    {
+      int absM = m < 0 ? -m : m;
+
+      // 2^l * P_l(z) = sum over k of (-1)^k * C(l, k) * C(2l - 2k, l) * z^(l - 2k), all integers
+      std::array<int64_t, MAX_ORDER + 1> legendre = {};
+      for (int k = 0; 2 * k <= l; k++)
+        legendre[l - 2 * k] = (k % 2 ? -1 : 1) * binomial(l, k) * binomial(2 * l - 2 * k, l);
+
+      std::array<int64_t, MAX_ORDER + 1> derivative = {};
+      int64_t zContent = 0;
+      for (int power = absM; power <= l; power++)
+      {
+        derivative[power - absM] = legendre[power] * factorial(power) / factorial(power - absM);
+        zContent = std::gcd(zContent, derivative[power - absM]);
+      }
+
+      // C_m takes the terms of (x + i * y)^m with even powers of y, S_m the odd ones
+      int64_t xyContent = 0;
+      for (int k = 0; k <= absM; k++)
+        if ((k % 2 == 0) == (m >= 0))
+          xyContent = std::gcd(xyContent, binomial(absM, k));
+
+      Term term = { l, m, {}, 1. / double(xyContent), 0. };
+      for (int power = 0; power <= l - absM; power++)
+        term.zPolynomial[power] = double(derivative[power] / zContent);
+
+      // Usual normalization of P_l^m * cos(m * phi), corrected for the integer scaling of the polynomial
+      double scale = double(zContent * xyContent) / double(int64_t(1) << l);
+      term.normalizationSquared = (2. * l + 1.) / (4. * std::numbers::pi) * double(factorial(l - absM)) / double(factorial(l + absM))
+        * (m != 0 ? 2. : 1.) * scale * scale;
+      return term;
+    }
+
+    template <int L>
+    constexpr std::array<Term, coeffs_num(L)> make_terms()
+    {
+      std::array<Term, coeffs_num(L)> terms = {};
+      for (int l = 0; l <= L; l++)
+        for (int m = -l; m <= l; m++)
+          terms[l * l + l + m] = make_term(l, m);
+      return terms;
+    }
+
+  }
+
+  template <int L>
+  inline constexpr std::array<Term, coeffs_num(L)> TERMS = detail::make_terms<L>();
+
+  // K^2 of every harmonic, multiplied into the projected coefficients
+  template <int L>
+  constexpr std::array<double, coeffs_num(L)> normalization_squared()
+  {
+    std::array<double, coeffs_num(L)> constants = {};
+    for (uint32_t i = 0; i < coeffs_num(L); i++)
+      constants[i] = TERMS<L>[i].normalizationSquared;
+    return constants;
+  }
+
+  namespace detail {
+
+    template <int L, size_t I, typename T>
+    inline T evaluate_term(T z, const std::array<T, L + 1>& c, const std::array<T, L + 1>& s)
+    {
+      constexpr Term term = TERMS<L>[I];
+      constexpr int degree = term.l - (term.m < 0 ? -term.m : term.m);
+
+      // Horner's scheme, the loop has a constant trip count and is unrolled
+      T polynomial = T(term.zPolynomial[degree]);
+      for (int power = degree - 1; power >= 0; power--)
+        polynomial = polynomial * z + T(term.zPolynomial[power]);
+
+      T xy = (term.m >= 0) ? c[term.m] : s[-term.m];
+      if constexpr (term.xyScale == 1.)
+        return polynomial * xy;
+      else
+        return polynomial * xy * T(term.xyScale);
+    }
+
+    template <int L, typename T, size_t... I>
+    inline void evaluate_terms(T z, const std::array<T, L + 1>& c, const std::array<T, L + 1>& s,
+      T* harmonics, std::index_sequence<I...>)
+    {
+      ((harmonics[I] = evaluate_term<L, I>(z, c, s)), ...);
+    }
+
+  }
+
+  // Evaluate all harmonics of order up to L without their normalization constants.
+  // \param harmonics receives coeffs_num(L) values
+  template <int L, typename T>
+  inline void evaluate_basis(T x, T y, T z, T* harmonics)
+  {
+    static_assert(0 <= L && L <= MAX_ORDER, "Only orders 0 to 4 are supported");
+
+    std::array<T, L + 1> c, s;
+    c[0] = T(1);
+    s[0] = T(0);
+    for (int m = 1; m <= L; m++)
+    {
+      c[m] = x * c[m - 1] - y * s[m - 1];
+      s[m] = x * s[m - 1] + y * c[m - 1];
+    }
+    detail::evaluate_terms<L>(z, c, s, harmonics, std::make_index_sequence<coeffs_num(L)>());
+  }
+
+  namespace detail {
+
+    inline std::string glsl_float(double value)
+    {
+      std::ostringstream text;
+      text.precision(17);
+      text << value;
+      std::string result = text.str();
+      if (result.find_first_of(".e") == std::string::npos)
+        result += ".";
+      return result + "f";
+    }
+
+  }
+
+  // \returns GLSL source of evaluate_sh_basis(vec3 dir, out float basis[SH_COEFFS_NUM]) for order L.
+  // The operations are the same as the ones of evaluate_basis.
+  template <int L>
+  std::string glsl_source()
+  {
+    std::ostringstream source;
+    source << "// Generated from src/preprocessing/spherical_harmonics.h, do not edit.\n"
+      << "// Real spherical harmonics without normalization constants, which are already baked into the coefficients.\n"
+      << "// A VERY IMPORTANT NOTE: z-axis is the UP direction.\n\n"
+      << "#if SH_ORDER != " << L << "\n"
+      << "#error \"spherical_harmonics.glsl was generated for a different SH_ORDER, run the renderer to regenerate it\"\n"
+      << "#endif\n\n"
+      << "void evaluate_sh_basis(vec3 dir, out float basis[SH_COEFFS_NUM])\n{\n"
+      << "  float c0 = 1.f, s0 = 0.f;\n";
+    for (int m = 1; m <= L; m++)
+      source << "  float c" << m << " = dir.x * c" << m - 1 << " - dir.y * s" << m - 1
+        << ", s" << m << " = dir.x * s" << m - 1 << " + dir.y * c" << m - 1 << ";\n";
+    source << "\n";
+
+    for (uint32_t i = 0; i < coeffs_num(L); i++)
+    {
+      const Term& term = TERMS<L>[i];
+      int absM = term.m < 0 ? -term.m : term.m;
+      int degree = term.l - absM;
+
+      std::string polynomial = detail::glsl_float(term.zPolynomial[degree]);
+      for (int power = degree - 1; power >= 0; power--)
+      {
+        // Factors of one are left out, they don't change the result
+        polynomial = (polynomial == "1.f") ? "dir.z" : polynomial + " * dir.z";
+        double coefficient = term.zPolynomial[power];
+        if (coefficient != 0.)
+          polynomial = "(" + polynomial + (coefficient > 0. ? " + " : " - ")
+            + detail::glsl_float(coefficient > 0. ? coefficient : -coefficient) + ")";
+      }
+
+      std::string expression = (polynomial == "1.f") ? "" : polynomial;
+      if (absM > 0)
+        expression += (expression.empty() ? "" : " * ") + std::string(term.m >= 0 ? "c" : "s") + std::to_string(absM);
+      if (term.xyScale != 1.)
+        expression += " * " + detail::glsl_float(term.xyScale);
+      source << "  basis[" << i << "] = " << (expression.empty() ? "1.f" : expression);
+      source << "; // Y" << term.l << (term.m < 0 ? "m" : "") << absM << "\n";
+    }
+    source << "}\n";
+    return source.str();
+  }
+
+  // Write the GLSL include for order L, unless the file is already up to date.
+  // \returns whether the file is up to date now
+  template <int L>
+  bool write_glsl_include(const std::string& path)
+  {
+    std::string source = glsl_source<L>();
+
+    std::ifstream existing(path, std::ios::binary);
+    if (existing)
+    {
+      std::stringstream contents;
+      contents << existing.rdbuf();
+      if (contents.str() == source)
+        return true;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << source;
+    return static_cast<bool>(file);
+  }
+
+}
@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  queues.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++)
+    queues.push_back(std::make_unique<WorkQueue>());
+
+  workers.reserve(threadCount - 1);
+  for (uint32_t i = 0; i + 1 < threadCount; i++)
+    workers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(loopLock);
+    stopping = true;
+  }
+  loopStarted.notify_all();
+
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& body)
+{
+  if (count == 0)
+    return;
+
+  chunkSize = std::max<size_t>(1, chunkSize);
+  size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+  // Contiguous blocks of chunks go to every participant up front, stealing fixes the imbalance.
+  size_t participants = queues.size();
+  for (size_t queueNo = 0; queueNo < participants; queueNo++)
+  {
+    std::lock_guard<std::mutex> guard(queues[queueNo]->lock);
+    for (size_t chunkNo = chunkCount * queueNo / participants; chunkNo < chunkCount * (queueNo + 1) / participants; chunkNo++)
+      queues[queueNo]->chunks.push_back(chunkNo);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(loopLock);
+    loopBody = &body;
+    loopCount = count;
+    loopChunkSize = chunkSize;
+    busyWorkers = workers.size();
+    generation++;
+  }
+  loopStarted.notify_all();
+
+  work(static_cast<uint32_t>(participants - 1));
+
+  // Chunks may still be running on other threads even though all queues are empty.
+  std::unique_lock<std::mutex> guard(loopLock);
+  loopFinished.wait(guard, [this]() { return busyWorkers == 0; });
+  loopBody = nullptr;
+}
+
+void ThreadPool::workerMain(uint32_t queueNo)
+{
+  uint64_t seenGeneration = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> guard(loopLock);
+      loopStarted.wait(guard, [&]() { return stopping || generation != seenGeneration; });
+      if (stopping)
+        return;
+      seenGeneration = generation;
+    }
+
+    work(queueNo);
+
+    {
+      std::lock_guard<std::mutex> guard(loopLock);
+      busyWorkers--;
+    }
+    loopFinished.notify_one();
+  }
+}
+
+void ThreadPool::work(uint32_t queueNo)
+{
+  size_t chunkNo;
+  while (takeChunk(queueNo, chunkNo))
+  {
+    size_t begin = chunkNo * loopChunkSize;
+    size_t end = std::min(loopCount, begin + loopChunkSize);
+    (*loopBody)(begin, end);
+  }
+}
+
+bool ThreadPool::takeChunk(uint32_t queueNo, size_t& chunkNo)
+{
+  {
+    WorkQueue& own = *queues[queueNo];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.chunks.empty())
+    {
+      chunkNo = own.chunks.front();
+      own.chunks.pop_front();
+      return true;
+    }
+  }
+
+  // Chunks are never added while a loop runs, so a full pass over empty queues means there's nothing left.
+  for (size_t i = 1; i < queues.size(); i++)
+  {
+    WorkQueue& victim = *queues[(queueNo + i) % queues.size()];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.chunks.empty())
+    {
+      chunkNo = victim.chunks.back();
+      victim.chunks.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of persistent worker threads running data-parallel loops with work stealing.
+// Every participant owns a deque of chunks: it takes work from the front of its own deque
+// and, once that runs dry, steals from the back of the others. This keeps neighbouring
+// chunks on the same thread while still balancing uneven workloads.
+class ThreadPool {
+  public:
+    // \param threadCount total number of threads working on a loop, including the calling one.
+    // 0 means one per hardware thread.
+    ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Run body over [0, count) split into chunks of chunkSize elements and wait for completion.
+    // The calling thread takes part in the work. Loops are not reentrant.
+    // \param count number of elements
+    // \param chunkSize number of elements handed out at once
+    // \param body called with the [begin, end) range of a chunk
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& body);
+
+    uint32_t threadCount() const { return static_cast<uint32_t>(queues.size()); }
+
+  private:
+    struct WorkQueue {
+      std::mutex lock;
+      std::deque<size_t> chunks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues; // one per participant, the calling thread uses the last one
+    std::vector<std::thread> workers;
+
+    std::mutex loopLock;
+    std::condition_variable loopStarted, loopFinished;
+    uint64_t generation = 0;
+    bool stopping = false;
+    size_t busyWorkers = 0;
+
+    // State of the loop being run
+    const std::function<void(size_t, size_t)>* loopBody = nullptr;
+    size_t loopCount = 0, loopChunkSize = 1;
+
+    void workerMain(uint32_t queueNo);
+
+    // Process chunks until every queue is empty.
+    void work(uint32_t queueNo);
+
+    bool takeChunk(uint32_t queueNo, size_t& chunkNo);
+};
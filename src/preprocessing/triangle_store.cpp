@@ -0,0 +1,261 @@
+#include "triangle_store.h"
+
+#include "cpu_features.h"
+
+static constexpr float EPSILON = 1.e-7f;
+
+// Möller–Trumbore ray-triangle intersection of a single lane.
+// The SIMD kernels below perform exactly the same float operations in the same order,
+// so all kernels find the same hits at the same distances.
+// \returns the distance to the intersection point, 0 if there is none
+static float intersect_lane(const TrianglePacket& packet, uint32_t lane, const glm::vec3& origin, const glm::vec3& direction)
+{
+  float e1x = packet.edge1[0][lane], e1y = packet.edge1[1][lane], e1z = packet.edge1[2][lane];
+  float e2x = packet.edge2[0][lane], e2y = packet.edge2[1][lane], e2z = packet.edge2[2][lane];
+
+  float px = direction.y * e2z - direction.z * e2y;
+  float py = direction.z * e2x - direction.x * e2z;
+  float pz = direction.x * e2y - direction.y * e2x;
+  float det = e1x * px + e1y * py + e1z * pz;
+  if (det > -EPSILON && det < EPSILON)
+    return 0.f; // This ray is parallel to this triangle.
+
+  float invDet = 1.f / det;
+  float sx = origin.x - packet.vertex0[0][lane];
+  float sy = origin.y - packet.vertex0[1][lane];
+  float sz = origin.z - packet.vertex0[2][lane];
+  float u = invDet * (sx * px + sy * py + sz * pz);
+  if (u < 0.f || u > 1.f)
+    return 0.f;
+
+  float qx = sy * e1z - sz * e1y;
+  float qy = sz * e1x - sx * e1z;
+  float qz = sx * e1y - sy * e1x;
+  float v = invDet * (direction.x * qx + direction.y * qy + direction.z * qz);
+  if (v < 0.f || u + v > 1.f)
+    return 0.f;
+
+  // A line intersection behind the origin is not a ray intersection
+  float t = invDet * (e2x * qx + e2y * qy + e2z * qz);
+  return (t > EPSILON) ? t : 0.f;
+}
+
+static bool farthest_hit_scalar(const TrianglePacket* packets, size_t packetCount,
+  const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& lane)
+{
+  bool hit = false;
+  for (size_t packetNo = 0; packetNo < packetCount; packetNo++)
+    for (uint32_t laneNo = 0; laneNo < TRIANGLE_PACKET_SIZE; laneNo++)
+    {
+      float t = intersect_lane(packets[packetNo], laneNo, origin, direction);
+      if (t > distance)
+      {
+        distance = t;
+        lane = static_cast<uint32_t>(packetNo * TRIANGLE_PACKET_SIZE + laneNo);
+        hit = true;
+      }
+    }
+  return hit;
+}
+
+#ifdef PREPROCESSING_X86
+
+// Pick the farthest of the lanes selected by mask, the first lane wins ties.
+static bool pick_lane(const float* distances, int mask, uint32_t firstLane, uint32_t laneCount, float& distance, uint32_t& lane)
+{
+  bool hit = false;
+  for (uint32_t laneNo = 0; laneNo < laneCount; laneNo++)
+    if ((mask & (1 << laneNo)) && distances[laneNo] > distance)
+    {
+      distance = distances[laneNo];
+      lane = firstLane + laneNo;
+      hit = true;
+    }
+  return hit;
+}
+
+// The rejection tests are the exact negations of the scalar early outs, so NaNs are handled the same way.
+TARGET_AVX static bool farthest_hit_avx(const TrianglePacket* packets, size_t packetCount,
+  const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& lane)
+{
+  const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+  const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+  const __m256 epsilon = _mm256_set1_ps(EPSILON), minusEpsilon = _mm256_set1_ps(-EPSILON);
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+  __m256 best = _mm256_set1_ps(distance);
+
+  bool hit = false;
+  for (size_t packetNo = 0; packetNo < packetCount; packetNo++)
+  {
+    const TrianglePacket& packet = packets[packetNo];
+    __m256 e1x = _mm256_load_ps(packet.edge1[0]), e1y = _mm256_load_ps(packet.edge1[1]), e1z = _mm256_load_ps(packet.edge1[2]);
+    __m256 e2x = _mm256_load_ps(packet.edge2[0]), e2y = _mm256_load_ps(packet.edge2[1]), e2z = _mm256_load_ps(packet.edge2[2]);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 invDet = _mm256_div_ps(one, det);
+
+    __m256 sx = _mm256_sub_ps(ox, _mm256_load_ps(packet.vertex0[0]));
+    __m256 sy = _mm256_sub_ps(oy, _mm256_load_ps(packet.vertex0[1]));
+    __m256 sz = _mm256_sub_ps(oz, _mm256_load_ps(packet.vertex0[2]));
+    __m256 u = _mm256_mul_ps(invDet,
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)));
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    __m256 v = _mm256_mul_ps(invDet,
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+    __m256 t = _mm256_mul_ps(invDet,
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+    __m256 reject = _mm256_and_ps(_mm256_cmp_ps(det, minusEpsilon, _CMP_GT_OQ), _mm256_cmp_ps(det, epsilon, _CMP_LT_OQ));
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, zero, _CMP_LT_OQ));
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, one, _CMP_GT_OQ));
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(v, zero, _CMP_LT_OQ));
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ));
+    __m256 accept = _mm256_andnot_ps(reject,
+      _mm256_and_ps(_mm256_cmp_ps(t, epsilon, _CMP_GT_OQ), _mm256_cmp_ps(t, best, _CMP_GT_OQ)));
+
+    int mask = _mm256_movemask_ps(accept);
+    if (mask != 0) [[unlikely]]
+    {
+      alignas(32) float distances[TRIANGLE_PACKET_SIZE];
+      _mm256_store_ps(distances, t);
+      hit |= pick_lane(distances, mask, static_cast<uint32_t>(packetNo * TRIANGLE_PACKET_SIZE), TRIANGLE_PACKET_SIZE, distance, lane);
+      best = _mm256_set1_ps(distance);
+    }
+  }
+  return hit;
+}
+
+// SSE2 is part of x86-64, so this kernel needs no runtime check. A packet is processed in two halves.
+static bool farthest_hit_sse(const TrianglePacket* packets, size_t packetCount,
+  const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& lane)
+{
+  const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+  const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+  const __m128 epsilon = _mm_set1_ps(EPSILON), minusEpsilon = _mm_set1_ps(-EPSILON);
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+  __m128 best = _mm_set1_ps(distance);
+
+  bool hit = false;
+  for (size_t packetNo = 0; packetNo < packetCount; packetNo++)
+    for (uint32_t half = 0; half < TRIANGLE_PACKET_SIZE; half += 4)
+    {
+      const TrianglePacket& packet = packets[packetNo];
+      __m128 e1x = _mm_load_ps(packet.edge1[0] + half), e1y = _mm_load_ps(packet.edge1[1] + half), e1z = _mm_load_ps(packet.edge1[2] + half);
+      __m128 e2x = _mm_load_ps(packet.edge2[0] + half), e2y = _mm_load_ps(packet.edge2[1] + half), e2z = _mm_load_ps(packet.edge2[2] + half);
+
+      __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+      __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+      __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+      __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+      __m128 invDet = _mm_div_ps(one, det);
+
+      __m128 sx = _mm_sub_ps(ox, _mm_load_ps(packet.vertex0[0] + half));
+      __m128 sy = _mm_sub_ps(oy, _mm_load_ps(packet.vertex0[1] + half));
+      __m128 sz = _mm_sub_ps(oz, _mm_load_ps(packet.vertex0[2] + half));
+      __m128 u = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)));
+
+      __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+      __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+      __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+      __m128 v = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+      __m128 t = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+      __m128 reject = _mm_and_ps(_mm_cmpgt_ps(det, minusEpsilon), _mm_cmplt_ps(det, epsilon));
+      reject = _mm_or_ps(reject, _mm_cmplt_ps(u, zero));
+      reject = _mm_or_ps(reject, _mm_cmpgt_ps(u, one));
+      reject = _mm_or_ps(reject, _mm_cmplt_ps(v, zero));
+      reject = _mm_or_ps(reject, _mm_cmpgt_ps(_mm_add_ps(u, v), one));
+      __m128 accept = _mm_andnot_ps(reject, _mm_and_ps(_mm_cmpgt_ps(t, epsilon), _mm_cmpgt_ps(t, best)));
+
+      int mask = _mm_movemask_ps(accept);
+      if (mask != 0) [[unlikely]]
+      {
+        alignas(16) float distances[4];
+        _mm_store_ps(distances, t);
+        hit |= pick_lane(distances, mask, static_cast<uint32_t>(packetNo * TRIANGLE_PACKET_SIZE + half), 4, distance, lane);
+        best = _mm_set1_ps(distance);
+      }
+    }
+  return hit;
+}
+
+#endif // PREPROCESSING_X86
+
+std::vector<PacketKernelInfo> available_packet_kernels()
+{
+  std::vector<PacketKernelInfo> kernels;
+#ifdef PREPROCESSING_X86
+  if (cpu_supports_avx())
+    kernels.push_back({ "AVX", farthest_hit_avx });
+  kernels.push_back({ "SSE", farthest_hit_sse });
+#endif
+  kernels.push_back({ "scalar", farthest_hit_scalar });
+  return kernels;
+}
+
+const PacketKernelInfo& select_packet_kernel()
+{
+  static const PacketKernelInfo selected = available_packet_kernels().front();
+  return selected;
+}
+
+void TriangleStore::add(const glm::vec3& vertex0, const glm::vec3& vertex1, const glm::vec3& vertex2, uint32_t triangleNo)
+{
+  if (packetFull)
+  {
+    // Zeroed edges make the unused lanes degenerate
+    packets.push_back({});
+    triangleIds.insert(triangleIds.end(), TRIANGLE_PACKET_SIZE, UINT32_MAX);
+    packetFull = false;
+    lanesUsed = 0;
+  }
+
+  TrianglePacket& packet = packets.back();
+  glm::vec3 edge1 = vertex1 - vertex0;
+  glm::vec3 edge2 = vertex2 - vertex0;
+  for (int axis = 0; axis < 3; axis++)
+  {
+    packet.vertex0[axis][lanesUsed] = vertex0[axis];
+    packet.edge1[axis][lanesUsed] = edge1[axis];
+    packet.edge2[axis][lanesUsed] = edge2[axis];
+  }
+  triangleIds[(packets.size() - 1) * TRIANGLE_PACKET_SIZE + lanesUsed] = triangleNo;
+
+  if (++lanesUsed == TRIANGLE_PACKET_SIZE)
+    packetFull = true;
+}
+
+bool TriangleStore::farthestHit(uint32_t firstPacket, uint32_t packetCount,
+  const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& triangle) const
+{
+  static const PacketKernel kernel = select_packet_kernel().kernel;
+
+  uint32_t lane;
+  if (!kernel(packets.data() + firstPacket, packetCount, origin, direction, distance, lane))
+    return false;
+
+  triangle = triangleIds[firstPacket * TRIANGLE_PACKET_SIZE + lane];
+  return true;
+}
+
+TriangleStore make_triangle_store(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData)
+{
+  auto getPosition = [&vertexData](uint32_t vertexNo)
+  {
+    return glm::vec3(vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo    ],
+                     vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 1],
+                     vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + 2]);
+  };
+
+  TriangleStore store;
+  for (uint32_t triangleNo = 0; triangleNo < indexData.size() / 3; triangleNo++)
+    store.add(getPosition(indexData[3 * triangleNo]), getPosition(indexData[3 * triangleNo + 1]),
+      getPosition(indexData[3 * triangleNo + 2]), triangleNo);
+  return store;
+}
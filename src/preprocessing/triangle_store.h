@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../config.h"
+
+static constexpr uint32_t TRIANGLE_PACKET_SIZE = 8;
+
+// Eight triangles in structure-of-arrays layout, ready for Möller–Trumbore intersection.
+// The first vertex and both edges are precomputed, every component row is 32 bytes and 32-byte aligned.
+// Unused lanes hold degenerate triangles which are never hit.
+struct alignas(32) TrianglePacket {
+  float vertex0[3][TRIANGLE_PACKET_SIZE];
+  float edge1[3][TRIANGLE_PACKET_SIZE];
+  float edge2[3][TRIANGLE_PACKET_SIZE];
+};
+
+// Find the farthest hit of a ray among a range of packets.
+// Ties are resolved in favour of the lowest lane index, counting lanes across all packets of the range.
+// \param packets the first packet to test
+// \param packetCount number of packets to test
+// \param origin the ray origin
+// \param direction the ray direction
+// \param distance farthest hit distance found so far, only hits past it are reported (ties excluded)
+// \param lane index of the hit lane relative to packets, only written on a hit
+// \returns whether a hit farther than distance was found
+using PacketKernel = bool (*)(const TrianglePacket* packets, size_t packetCount,
+  const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& lane);
+
+struct PacketKernelInfo {
+  const char* name;
+  PacketKernel kernel;
+};
+
+// \returns the kernels runnable on this CPU, widest first. The scalar one is always the last.
+std::vector<PacketKernelInfo> available_packet_kernels();
+
+// \returns the widest kernel runnable on this CPU, detected once at runtime
+const PacketKernelInfo& select_packet_kernel();
+
+// Triangles of a mesh stored in packets, along with the number of every triangle in the index buffer.
+class TriangleStore {
+  public:
+    // Add a triangle to the last packet, a new packet is started when it is full.
+    // \param triangleNo number of the triangle in the index buffer
+    void add(const glm::vec3& vertex0, const glm::vec3& vertex1, const glm::vec3& vertex2, uint32_t triangleNo);
+
+    // Make the next added triangle start a new packet.
+    void finishPacket() { packetFull = true; }
+
+    uint32_t packetCount() const { return static_cast<uint32_t>(packets.size()); }
+    const TrianglePacket* packetData() const { return packets.data(); }
+
+    // Find the farthest hit among a range of packets using the kernel selected for this CPU.
+    // Ties are resolved in favour of the triangle which comes first in the range.
+    // \param distance farthest hit distance found so far, updated on a hit
+    // \param triangle number of the hit triangle in the index buffer, only written on a hit
+    // \returns whether a hit farther than distance was found
+    bool farthestHit(uint32_t firstPacket, uint32_t packetCount,
+      const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& triangle) const;
+
+    // Brute force version of the above over every packet of the store.
+    bool farthestHit(const glm::vec3& origin, const glm::vec3& direction, float& distance, uint32_t& triangle) const
+    {
+      return farthestHit(0, packetCount(), origin, direction, distance, triangle);
+    }
+
+  private:
+    std::vector<TrianglePacket> packets;
+    std::vector<uint32_t> triangleIds; // TRIANGLE_PACKET_SIZE entries per packet
+    bool packetFull = true;
+    uint32_t lanesUsed = 0;
+};
+
+// Put every triangle of an indexed mesh into packets, in index buffer order.
+// \param vertexData interleaved vertex attributes, SINGLE_VERTEX_FLOAT_NUM floats per vertex
+// \param indexData triangle list indexing into vertexData
+TriangleStore make_triangle_store(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData);
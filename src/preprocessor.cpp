@@ -1,13 +1,489 @@
-
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
-#include "preprocessing/preprocessing_common.h"
+#include <random>
+#include <string>
+
+#include "preprocessing/bake.h"
+#include "preprocessing/bake_cache.h"
+#include "preprocessing/baked_mesh.h"
+#include "preprocessing/triangle_store.h"
+#include "view/vkMesh/obj_mesh.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#define BENCHMARK_TRIANGLES 65536
+#define BENCHMARK_RAYS 2000
+#define BENCHMARK_OBJ_GRID 1000 // quads per side of the synthetic OBJ, each split into two triangles
+#define BENCHMARK_OBJ_RUNS 3
+
+// Micro-benchmark of the ray-triangle kernels: random rays against a cloud of random triangles.
+// Every kernel available on this CPU is timed and checked against the scalar one.
+static void benchmark_kernels()
+{
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> coordinate(-1.f, 1.f);
+  auto randomPoint = [&]() { return glm::vec3(coordinate(generator), coordinate(generator), coordinate(generator)); };
+
+  TriangleStore store;
+  for (uint32_t triangleNo = 0; triangleNo < BENCHMARK_TRIANGLES; triangleNo++)
+  {
+    glm::vec3 center = randomPoint();
+    store.add(center, center + 0.1f * randomPoint(), center + 0.1f * randomPoint(), triangleNo);
+  }
+
+  std::vector<glm::vec3> origins, directions;
+  for (int rayNo = 0; rayNo < BENCHMARK_RAYS; rayNo++)
+  {
+    origins.push_back(0.5f * randomPoint());
+    directions.push_back(glm::normalize(randomPoint()));
+  }
+
+  std::vector<PacketKernelInfo> kernels = available_packet_kernels();
+  std::vector<std::vector<uint32_t>> hits(kernels.size(), std::vector<uint32_t>(BENCHMARK_RAYS, UINT32_MAX));
+  // The scalar kernel is the last one, running backwards makes its results available for the comparison
+  for (size_t kernelNo = kernels.size(); kernelNo-- > 0;)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int rayNo = 0; rayNo < BENCHMARK_RAYS; rayNo++)
+    {
+      float distance = 0.f;
+      kernels[kernelNo].kernel(store.packetData(), store.packetCount(), origins[rayNo], directions[rayNo], distance, hits[kernelNo][rayNo]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double trianglesTested = double(BENCHMARK_RAYS) * store.packetCount() * TRIANGLE_PACKET_SIZE;
+    std::cout << kernels[kernelNo].name << ": " << trianglesTested / seconds << " triangles/s ("
+      << seconds << " s)" << (hits[kernelNo] == hits.back() ? "" : ", results differ from scalar!") << "\n";
+  }
+
+  std::cout << "Selected kernel: " << select_packet_kernel().name << "\n";
+}
+
+// Write a flat grid of BENCHMARK_OBJ_GRID^2 quads as 2 * BENCHMARK_OBJ_GRID^2 triangles.
+// \returns the path of the file
+static std::string write_synthetic_obj()
+{
+  std::string path = (std::filesystem::temp_directory_path() / "preprocessor_benchmark.obj").string();
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  char line[128];
+  for (int y = 0; y <= BENCHMARK_OBJ_GRID; y++)
+    for (int x = 0; x <= BENCHMARK_OBJ_GRID; x++)
+      file.write(line, std::snprintf(line, sizeof(line), "v %f %f 0.000000\nvt %f %f\n",
+        float(x) / BENCHMARK_OBJ_GRID, float(y) / BENCHMARK_OBJ_GRID, float(x) / BENCHMARK_OBJ_GRID, float(y) / BENCHMARK_OBJ_GRID));
+  file << "vn 0.0000 0.0000 1.0000\n";
+  for (int y = 0; y < BENCHMARK_OBJ_GRID; y++)
+    for (int x = 0; x < BENCHMARK_OBJ_GRID; x++)
+    {
+      int corner = y * (BENCHMARK_OBJ_GRID + 1) + x + 1;
+      int above = corner + BENCHMARK_OBJ_GRID + 1;
+      file.write(line, std::snprintf(line, sizeof(line), "f %d/%d/1 %d/%d/1 %d/%d/1\nf %d/%d/1 %d/%d/1 %d/%d/1\n",
+        corner, corner, corner + 1, corner + 1, above + 1, above + 1, corner, corner, above + 1, above + 1, above, above));
+    }
+  return path;
+}
+
+// Parse throughput of the OBJ loader on the shipped models and a synthetic multi-million-face mesh
+// for 1 to 16 threads. Every configuration is loaded BENCHMARK_OBJ_RUNS times and the fastest run is reported.
+// Results of the parallel loads are checked against the serial one.
+static void benchmark_obj_loading()
+{
+  std::vector<std::string> paths = { "resources/models/skull.obj", "resources/models/viking_room.obj" };
+  std::cout << "Writing a synthetic OBJ of " << 2 * BENCHMARK_OBJ_GRID * BENCHMARK_OBJ_GRID << " triangles...\n";
+  paths.push_back(write_synthetic_obj());
+
+  for (const std::string& path : paths)
+  {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if (error)
+    {
+      std::cout << path << ": not found\n";
+      continue;
+    }
+
+    vkmesh::ObjMesh serial;
+    for (uint32_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+    {
+      double bestSeconds = 0.;
+      bool matches = true;
+      for (int run = 0; run < BENCHMARK_OBJ_RUNS; run++)
+      {
+        auto start = std::chrono::steady_clock::now();
+        vkmesh::ObjMesh model;
+        model.load(path.c_str(), "", glm::mat4(1.f), threadCount);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < bestSeconds)
+          bestSeconds = seconds;
+
+        if (threadCount == 1)
+          serial = std::move(model);
+        else
+          matches = matches && model.vertices == serial.vertices && model.indices == serial.indices;
+      }
+      std::cout << path << ", " << threadCount << " threads: " << size / (1024. * 1024.) << " MB, "
+        << serial.indices.size() / 3 << " triangles in " << bestSeconds * 1000. << " ms, "
+        << size / (1024. * 1024.) / bestSeconds << " MB/s" << (matches ? "" : ", results differ from serial!") << "\n";
+    }
+  }
+
+  std::filesystem::remove(paths.back());
+}
+
+// Load small OBJ files with relative indices and with indices past the attributes.
+// \returns whether the relative faces match the absolute ones and the broken faces are rejected
+static bool obj_index_test()
+{
+  const char* attributes = "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 0 1\nvn 0 0 1\n";
+  std::string path = (std::filesystem::temp_directory_path() / "preprocessor_self_test.obj").string();
+  auto load = [&](const std::string& faces, vkmesh::ObjMesh& model)
+  {
+    std::ofstream(path, std::ios::binary) << attributes << faces;
+    return model.load(path.c_str(), "", glm::mat4(1.f));
+  };
+
+  vkmesh::ObjMesh absolute, relative, broken;
+  bool passed = load("f 1/1/1 2/2/1 3/3/1\n", absolute) && load("f -3/-3/-1 -2/-2/-1 -1/-1/-1\n", relative)
+    && absolute.vertices == relative.vertices && absolute.indices == relative.indices;
+  for (const char* faces : { "f 1 2 4\n", "f 1/4 2 3\n", "f 1//2 2 3\n", "f -4 2 3\n", "f 0 2 3\n", "f x 2 3\n", "f 1/ 2 3a\n" })
+    passed = passed && !load(faces, broken) && broken.vertices.empty() && broken.indices.empty();
+
+  std::filesystem::remove(path);
+  std::cout << "OBJ indices: " << (passed ? "resolved and checked" : "wrong") << "\n";
+  return passed;
+}
+
+// Bake skull.obj with 1, 4 and one thread per hardware thread, the baked files have to be byte-identical.
+// Every vertex is baked whole by a single thread, so the thread count must not show.
+// The OBJ index checks run afterwards.
+// \returns whether every bake wrote the same bytes and the index checks passed
+static bool self_test()
+{
+  const char* objPath = "resources/models/skull.obj";
+  const char* mtlPath = "resources/models/skull.mtl";
+  if (!std::filesystem::exists(objPath))
+  {
+    std::cout << objPath << ": not found\n";
+    return false;
+  }
 
-#define NUM_POINTS 1000000
+  std::string outputPath = (std::filesystem::temp_directory_path() / "preprocessor_self_test.baked").string();
+  std::string reference;
+  bool identical = true;
+  for (uint32_t threadCount : { 1u, 4u, 0u })
+  {
+    BakeSettings settings;
+    settings.useCache = false;
+    settings.threadCount = threadCount;
+    // Fewer directions than the renderer uses keep the test short, the threading is the same
+    settings.sampleCount = 128;
 
-int main()
+    vkmesh::ObjMesh model;
+    if (!model.load(objPath, mtlPath, glm::mat4(1.f), threadCount))
+    {
+      std::cout << model.error << "\n";
+      identical = false;
+      break;
+    }
+    std::vector<MeshBakeInput> inputs = { { model.vertices, model.indices, objPath } };
+    bake_sh_terms(inputs, settings);
+
+    BakedMesh baked;
+    baked.vertexData = std::move(model.vertices);
+    baked.indexData = std::move(model.indices);
+    baked.ior = settings.ior;
+    baked.sampleCount = settings.sampleCount;
+    make_bake_cache_key(objPath, baked.preTransform, settings, baked.bakeKey);
+    std::ifstream file;
+    if (write_baked_mesh(outputPath, baked))
+      file.open(outputPath, std::ios::binary);
+    if (!file)
+    {
+      std::cout << "Failed to write " << outputPath << "\n";
+      identical = false;
+      break;
+    }
+    BakedMeshView view;
+    if (!view.open(outputPath) || !view.bakedWith(objPath, settings, baked.preTransform))
+    {
+      std::cout << outputPath << ": not accepted as a bake of " << objPath << "\n";
+      identical = false;
+      break;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    bool matches = threadCount == 1 || bytes == reference;
+    if (threadCount == 1)
+      reference = std::move(bytes);
+    identical = identical && matches;
+    std::cout << objPath << ", " << (threadCount == 0 ? "all" : std::to_string(threadCount)) << " threads: "
+      << reference.size() << " bytes" << (matches ? "" : ", differ from the serial bake!") << "\n";
+  }
+
+  std::filesystem::remove(outputPath);
+  identical = obj_index_test() && identical;
+  std::cout << (identical ? "Self-test passed\n" : "Self-test failed\n");
+  return identical;
+}
+
+// \returns the peak resident memory of the process in megabytes
+static double peak_memory_mb()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters = {};
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0.;
+  return counters.PeakWorkingSetSize / (1024. * 1024.);
+#else
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024. * 1024.); // bytes
+#else
+  return usage.ru_maxrss / 1024.;           // kilobytes
+#endif
+#endif
+}
+
+static void print_usage()
+{
+  std::cout << "Usage: preprocessor [options] <file.obj | directory>...\n"
+    << "Bakes the spherical harmonics expansion of every OBJ into <output>/<name>.baked.\n"
+    << "A material file next to an OBJ with the same name is used for its colors.\n\n"
+    << "  --samples N          directions per vertex (default 500)\n"
+    << "  --ior X              index of refraction (default " << IOR << ")\n"
+    << "  --sh-order L         SH order, has to be the one the program was built with (" << SH_ORDER << ")\n"
+    << "  --threads N          worker threads, 0 means one per hardware thread (default 0)\n"
+    << "  --rotate-z DEGREES   rotate the meshes around the up axis before baking, like the renderer's pre-transforms\n"
+    << "  --output DIR         output directory (default: next to the inputs)\n"
+    << "  --no-bvh             test every ray against every triangle\n"
+    << "  --cache              reuse and update the bake cache next to the inputs\n"
+    << "  --benchmark-kernels  time the ray-triangle kernels and exit\n"
+    << "  --benchmark-obj      time the OBJ loader and exit\n"
+    << "  --self-test          check that baking skull.obj with 1, 4 and all threads gives identical files, and exit\n";
+}
+
+// An OBJ to bake with the material file next to it, if any
+struct BakeJob {
+  std::filesystem::path objPath, mtlPath;
+  std::string objPathString;
+  vkmesh::ObjMesh model;
+};
+
+// \returns whether the inputs could be collected, every OBJ of a directory is added
+static bool collect_inputs(const std::vector<std::string>& inputs, std::vector<std::filesystem::path>& objPaths)
+{
+  for (const std::string& input : inputs)
+  {
+    std::error_code error;
+    if (std::filesystem::is_directory(input, error))
+    {
+      std::vector<std::filesystem::path> found;
+      for (const auto& entry : std::filesystem::directory_iterator(input, error))
+        if (entry.is_regular_file() && entry.path().extension() == ".obj")
+          found.push_back(entry.path());
+      // Directory order is unspecified, sorting keeps the output stable
+      std::sort(found.begin(), found.end());
+      objPaths.insert(objPaths.end(), found.begin(), found.end());
+    }
+    else if (std::filesystem::is_regular_file(input, error))
+      objPaths.push_back(input);
+    else
+    {
+      std::cout << "No such file or directory: " << input << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// \returns whether the option has a value which could be parsed
+template <typename T>
+static bool parse_value(int argc, char** argv, int& argNo, T& value)
+{
+  if (argNo + 1 >= argc)
+  {
+    std::cout << argv[argNo] << " needs a value\n";
+    return false;
+  }
+  std::istringstream text(argv[++argNo]);
+  if (!(text >> value) || !text.eof())
+  {
+    std::cout << "Invalid value of " << argv[argNo - 1] << ": " << argv[argNo] << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Offline batch baker: bakes every given OBJ in parallel and writes one baked mesh per input.
+int main(int argc, char** argv)
 {
-  std::vector<glm::dvec3> hammersleySequence = construct_hemisphere_hammersley_sequence(NUM_POINTS);
-  // std::vector<float> shTerms = calculate_sh_terms(hammersleySequence, sphere_width);
+  BakeSettings settings;
+  settings.useCache = false;
+  int shOrder = SH_ORDER;
+  float rotationDegrees = 0.f;
+  std::string outputDirectory;
+  std::vector<std::string> inputs;
+
+  for (int argNo = 1; argNo < argc; argNo++)
+  {
+    std::string arg = argv[argNo];
+    bool parsed = true;
+    if (arg == "--samples")
+      parsed = parse_value(argc, argv, argNo, settings.sampleCount) && settings.sampleCount > 0;
+    else if (arg == "--ior")
+      parsed = parse_value(argc, argv, argNo, settings.ior) && settings.ior > 0.f;
+    else if (arg == "--sh-order")
+      parsed = parse_value(argc, argv, argNo, shOrder);
+    else if (arg == "--rotate-z")
+      parsed = parse_value(argc, argv, argNo, rotationDegrees);
+    else if (arg == "--threads")
+      parsed = parse_value(argc, argv, argNo, settings.threadCount);
+    else if (arg == "--output")
+    {
+      // Taken verbatim, paths may contain spaces
+      parsed = argNo + 1 < argc;
+      if (parsed)
+        outputDirectory = argv[++argNo];
+    }
+    else if (arg == "--no-bvh")
+      settings.useBVH = false;
+    else if (arg == "--cache")
+      settings.useCache = true;
+    else if (arg == "--benchmark-kernels")
+    {
+      benchmark_kernels();
+      return 0;
+    }
+    else if (arg == "--benchmark-obj")
+    {
+      benchmark_obj_loading();
+      return 0;
+    }
+    else if (arg == "--self-test")
+      return self_test() ? 0 : 1;
+    else if (arg == "--help" || arg == "-h")
+    {
+      print_usage();
+      return 0;
+    }
+    else if (arg.starts_with("--"))
+    {
+      std::cout << "Unknown option " << arg << "\n";
+      parsed = false;
+    }
+    else
+      inputs.push_back(arg);
+
+    if (!parsed)
+    {
+      print_usage();
+      return 1;
+    }
+  }
+
+  // The order decides the vertex layout and the shaders, so it can't change at runtime
+  if (shOrder != SH_ORDER)
+  {
+    std::cout << "SH order " << shOrder << " requested, but this build uses order " << SH_ORDER
+      << ". Change SH_ORDER in common_definitions.h and rebuild.\n";
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> objPaths;
+  if (!collect_inputs(inputs, objPaths))
+    return 1;
+  if (objPaths.empty())
+  {
+    print_usage();
+    return 1;
+  }
+  if (!outputDirectory.empty())
+    std::filesystem::create_directories(outputDirectory);
+
+  // Built the same way as the pre-transforms of the renderer, so that the matrices compare equal
+  glm::mat4 preTransform = glm::mat4(1.f);
+  if (rotationDegrees != 0.f)
+    preTransform = glm::rotate(glm::mat4(1.f), glm::radians(rotationDegrees), glm::vec3(0.f, 0.f, 1.f));
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<BakeJob> jobs(objPaths.size());
+  for (size_t jobNo = 0; jobNo < jobs.size(); jobNo++)
+  {
+    jobs[jobNo].objPath = objPaths[jobNo];
+    jobs[jobNo].objPathString = objPaths[jobNo].string();
+    std::filesystem::path mtlPath = objPaths[jobNo];
+    mtlPath.replace_extension(".mtl");
+    if (std::filesystem::exists(mtlPath))
+      jobs[jobNo].mtlPath = mtlPath;
+  }
+
+  // Large files are split between the threads by the loader itself
+  for (BakeJob& job : jobs)
+    if (!job.model.load(job.objPathString.c_str(), job.mtlPath.string().c_str(), preTransform, settings.threadCount))
+    {
+      std::cout << job.model.error << "\n";
+      return 1;
+    }
+  double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Loaded " << jobs.size() << " meshes in " << loadSeconds << " s\n";
+
+  std::vector<MeshBakeInput> bakeInputs;
+  for (BakeJob& job : jobs)
+    bakeInputs.push_back({ job.model.vertices, job.model.indices, job.objPathString.c_str(), preTransform });
+  std::vector<MeshBakeStats> stats;
+  bake_sh_terms(bakeInputs, settings, &stats);
+
+  bool succeeded = true;
+  for (size_t jobNo = 0; jobNo < jobs.size(); jobNo++)
+  {
+    BakedMesh baked;
+    baked.vertexData = std::move(jobs[jobNo].model.vertices);
+    baked.indexData = std::move(jobs[jobNo].model.indices);
+    baked.ior = settings.ior;
+    baked.sampleCount = settings.sampleCount;
+    baked.preTransform = preTransform;
+    // The renderer only maps the file while the OBJ and the settings are still the ones baked here
+    if (!make_bake_cache_key(jobs[jobNo].objPathString.c_str(), preTransform, settings, baked.bakeKey))
+    {
+      std::cout << "Failed to read " << jobs[jobNo].objPathString << "\n";
+      succeeded = false;
+      continue;
+    }
+
+    std::filesystem::path outputPath = jobs[jobNo].objPath;
+    outputPath.replace_extension(".baked");
+    if (!outputDirectory.empty())
+      outputPath = std::filesystem::path(outputDirectory) / outputPath.filename();
+    if (!write_baked_mesh(outputPath.string(), baked))
+    {
+      std::cout << "Failed to write " << outputPath.string() << "\n";
+      succeeded = false;
+    }
+
+    const MeshBakeStats& meshStats = stats[jobNo];
+    std::cout << jobs[jobNo].objPath.filename().string() << ": " << meshStats.vertexCount << " vertices, "
+      << meshStats.seconds << " s";
+    if (meshStats.cached)
+      std::cout << " (cached)";
+    else if (meshStats.seconds > 0.)
+      std::cout << ", " << meshStats.tracedVertexCount << " traced, "
+        << meshStats.tracedVertexCount * double(settings.sampleCount) / meshStats.seconds << " rays/s";
+    std::cout << " -> " << outputPath.string() << "\n";
+  }
 
-  return 0;
-}
\ No newline at end of file
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Baked " << jobs.size() << " meshes in " << seconds << " s, peak memory "
+    << peak_memory_mb() << " MB\n";
+  return succeeded ? 0 : 1;
+}
@@ -1,10 +1,28 @@
 #include "control/app.h"
+#include "preprocessing/spherical_harmonics.h"
 
-int main()
+int main(int argc, char** argv)
 {
-	std::system("cd src/shaders && python compile_shaders.py");
+	// --instances N fills the scene with N cubes, for measuring how the frame time scales
+	// --frames-in-flight N lets the CPU record up to N frames ahead of the GPU, trading latency for throughput
+	// --sdf-shape N and --march-steps N pick what the sky ray marches, its pipelines are specialized to them
+	size_t instanceCount = 1;
+	int framesInFlight = 2;
+	RayMarchSettings rayMarch;
+	for (int i = 1; i + 1 < argc; i++)
+		if (std::string(argv[i]) == "--instances")
+			instanceCount = std::stoul(argv[++i]);
+		else if (std::string(argv[i]) == "--frames-in-flight")
+			framesInFlight = std::stoi(argv[++i]);
+		else if (std::string(argv[i]) == "--sdf-shape")
+			rayMarch.shape = std::stoul(argv[++i]);
+		else if (std::string(argv[i]) == "--march-steps")
+			rayMarch.maxSteps = std::stoul(argv[++i]);
 
-	App* myApp = new App(1280, 720);
+	// The shaders include the basis of the configured order, so it has to be up to date before the engine compiles them
+	sh::write_glsl_include<SH_ORDER>("src/shaders/spherical_harmonics.glsl");
+
+	App* myApp = new App(1280, 720, instanceCount, framesInFlight, rayMarch);
 	myApp->run();
 	delete myApp;
 
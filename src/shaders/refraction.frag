@@ -17,15 +17,21 @@ layout(set = 1, binding = 0) uniform samplerCube material;
 layout(location = 0) out vec4 outColor;
 
 
-#define MAX_STEPS 100
+// Specialization constants, every combination in use gets a pipeline of its own in which they are folded in.
+// DISTANCE_MODE 1 ray marches the shape, 0 reads the mode from renderParams instead, which costs a branch per pixel.
+layout(constant_id = 0) const uint DISTANCE_MODE = 0u;
+// 0 box, 1 sphere, 2 tilted cylinder, 3 upright cylinder, 4 cone
+layout(constant_id = 1) const uint SDF_SHAPE = 1u;
+layout(constant_id = 2) const int MAX_STEPS = 100;
+layout(constant_id = 3) const float SURF_DIST = 0.001f;
+layout(constant_id = 4) const float REFRACTIVE_INDEX = IOR;
+
 #define MAX_DIST 100.f
-#define SURF_DIST 0.001f
 #define GAMMA 2.2f
 #define M_PI 3.1415926535897932384626433832795f
 #define UP vec3(0.f, 1.f, 0.f)
 
 
-const float R0 = (IOR - 1.f) * (IOR - 1.f) / ((IOR + 1.f) * (IOR + 1.f));
 const float SPHERE_RADIUS = 1.f;
 
 float sd_box(vec3 p, vec3 s)
@@ -83,13 +89,19 @@ float sd_box_frame(vec3 p, vec3 b, float e)
 
 float get_dist(vec3 p)
 {
-  // float d = sd_box(p, vec3(1.f));
-  float d = sd_sphere(p, SPHERE_RADIUS);
-  // float d = sd_cylinder(p, vec3(-0.2, -0.2, -0.f), vec3(0.f, 0.2, 0.2), 0.25);
-  // float d = sd_cylinder(p, vec3(-0.f, -0.2, -0.f), vec3(0.f, 0.2, 0.f), 0.25);
-  // float d = sd_cone(p - vec3(0.f, 0.5f, 0.f), vec2(sin(3.14f / 6.f), cos(3.14f / 6.f)), 1.f);
-  
-  return d;
+  switch (SDF_SHAPE)
+  {
+    case 0u:
+      return sd_box(p, vec3(1.f));
+    case 2u:
+      return sd_cylinder(p, vec3(-0.2, -0.2, -0.f), vec3(0.f, 0.2, 0.2), 0.25);
+    case 3u:
+      return sd_cylinder(p, vec3(-0.f, -0.2, -0.f), vec3(0.f, 0.2, 0.f), 0.25);
+    case 4u:
+      return sd_cone(p - vec3(0.f, 0.5f, 0.f), vec2(sin(3.14f / 6.f), cos(3.14f / 6.f)), 1.f);
+    default:
+      return sd_sphere(p, SPHERE_RADIUS);
+  }
 }
 
 
@@ -142,6 +154,8 @@ float get_fresnel_factor(float cosTheta)
 {
   // Schlick's approximation for reflective Fresnel factor on an interface between two insulators.
   // This clamp BS is needed only for ray marching. Remove when proper ray tracing is implemented.
+  // Folded into a constant once the index of refraction is specialized.
+  float R0 = (REFRACTIVE_INDEX - 1.f) * (REFRACTIVE_INDEX - 1.f) / ((REFRACTIVE_INDEX + 1.f) * (REFRACTIVE_INDEX + 1.f));
   return R0 + (1.f - R0) * pow5(1.f - clamp(cosTheta, 0.f, 1.f));
 }
 
@@ -156,7 +170,8 @@ void main()
 {
   vec3 color = sample_cubemap_linear_space(rayDirection);
 
-  if (renderParams.distanceCalculationMode == 1)
+  uint mode = DISTANCE_MODE == 0u ? renderParams.distanceCalculationMode : DISTANCE_MODE;
+  if (mode == 1u)
   {
     float dist = ray_march(cameraData.position.xzy, rayDirection, 1.f); // outside of object
     
@@ -174,14 +189,14 @@ void main()
       float T = 1.f - R;
       color += R * colorReflected;
       
-      vec3 inRayDirection = refract_safe(rayDirection, normal, 1.f/IOR); // ray direction when entering
+      vec3 inRayDirection = refract_safe(rayDirection, normal, 1.f/REFRACTIVE_INDEX); // ray direction when entering
       
       vec3 enterPoint = pos - normal * SURF_DIST * 3.f;
 
       float distanceInside = ray_march(enterPoint, inRayDirection, -1.f); // inside the object
       vec3 exitPoint = enterPoint + inRayDirection * distanceInside; // 3d position of exit
       vec3 exitNormal = -get_normal(exitPoint);
-      vec3 outRayDirection = refract_safe(inRayDirection, exitNormal, IOR);
+      vec3 outRayDirection = refract_safe(inRayDirection, exitNormal, REFRACTIVE_INDEX);
 
       vec3 colorRefracted = sample_cubemap_linear_space(outRayDirection);
       color += T * colorRefracted;
@@ -0,0 +1,24 @@
+// Generated from src/preprocessing/spherical_harmonics.h, do not edit.
+// Real spherical harmonics without normalization constants, which are already baked into the coefficients.
+// A VERY IMPORTANT NOTE: z-axis is the UP direction.
+
+#if SH_ORDER != 2
+#error "spherical_harmonics.glsl was generated for a different SH_ORDER, run the renderer to regenerate it"
+#endif
+
+void evaluate_sh_basis(vec3 dir, out float basis[SH_COEFFS_NUM])
+{
+  float c0 = 1.f, s0 = 0.f;
+  float c1 = dir.x * c0 - dir.y * s0, s1 = dir.x * s0 + dir.y * c0;
+  float c2 = dir.x * c1 - dir.y * s1, s2 = dir.x * s1 + dir.y * c1;
+
+  basis[0] = 1.f; // Y00
+  basis[1] = s1; // Y1m1
+  basis[2] = dir.z; // Y10
+  basis[3] = c1; // Y11
+  basis[4] = s2 * 0.5f; // Y2m2
+  basis[5] = dir.z * s1; // Y2m1
+  basis[6] = (3.f * dir.z * dir.z - 1.f); // Y20
+  basis[7] = dir.z * c1; // Y21
+  basis[8] = c2; // Y22
+}
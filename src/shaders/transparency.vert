@@ -1,6 +1,7 @@
 #version 450
 #extension GL_GOOGLE_include_directive : require
 #include "../common/common_definitions.h"
+#include "spherical_harmonics.glsl"
 
 layout(set = 0, binding = 0) uniform UBO {
 	CameraMatrices cameraMatrices;
@@ -10,8 +11,8 @@ layout(set = 0, binding = 1) uniform CameraData {
 	CameraVectors cameraVectors;
 };
 
-layout(std140, set = 0, binding = 2) readonly buffer storageBuffer {
-	mat4 model[];
+layout(std430, set = 0, binding = 2) readonly buffer storageBuffer {
+	InstanceTransform instances[];
 } ObjectData;
 
 layout(location = 0) in vec3 vertexPosition;
@@ -19,21 +20,8 @@ layout(location = 1) in vec3 vertexColor;
 layout(location = 2) in vec2 vertexTexCoord;
 layout(location = 3) in vec3 vertexNormal;
 
-layout(location = 4) in vec3 sphCoeffsWidth1;
-layout(location = 5) in vec3 sphCoeffsWidth2;
-layout(location = 6) in vec3 sphCoeffsWidth3;
-
-layout(location = 7) in vec3 sphCoeffsX1;
-layout(location = 8) in vec3 sphCoeffsX2;
-layout(location = 9) in vec3 sphCoeffsX3;
-
-layout(location = 10) in vec3 sphCoeffsY1;
-layout(location = 11) in vec3 sphCoeffsY2;
-layout(location = 12) in vec3 sphCoeffsY3;
-
-layout(location = 13) in vec3 sphCoeffsZ1;
-layout(location = 14) in vec3 sphCoeffsZ2;
-layout(location = 15) in vec3 sphCoeffsZ3;
+// Every coefficient holds (width, x, y, z)
+layout(location = 4) in vec4 sphCoeffs[SH_COEFFS_NUM];
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -47,22 +35,9 @@ layout(location = 6) out float fresnelFactor;
 
 const float R0 = (IOR - 1.f) * (IOR - 1.f) / ((IOR + 1.f) * (IOR + 1.f));
 
-// Implementation of spherical harmonics.
 // Note that constant coefficients are already accounted for in expansion terms.
-// A VERY IMPORTANT NOTE: notice how z-axis is UP direction.
-float Y00 (vec3 dir) { return 1.f; }
-
-float Y1m1(vec3 dir) { return dir.y; }
-float Y10 (vec3 dir) { return dir.z; }
-float Y11 (vec3 dir) { return dir.x; }
-
-float Y2m2(vec3 dir) { return dir.x * dir.y; }
-float Y2m1(vec3 dir) { return dir.y * dir.z; }
-float Y20 (vec3 dir) { return 3.f * dir.z * dir.z - 1.f; }
-float Y21 (vec3 dir) { return dir.x * dir.z; }
-float Y22 (vec3 dir) { return dir.x * dir.x - dir.y * dir.y; }
-
-float reconstruct_from_sh(vec3 rd, vec3 n, vec3 sphCoeffs1, vec3 sphCoeffs2, vec3 sphCoeffs3)
+// \returns width and the x, y and z-coordinates of the refracted vector
+vec4 reconstruct_from_sh(vec3 rd, vec3 n)
 {
   // Constructing right-handed orthonormal basis.
   // Again, look at how z-axis is UP direction in the local coordinate system, and not y-direction.
@@ -73,17 +48,13 @@ float reconstruct_from_sh(vec3 rd, vec3 n, vec3 sphCoeffs1, vec3 sphCoeffs2, vec
   
   // Here we go from object reference frame to vertex reference frame
   vec3 localDirection = rd * transform;
-  return sphCoeffs1.x * Y00 (localDirection)
-
-       + sphCoeffs1.y * Y1m1(localDirection)
-       + sphCoeffs1.z * Y10 (localDirection)
-       + sphCoeffs2.x * Y11 (localDirection)
+  float basis[SH_COEFFS_NUM];
+  evaluate_sh_basis(localDirection, basis);
 
-       + sphCoeffs2.y * Y2m2(localDirection)
-       + sphCoeffs2.z * Y2m1(localDirection)
-       + sphCoeffs3.x * Y20 (localDirection)
-       + sphCoeffs3.y * Y21 (localDirection)
-       + sphCoeffs3.z * Y22 (localDirection);
+  vec4 result = vec4(0.f);
+  for (int i = 0; i < SH_COEFFS_NUM; i++)
+    result += basis[i] * sphCoeffs[i];
+  return result;
 }
 
 float pow5(float x)
@@ -107,11 +78,13 @@ vec3 refract_safe(vec3 I, vec3 N, float eta)
 
 void main()
 {
-  vec4 currentVertexPos = ObjectData.model[gl_InstanceIndex] * vec4(vertexPosition, 1.f);
+  InstanceTransform instance = ObjectData.instances[gl_InstanceIndex];
+  vec4 currentVertexPos = vec4(vertexPosition * instance.scale + instance.position, 1.f);
 	gl_Position = cameraMatrices.viewProjection * currentVertexPos;
 	fragColor = vertexColor;
 	fragTexCoord = vertexTexCoord;
-	fragNormal = normalize((ObjectData.model[gl_InstanceIndex] * vec4(vertexNormal, 0.f)).xyz);
+  // Neither a uniform scale nor a translation turns the normal
+	fragNormal = normalize(vertexNormal);
 	vec3 rayDirection = normalize(currentVertexPos.xyz - cameraVectors.position.xyz);
 
   // We swith Y and Z-coordinates here to avoid many more calculations in fragment shader:
@@ -119,10 +92,9 @@ void main()
   fresnelFactor = get_fresnel_factor(dot(-rayDirection, fragNormal));
 
 	vec3 inRayDirection = refract_safe(rayDirection, fragNormal, 1.f / IOR);
-	width = reconstruct_from_sh(inRayDirection, -fragNormal, sphCoeffsWidth1, sphCoeffsWidth2, sphCoeffsWidth3);
+	vec4 encoded = reconstruct_from_sh(inRayDirection, -fragNormal);
+	width = encoded.x;
 
   // We swith Y and Z-coordinates here to avoid many more calculations in fragment shader:
-  refractedVector.x = reconstruct_from_sh(inRayDirection, -fragNormal, sphCoeffsX1, sphCoeffsX2, sphCoeffsX3);
-  refractedVector.z = reconstruct_from_sh(inRayDirection, -fragNormal, sphCoeffsY1, sphCoeffsY2, sphCoeffsY3);
-  refractedVector.y = reconstruct_from_sh(inRayDirection, -fragNormal, sphCoeffsZ1, sphCoeffsZ2, sphCoeffsZ3);
+  refractedVector = encoded.ywz;
 }
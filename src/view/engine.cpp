@@ -1,4 +1,8 @@
 #include "engine.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <filesystem>
 #include "vkInit/instance.h"
 #include "vkInit/device.h"
 #include "vkInit/swapchain.h"
@@ -9,24 +13,34 @@
 #include "vkInit/descriptors.h"
 #include "vkMesh/mesh.h"
 #include "vkMesh/obj_mesh.h"
+#include "vkUtil/allocator.h"
 
-Engine::Engine(int width, int height, GLFWwindow* window)
+Engine::Engine(int width, int height, GLFWwindow* window, int framesInFlight, RayMarchSettings rayMarch)
 {
 	this->width = width;
 	this->height = height;
 	this->window = window;
+	this->rayMarch = rayMarch;
+	frameContexts.resize(std::clamp(framesInFlight, 1, 3));
 
 	vklogging::Logger::getLogger()->print("Making a graphics engine...");
+	auto start = std::chrono::steady_clock::now();
 
 	makeInstance();
 	makeDevice();
 	makeDescriptorSetLayouts();
-	makePipelines();
-	finalizeSetup();
+	makeShaders();
 
+	// The pipelines are built while the assets load, the framebuffers need their renderpasses
 	makeWorkerThreads();
+	makePipelines();
 	makeAssets();
-	endWorkerThreads();
+	finalizeSetup();
+
+	vkutil::MemoryAllocator::getAllocator()->logStatistics();
+	vklogging::Logger::getLogger()->print("Made the engine in "
+		+ std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count())
+		+ " ms, the pipeline cache was " + (pipelineCache->isWarm() ? "warm" : "cold"));
 }
 
 void Engine::makeInstance()
@@ -53,9 +67,23 @@ void Engine::makeDevice()
 {
 	physicalDevice = vkinit::choose_physical_device(instance);
 	device = vkinit::create_logical_device(physicalDevice, surface);
-	std::array<vk::Queue,2> queues = vkinit::get_queues(physicalDevice, device, surface);
+	vkutil::MemoryAllocator::getAllocator()->init(device, physicalDevice);
+	std::array<vk::Queue,3> queues = vkinit::get_queues(physicalDevice, device, surface);
 	graphicsQueue = queues[0];
 	presentQueue = queues[1];
+	transferQueue = queues[2];
+
+	vkutil::QueueFamilyIndices indices = vkutil::find_queue_families(physicalDevice, surface);
+	transferQueueFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+	if (indices.transferFamily.has_value())
+		uploadQueueFamilies = { indices.graphicsFamily.value(), indices.transferFamily.value() };
+	stagingRing = new vkutil::StagingRing(device, physicalDevice, transferQueue, transferQueueFamily);
+	pipelineCache = new vkutil::PipelineCache(device, physicalDevice, "resources/pipeline.cache");
+
+	// Timing the passes on the GPU needs timestamps on the graphics queue
+	vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+	if (limits.timestampComputeAndGraphics)
+		timestampPeriod = limits.timestampPeriod;
 	makeSwapchain();
 	frameNumber = 0;
 }
@@ -70,7 +98,6 @@ void Engine::makeSwapchain()
 	swapchainFrames = bundle.frames;
 	swapchainFormat = bundle.format;
 	swapchainExtent = bundle.extent;
-	maxFramesInFlight = static_cast<int>(swapchainFrames.size());
 
 	for (vkutil::SwapChainFrame& frame : swapchainFrames)
 	{
@@ -78,6 +105,7 @@ void Engine::makeSwapchain()
 		frame.physicalDevice = physicalDevice;
 		frame.width = swapchainExtent.width;
 		frame.height = swapchainExtent.height;
+		frame.renderFinished = vkinit::make_semaphore(device);
 
 		frame.makeDepthResources();
 	}
@@ -87,23 +115,34 @@ void Engine::makeSwapchain()
 // The swapchain must be recreated upon resize or minimization, among other cases
 void Engine::recreateSwapchain()
 {
-	width = 0;
-	height = 0;
+	// Only a minimized window has to be waited for, waiting for events otherwise stalls every resize
+	glfwGetFramebufferSize(window, &width, &height);
 	while (width == 0 || height == 0)
 	{
-		glfwGetFramebufferSize(window, &width, &height);
 		glfwWaitEvents();
+		glfwGetFramebufferSize(window, &width, &height);
 	}
 
+	auto start = std::chrono::steady_clock::now();
 	device.waitIdle();
 
+	// Pipelines take their viewport and scissor when drawing, and the frame contexts don't depend on the
+	// swapchain, so only the images and what is made from them are replaced
+	vk::Format oldFormat = swapchainFormat;
 	cleanupSwapchain();
 	makeSwapchain();
+
+	// The renderpasses only fit images of the format they were made for
+	if (swapchainFormat != oldFormat)
+	{
+		destroyPipelines();
+		makePipelines();
+		workQueue.waitUntilDone();
+	}
 	make_framebuffers();
-	makeFrameResources();
-	vkinit::commandBufferInputChunk commandBufferInput = { device, commandPool, swapchainFrames };
-	vkinit::make_frame_command_buffers(commandBufferInput);
-	makePipelines();
+
+	frameTotals.resizeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	resizes++;
 }
 
 void Engine::makeDescriptorSetLayouts()
@@ -118,22 +157,22 @@ void Engine::makeDescriptorSetLayouts()
 	// Ideally, this should be automatic, it is impossible not to forget about this
 	// Sky pipeline bindings
 	skyPipelineBindings.emplace_back(
-		vk::DescriptorType::eUniformBuffer,
+		vk::DescriptorType::eUniformBufferDynamic,
 		vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment
 	);
 	skyPipelineBindings.emplace_back(
-		vk::DescriptorType::eUniformBuffer,
+		vk::DescriptorType::eUniformBufferDynamic,
 		vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment
 	);
 	frameSetLayout[pipelineType::SKY] = vkinit::makeDescriptorSetLayout(device, skyPipelineBindings);
 
 	// Standard pipeline bindings
 	standardPipelineBindings.emplace_back(
-		vk::DescriptorType::eUniformBuffer,
+		vk::DescriptorType::eUniformBufferDynamic,
 		vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment
 	);
 	standardPipelineBindings.emplace_back(
-		vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex
+		vk::DescriptorType::eUniformBufferDynamic, vk::ShaderStageFlagBits::eVertex
 	);
 	standardPipelineBindings.emplace_back(
 		vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eVertex
@@ -148,46 +187,170 @@ void Engine::makeDescriptorSetLayouts()
 	meshSetLayout[pipelineType::STANDARD] = vkinit::makeDescriptorSetLayout(device, individualDrawCallBindings);
 }
 
+// Destroy a pipeline along with its variants, it is one of them if there are any.
+static void destroy_pipeline(vk::Device device, vk::Pipeline pipeline, const vkinit::PipelineVariants& variants)
+{
+	if (variants.empty())
+		device.destroyPipeline(pipeline);
+	for (const auto& [values, variant] : variants)
+		device.destroyPipeline(variant);
+}
+
+// \returns the name of a pipeline in the log
+static const char* pipeline_name(pipelineType type)
+{
+	return type == pipelineType::SKY ? "sky" : "standard";
+}
+
+void Engine::makeShaders()
+{
+	auto start = std::chrono::steady_clock::now();
+	shaderCompiler = new vkutil::ShaderCompiler("src/shaders", "resources/shaders");
+	// Unlike a reload, there are no pipelines to fall back on, so a shader without SPIR-V ends startup here
+	for (pipelineType type : pipelineTypes)
+		for (const std::string& shader : pipelineShaders[type])
+			if (!shaderCompiler->update(shader))
+			{
+				vklogging::Logger::getLogger()->print("Shader " + shader + " is not available");
+				throw std::runtime_error("shader " + shader + " failed to compile and has no previous SPIR-V");
+			}
+
+	vklogging::Logger::getLogger()->print("Shaders ready in "
+		+ std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count())
+		+ " ms, " + std::to_string(shaderCompiler->compiledCount()) + " compiled and "
+		+ std::to_string(shaderCompiler->cachedCount()) + " unchanged");
+	lastShaderCheck = std::chrono::steady_clock::now();
+}
+
+std::unique_ptr<vkinit::PipelineBuilder> Engine::configurePipeline(pipelineType type)
+{
+	auto builder = std::make_unique<vkinit::PipelineBuilder>(device);
+	builder->setPipelineCache(pipelineCache->handle());
+	builder->specifyVertexShader(shaderCompiler->outputPath(pipelineShaders[type][0]).c_str());
+	builder->specifyFragmentShader(shaderCompiler->outputPath(pipelineShaders[type][1]).c_str());
+	builder->addDescriptorSetLayout(frameSetLayout[type]);
+	builder->addDescriptorSetLayout(meshSetLayout[type]);
+	builder->addColorAttachment(swapchainFormat, 0);
+
+	if (type == pipelineType::SKY)
+	{
+		builder->setOverwriteMode(false);
+		builder->clearDepthAttachment();
+
+		// Every mode is prebuilt so that switching between them is free, the first one is the default
+		for (uint32_t mode : { 1, 2, 3, 0 })
+			builder->addVariant(skyVariant(mode));
+	}
+	else
+	{
+		builder->setOverwriteMode(true);
+		builder->specifyVertexFormat(
+			vkmesh::get_pos_color_binding_description(), 
+			vkmesh::get_pos_color_attribute_descriptions()
+		);
+		builder->specifyDepthAttachment(swapchainFrames[0].depthFormat, 1);
+	}
+	return builder;
+}
+
+vkinit::SpecializationValues Engine::skyVariant(uint32_t mode) const
+{
+	// In the order of the constant_ids in refraction.frag
+	return {
+		mode,
+		rayMarch.shape,
+		rayMarch.maxSteps,
+		std::bit_cast<uint32_t>(rayMarch.surfaceDistance),
+		std::bit_cast<uint32_t>(rayMarch.refractiveIndex)
+	};
+}
+
 void Engine::makePipelines()
 {
-	vkinit::PipelineBuilder pipelineBuilder(device);
-
-	// Sky
-	pipelineBuilder.setOverwriteMode(false);
-	pipelineBuilder.specifyVertexShader("resources/shaders/simple_skybox.vert.spv");
-	pipelineBuilder.specifyFragmentShader("resources/shaders/refraction.frag.spv");
-	pipelineBuilder.specifySwapchainExtent(swapchainExtent);
-	pipelineBuilder.clearDepthAttachment();
-	pipelineBuilder.addDescriptorSetLayout(frameSetLayout[pipelineType::SKY]);
-	pipelineBuilder.addDescriptorSetLayout(meshSetLayout[pipelineType::SKY]);
-	pipelineBuilder.addColorAttachment(swapchainFormat, 0);
-
-	vkinit::GraphicsPipelineOutBundle output = pipelineBuilder.build();
-
-	pipelineLayout[pipelineType::SKY] = output.layout;
-	renderpass[pipelineType::SKY] = output.renderpass;
-	pipeline[pipelineType::SKY] = output.pipeline;
-	pipelineBuilder.reset();
-
-	// Standard
-	pipelineBuilder.setOverwriteMode(true);
-	pipelineBuilder.specifyVertexFormat(
-		vkmesh::get_pos_color_binding_description(), 
-		vkmesh::get_pos_color_attribute_descriptions()
-	);
-	pipelineBuilder.specifyVertexShader("resources/shaders/transparency.vert.spv");
-	pipelineBuilder.specifyFragmentShader("resources/shaders/transparency.frag.spv");
-	pipelineBuilder.specifySwapchainExtent(swapchainExtent);
-	pipelineBuilder.specifyDepthAttachment(swapchainFrames[0].depthFormat, 1);
-	pipelineBuilder.addDescriptorSetLayout(frameSetLayout[pipelineType::STANDARD]);
-	pipelineBuilder.addDescriptorSetLayout(meshSetLayout[pipelineType::STANDARD]);
-	pipelineBuilder.addColorAttachment(swapchainFormat, 0);
+	// Every pipeline gets a builder of its own, so that the workers can build them side by side.
+	// Once all are built the cache holds everything they need.
+	vkjob::Job* save = new vkjob::SavePipelineCache(pipelineCache, pipelineTypes.size());
+	std::vector<vkjob::Job*> builds;
+	for (pipelineType type : pipelineTypes)
+	{
+		// The map entries are made here, the jobs only write to them
+		builds.push_back(new vkjob::BuildPipeline(configurePipeline(type), pipelineLayout[type],
+			renderpass[type], pipeline[type], pipelineVariants[type], pipeline_name(type)));
+		builds.back()->then(save);
+	}
+
+	for (vkjob::Job* build : builds)
+		workQueue.add(build);
+}
 
-	output = pipelineBuilder.build();
+void Engine::reloadChangedShaders()
+{
+	// Checking means asking for the write time of every source, a few times a second is enough
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastShaderCheck < std::chrono::milliseconds(500))
+		return;
+	lastShaderCheck = now;
+
+	std::vector<std::string> changedShaders = shaderCompiler->findChangedShaders();
+	if (changedShaders.empty())
+		return;
 
-	pipelineLayout[pipelineType::STANDARD] = output.layout;
-	renderpass[pipelineType::STANDARD] = output.renderpass;
-	pipeline[pipelineType::STANDARD] = output.pipeline;
+	auto start = std::chrono::steady_clock::now();
+	size_t compiledBefore = shaderCompiler->compiledCount();
+	for (const std::string& shader : changedShaders)
+		shaderCompiler->update(shader);
+	// Nothing new was compiled if the files were only touched, or if they don't compile
+	if (shaderCompiler->compiledCount() == compiledBefore)
+		return;
+
+	std::vector<pipelineType> affected;
+	for (pipelineType type : pipelineTypes)
+		for (const std::string& shader : pipelineShaders[type])
+			if (std::find(changedShaders.begin(), changedShaders.end(), shader) != changedShaders.end())
+			{
+				affected.push_back(type);
+				break;
+			}
+
+	// The new pipelines are built next to the old ones, which are only replaced if building worked
+	std::unordered_map<pipelineType, vkinit::GraphicsPipelineOutBundle> rebuilt;
+	vkjob::Job* save = new vkjob::SavePipelineCache(pipelineCache, affected.size());
+	std::vector<vkjob::Job*> builds;
+	for (pipelineType type : affected)
+	{
+		vkinit::GraphicsPipelineOutBundle& output = rebuilt[type];
+		builds.push_back(new vkjob::BuildPipeline(configurePipeline(type), output.layout,
+			output.renderpass, output.pipeline, output.variants, pipeline_name(type)));
+		builds.back()->then(save);
+	}
+	for (vkjob::Job* build : builds)
+		workQueue.add(build);
+	workQueue.waitUntilDone();
+
+	device.waitIdle();
+	for (auto& [type, output] : rebuilt)
+	{
+		// A pipeline missing a variant would fail when switching to it, so it is kept out as well
+		if (!output.pipeline || output.variants.size() != pipelineVariants[type].size())
+		{
+			destroy_pipeline(device, output.pipeline, output.variants);
+			device.destroyPipelineLayout(output.layout);
+			device.destroyRenderPass(output.renderpass);
+			continue;
+		}
+
+		// Framebuffers work with any compatible renderpass, so they are kept
+		destroy_pipeline(device, pipeline[type], pipelineVariants[type]);
+		device.destroyPipelineLayout(pipelineLayout[type]);
+		device.destroyRenderPass(renderpass[type]);
+		pipeline[type] = output.pipeline;
+		pipelineVariants[type] = std::move(output.variants);
+		pipelineLayout[type] = output.layout;
+		renderpass[type] = output.renderpass;
+	}
+
+	vklogging::Logger::getLogger()->print("Reloaded shaders in "
+		+ std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) + " ms");
 }
 
 // Make a framebuffer for each frame
@@ -206,7 +369,7 @@ void Engine::finalizeSetup()
 
 	commandPool = vkinit::make_command_pool(device, physicalDevice, surface);
 
-	vkinit::commandBufferInputChunk commandBufferInput = { device, commandPool, swapchainFrames };
+	vkinit::commandBufferInputChunk commandBufferInput = { device, commandPool, frameContexts };
 	mainCommandBuffer = vkinit::make_command_buffer(commandBufferInput);
 	vkinit::make_frame_command_buffers(commandBufferInput);
 
@@ -217,15 +380,23 @@ void Engine::makeFrameResources()
 {
 	uint32_t descriptor_sets_per_frame = 2;
 	frameDescriptorPool = vkinit::make_descriptor_pool(
-		device, static_cast<uint32_t>(swapchainFrames.size() * descriptor_sets_per_frame),
-		{vk::DescriptorType::eUniformBuffer, vk::DescriptorType::eStorageBuffer}
+		device, static_cast<uint32_t>(frameContexts.size() * descriptor_sets_per_frame),
+		{vk::DescriptorType::eUniformBufferDynamic, vk::DescriptorType::eStorageBuffer}
 	);
 
-	for (vkutil::SwapChainFrame& frame : swapchainFrames)
+	for (vkutil::FrameContext& frame : frameContexts)
 	{
+		frame.logicalDevice = device;
+		frame.physicalDevice = physicalDevice;
 		frame.imageAvailable = vkinit::make_semaphore(device);
-		frame.renderFinished = vkinit::make_semaphore(device);
 		frame.inFlight = vkinit::make_fence(device);
+		if (timestampPeriod > 0.f)
+		{
+			vk::QueryPoolCreateInfo queryInfo = {};
+			queryInfo.queryType = vk::QueryType::eTimestamp;
+			queryInfo.queryCount = 2;
+			frame.timestamps = device.createQueryPool(queryInfo);
+		}
 
 		frame.makeDescriptorResources();
 
@@ -235,25 +406,23 @@ void Engine::makeFrameResources()
 			device, frameDescriptorPool, frameSetLayout[pipelineType::STANDARD]);
 
 		frame.recordWriteOperations();
+		frame.writeDescriptorSet();
 	}
 }
 
 void Engine::makeWorkerThreads()
 {
-	done = false;
-	size_t threadCount = std::thread::hardware_concurrency() - 1;
+	// The main thread only waits, so there is always at least one worker
+	size_t threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
 
+	// Uploads are only staged by the workers, the staging ring records and submits them itself
 	workers.reserve(threadCount);
-	vkinit::commandBufferInputChunk commandBufferInput = { device, commandPool, swapchainFrames };
 	for (size_t i = 0; i < threadCount; ++i)
-	{
-		vk::CommandBuffer commandBuffer = vkinit::make_command_buffer(commandBufferInput);
 		workers.push_back(
 			std::thread(
-				vkjob::WorkerThread(workQueue, done, commandBuffer, graphicsQueue)
+				vkjob::WorkerThread(workQueue)
 			)
 		);
-	}
 }
 
 void Engine::makeAssets()
@@ -299,11 +468,70 @@ void Engine::makeAssets()
 		device, static_cast<uint32_t>(filenames.size()) + 1, {vk::DescriptorType::eCombinedImageSampler}
 	);
 
-	// Submit loading work
-	workQueue.lock.lock();
+	// Submit loading work. Every asset is a chain of jobs, parse -> bake for meshes and
+	// decode -> upload -> describe for textures, and the chains of different assets overlap.
+	// A single bake joins the mesh chains, so that one pool of threads works on the vertices of all meshes,
+	// and as they share one vertex buffer, a single upload follows it.
 	std::vector<meshTypes> mesh_types = {
 		meshTypes::CUBE,// meshTypes::GIRL, meshTypes::SKULL, meshTypes::VIKING_ROOM
 	};
+	std::unordered_map<meshTypes, BakedMeshView> baked_models;
+	for (meshTypes type : mesh_types)
+	{
+		// Meshes baked offline by the preprocessor are mapped as they are, the OBJ is only a fallback.
+		// A baked mesh older than its OBJ or baked with other settings is parsed and baked again instead.
+		std::filesystem::path bakedPath = model_filenames[type][0];
+		bakedPath.replace_extension(".baked");
+		auto start = std::chrono::steady_clock::now();
+		BakedMeshView& baked = baked_models[type];
+		if (baked.open(bakedPath.string()) && baked.bakedWith(model_filenames[type][0], bakeSettings, preTransforms[type]))
+			vklogging::Logger::getLogger()->print("Mapped baked mesh " + bakedPath.string() + " in "
+				+ std::to_string(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) + " ms");
+		else
+			baked_models.erase(type);
+	}
+
+	// The map has to be complete before the jobs take references to its models
+	for (meshTypes type : mesh_types)
+		if (!baked_models.contains(type))
+			loaded_models[type] = vkmesh::ObjMesh();
+
+	for (auto& [type, baked] : baked_models)
+		meshes->consume(type, baked.vertexData(), baked.vertexFloatCount(), baked.indexData(), baked.indexCount());
+
+	std::vector<std::pair<meshTypes, vkmesh::ObjMesh*>> uploaded_models;
+	for (auto& [type, model] : loaded_models)
+		uploaded_models.emplace_back(type, &model);
+
+	vertexBufferFinalizationChunk finalizationInfo;
+	finalizationInfo.logicalDevice = device;
+	finalizationInfo.physicalDevice = physicalDevice;
+	finalizationInfo.queueFamilyIndices = uploadQueueFamilies;
+	finalizationInfo.stagingRing = stagingRing;
+	vkjob::Job* uploadMeshes = new vkjob::UploadMeshes(meshes, std::move(uploaded_models), finalizationInfo);
+
+	// With every mesh mapped there is nothing to wait for
+	std::vector<vkjob::Job*> roots;
+	if (loaded_models.empty())
+		roots.push_back(uploadMeshes);
+	else
+	{
+		std::vector<MeshBakeInput> bakeInputs;
+		for (auto& [type, model] : loaded_models)
+			bakeInputs.push_back({ model.vertices, model.indices, model_filenames[type][0], preTransforms[type] });
+		vkjob::Job* bake = new vkjob::BakeModels(std::move(bakeInputs), bakeSettings);
+		bake->then(uploadMeshes);
+
+		for (auto& [type, model] : loaded_models)
+		{
+			vkjob::Job* parse = new vkjob::MakeModel(model,
+				model_filenames[type][0], model_filenames[type][1],
+				preTransforms[type]);
+			parse->then(bake);
+			roots.push_back(parse);
+		}
+	}
+
 	for (meshTypes type : mesh_types)
 	{
 		vkimage::TextureInputChunk textureInfo;
@@ -312,59 +540,43 @@ void Engine::makeAssets()
 		textureInfo.layout = meshSetLayout[pipelineType::STANDARD];
 		textureInfo.descriptorPool = meshDescriptorPool;
 		textureInfo.filenames = filenames[type];
+		textureInfo.queueFamilyIndices = uploadQueueFamilies;
+		textureInfo.stagingRing = stagingRing;
 		materials[type] = new vkimage::Texture();
-		loaded_models[type] = vkmesh::ObjMesh();
-		workQueue.add(
-			new vkjob::MakeTexture(materials[type], textureInfo)
-		);
-		workQueue.add(
-			new vkjob::MakeModel(loaded_models[type], 
-				model_filenames[type][0], model_filenames[type][1], 
-				preTransforms[type])
-		);
+
+		vkjob::Job* decode = new vkjob::MakeTexture(materials[type], textureInfo);
+		vkjob::Job* upload = new vkjob::UploadTexture(materials[type], textureInfo);
+		decode->then(upload);
+		upload->then(new vkjob::WriteTextureDescriptor(materials[type], textureInfo.filenames[0]));
+		roots.push_back(decode);
 	}
-	workQueue.lock.unlock();
+
+	// Only added once the graph is complete, a root finishing early can't release a half-linked continuation
+	auto loadStart = std::chrono::steady_clock::now();
+	for (vkjob::Job* root : roots)
+		workQueue.add(root);
 
 	// Work will be done by the background threads, we just need to wait.
 #ifndef NDEBUG
 	std::cout << "Waiting for work to finish." << std::endl;
 #endif
-	while (true)
-	{
-		if (!workQueue.lock.try_lock())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(200));
-			continue;
-		}
-
-		if (workQueue.done())
-		{
+	workQueue.waitUntilDone();
 #ifndef NDEBUG
-			std::cout << "Work finished" << std::endl;
+	std::cout << "Work finished" << std::endl;
 #endif
-			workQueue.clear();
-			workQueue.lock.unlock();
-			break;
-		}
-		workQueue.lock.unlock();
-	}
 
-	//Consume loaded meshes
-	for (std::pair<meshTypes, vkmesh::ObjMesh> pair : loaded_models)
-		meshes->consume(pair.first, pair.second.vertices, pair.second.indices);
-
-	vertexBufferFinalizationChunk finalizationInfo;
-	finalizationInfo.logicalDevice = device;
-	finalizationInfo.physicalDevice = physicalDevice;
-	finalizationInfo.commandBuffer = mainCommandBuffer;
-	finalizationInfo.queue = graphicsQueue;
-	meshes->finalize(finalizationInfo);
+	// The report includes the pipelines, which were queued before the assets
+	double loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+	vkjob::JobGraphReport report = workQueue.takeReport();
+	vklogging::Logger::getLogger()->print("Loaded assets in " + std::to_string(loadTime) + " ms: "
+		+ std::to_string(report.jobCount) + " jobs, " + std::to_string(report.busyMilliseconds) + " ms of work, "
+		+ "critical path " + std::to_string(report.criticalPathMilliseconds) + " ms (" + report.criticalPath + ")");
 
 	//Proceed when work is done
 
 	vkimage::TextureInputChunk textureInfo;
-	textureInfo.commandBuffer = mainCommandBuffer;
-	textureInfo.queue = graphicsQueue;
+	textureInfo.stagingRing = stagingRing;
+	textureInfo.queueFamilyIndices = uploadQueueFamilies;
 	textureInfo.logicalDevice = device;
 	textureInfo.physicalDevice = physicalDevice;
 	textureInfo.descriptorPool = meshDescriptorPool;
@@ -378,15 +590,21 @@ void Engine::makeAssets()
 			"resources/textures/skybox/negz.jpg", //z-
 	};
 	cubemap = new vkimage::CubeMap(textureInfo);
+
+	// Everything was staged into the ring, it goes out in as few submissions as fit
+	uploadsDone = vkinit::make_semaphore(device);
+	stagingRing->finish(uploadsDone);
+	uploadsPending = true;
+	vklogging::Logger::getLogger()->print("Uploaded assets in "
+		+ std::to_string(stagingRing->submissionCount()) + " staging submissions");
 }
 
 void Engine::endWorkerThreads()
 {
-	done = true;
-	size_t threadCount = std::thread::hardware_concurrency() - 1;
-
-	for (size_t i = 0; i < threadCount; ++i)
-		workers[i].join();
+	workQueue.stop(workers.size());
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
 
 #ifndef NDEBUG
 	std::cout << "Threads ended successfully." << std::endl;
@@ -404,19 +622,46 @@ void Engine::setDistanceCalculationMode(int mode)
 	distanceCalculationMode = mode;
 }
 
-void Engine::prepareFrame(uint32_t imageIndex, Scene* scene)
+void Engine::setUniformBranching(bool enabled)
+{
+	uniformBranching = enabled;
+}
+
+void Engine::waitForFrameContext(vkutil::FrameContext& frame)
 {
-	vkutil::SwapChainFrame& _frame = swapchainFrames[imageIndex];
+	auto start = std::chrono::steady_clock::now();
+	std::ignore = device.waitForFences(1, &frame.inFlight, VK_TRUE, UINT64_MAX);
+	auto end = std::chrono::steady_clock::now();
+
+	frameTotals.fenceWaitSeconds += std::chrono::duration<double>(end - start).count();
+	if (frame.submitted)
+	{
+		frameTotals.latencySeconds += std::chrono::duration<double>(end - frame.submitTime).count();
+		retiredFrames++;
+		frame.submitted = false;
+
+		// The fence says the frame is done, so its timestamps are there
+		uint64_t ticks[2];
+		if (frame.timestamps && device.getQueryPoolResults(frame.timestamps, 0, 2, sizeof(ticks), ticks,
+			sizeof(uint64_t), vk::QueryResultFlagBits::e64) == vk::Result::eSuccess)
+		{
+			frameTotals.skyPassSeconds += (ticks[1] - ticks[0]) * static_cast<double>(timestampPeriod) * 1e-9;
+			timedFrames++;
+		}
+	}
+}
+
+void Engine::prepareFrame(vkutil::FrameContext& _frame, Scene* scene)
+{
+	auto start = std::chrono::steady_clock::now();
 
 	_frame.cameraVectorData.forwards = camVecForwards;
 	_frame.cameraVectorData.right = camVecRight;
 	_frame.cameraVectorData.up = camVecUp;
 	_frame.cameraVectorData.position = camPos;
-	memcpy(_frame.cameraVectorWriteLocation, &(_frame.cameraVectorData), sizeof(CameraVectors));
 
 	_frame.renderParamsData.aspectRatio = static_cast<float>(height) / static_cast<float>(width);
 	_frame.renderParamsData.distanceCalculationMode = distanceCalculationMode;
-	memcpy(_frame.renderParamsWriteLocation, &(_frame.renderParamsData), sizeof(RenderParams));
 
 	glm::mat4 projection = glm::perspective(glm::radians(45.f), static_cast<float>(swapchainExtent.width) / static_cast<float>(swapchainExtent.height), 0.1f, 100.f);
 	projection[1][1] *= -1;
@@ -424,15 +669,36 @@ void Engine::prepareFrame(uint32_t imageIndex, Scene* scene)
 	_frame.cameraMatrixData.view = view;
 	_frame.cameraMatrixData.projection = projection;
 	_frame.cameraMatrixData.viewProjection = projection * view;
-	memcpy(_frame.cameraMatrixWriteLocation, &(_frame.cameraMatrixData), sizeof(CameraMatrices));
+	_frame.pushUniforms();
+
+	_frame.uploadInstances(*scene);
 
-	size_t i = 0;
-	for (std::pair<meshTypes, std::vector<glm::vec3>> pair : scene->positions)
-		for (glm::vec3& position : pair.second)
-			_frame.modelTransforms[i++] = glm::translate(glm::mat4(1.f), position);
-	memcpy(_frame.modelBufferWriteLocation, _frame.modelTransforms.data(), i * sizeof(glm::mat4));
+	frameTotals.prepareSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	preparedFrames++;
+}
 
-	_frame.writeDescriptorSet();
+FrameStatistics Engine::takeFrameStatistics()
+{
+	FrameStatistics average = {};
+	average.resizes = resizes;
+	if (resizes > 0)
+		average.resizeSeconds = frameTotals.resizeSeconds / resizes;
+	if (preparedFrames > 0)
+	{
+		average.prepareSeconds = frameTotals.prepareSeconds / preparedFrames;
+		average.fenceWaitSeconds = frameTotals.fenceWaitSeconds / preparedFrames;
+	}
+	if (retiredFrames > 0)
+		average.latencySeconds = frameTotals.latencySeconds / retiredFrames;
+	if (timedFrames > 0)
+		average.skyPassSeconds = frameTotals.skyPassSeconds / timedFrames;
+
+	frameTotals = {};
+	preparedFrames = 0;
+	retiredFrames = 0;
+	timedFrames = 0;
+	resizes = 0;
+	return average;
 }
 
 void Engine::prepareScene(vk::CommandBuffer commandBuffer)
@@ -443,7 +709,7 @@ void Engine::prepareScene(vk::CommandBuffer commandBuffer)
 	commandBuffer.bindIndexBuffer(meshes->indexBuffer.buffer, 0, vk::IndexType::eUint32);
 }
 
-void Engine::recordDrawCommandsSky(vk::CommandBuffer commandBuffer, uint32_t imageIndex, Scene* scene)
+void Engine::recordDrawCommandsSky(vk::CommandBuffer commandBuffer, const vkutil::FrameContext& frame, uint32_t imageIndex, Scene* scene)
 {
 	vk::RenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.renderPass = renderpass[pipelineType::SKY];
@@ -460,9 +726,16 @@ void Engine::recordDrawCommandsSky(vk::CommandBuffer commandBuffer, uint32_t ima
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
+	// The variants are all built up front, a mode without one falls back to the default
+	vk::Pipeline skyPipeline = pipeline[pipelineType::SKY];
+	auto variant = pipelineVariants[pipelineType::SKY].find(skyVariant(uniformBranching ? 0 : distanceCalculationMode));
+	if (variant != pipelineVariants[pipelineType::SKY].end())
+		skyPipeline = variant->second;
+
 	commandBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
-	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline[pipelineType::SKY]);
-	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout[pipelineType::SKY], 0, swapchainFrames[imageIndex].descriptorSet[pipelineType::SKY], nullptr);
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, skyPipeline);
+	setViewportAndScissor(commandBuffer);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout[pipelineType::SKY], 0, frame.descriptorSet.at(pipelineType::SKY), frame.dynamicOffsets(pipelineType::SKY));
 
 	cubemap->use(commandBuffer, pipelineLayout[pipelineType::SKY]);
 	commandBuffer.draw(6, 1, 0, 0);
@@ -470,7 +743,7 @@ void Engine::recordDrawCommandsSky(vk::CommandBuffer commandBuffer, uint32_t ima
 	commandBuffer.endRenderPass();
 }
 
-void Engine::recordDrawCommandsScene(vk::CommandBuffer commandBuffer, uint32_t imageIndex, Scene* scene)
+void Engine::recordDrawCommandsScene(vk::CommandBuffer commandBuffer, const vkutil::FrameContext& frame, uint32_t imageIndex, Scene* scene)
 {
 	vk::RenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.renderPass = renderpass[pipelineType::STANDARD];
@@ -494,41 +767,59 @@ void Engine::recordDrawCommandsScene(vk::CommandBuffer commandBuffer, uint32_t i
 	{
 		commandBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
 		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline[pipelineType::STANDARD]);	
-		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout[pipelineType::STANDARD], 0, swapchainFrames[imageIndex].descriptorSet[pipelineType::STANDARD], nullptr);
+		setViewportAndScissor(commandBuffer);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout[pipelineType::STANDARD], 0, frame.descriptorSet.at(pipelineType::STANDARD), frame.dynamicOffsets(pipelineType::STANDARD));
 
 		prepareScene(commandBuffer);
 		cubemap->use(commandBuffer, pipelineLayout[pipelineType::STANDARD]);
 
-		uint32_t startInstance = 0;
-		for (std::pair<meshTypes, std::vector<glm::vec3>> pair : scene->positions)
-			renderObjects(
-				commandBuffer, pair.first, startInstance, static_cast<uint32_t>(pair.second.size())
-			);
+		for (const Scene::MeshRange& range : scene->meshRanges())
+			renderObjects(commandBuffer, range.type, range.first, range.count);
 
 		commandBuffer.endRenderPass();
 	}
 }
 
-void Engine::renderObjects(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance, uint32_t instanceCount)
+void Engine::setViewportAndScissor(vk::CommandBuffer commandBuffer)
+{
+	vk::Viewport viewport = {};
+	viewport.x = 0.f;
+	viewport.y = 0.f;
+	viewport.width = static_cast<float>(swapchainExtent.width);
+	viewport.height = static_cast<float>(swapchainExtent.height);
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+	commandBuffer.setViewport(0, viewport);
+
+	vk::Rect2D scissor = {};
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	scissor.extent = swapchainExtent;
+	commandBuffer.setScissor(0, scissor);
+}
+
+void Engine::renderObjects(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t firstInstance, uint32_t instanceCount)
 {
 	int indexCount = meshes->indexCounts.find(objectType)->second;
 	int firstIndex = meshes->firstIndices.find(objectType)->second;
+	int vertexOffset = meshes->vertexOffsets.find(objectType)->second;
 	// materials[objectType]->use(commandBuffer, pipelineLayout[pipelineType::STANDARD]);
-	commandBuffer.drawIndexed(indexCount, instanceCount, firstIndex, 0, startInstance);
-	startInstance += instanceCount;
+	commandBuffer.drawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
 void Engine::render(Scene* scene)
 {
-	std::ignore = device.waitForFences(1, &(swapchainFrames[frameNumber].inFlight), VK_TRUE, UINT64_MAX);
-	std::ignore = device.resetFences(1, &(swapchainFrames[frameNumber].inFlight));
+	reloadChangedShaders();
+
+	vkutil::FrameContext& frame = frameContexts[frameNumber];
+	waitForFrameContext(frame);
 
 	uint32_t imageIndex;
 	try
 	{
 		vk::ResultValue acquire = device.acquireNextImageKHR(
 			swapchain, UINT64_MAX, 
-			swapchainFrames[frameNumber].imageAvailable, nullptr
+			frame.imageAvailable, nullptr
 		);
 		imageIndex = acquire.value;
 	}
@@ -549,11 +840,20 @@ void Engine::render(Scene* scene)
 		std::cout << "Failed to acquire swapchain image!" << std::endl;
 	}
 
-	vk::CommandBuffer commandBuffer = swapchainFrames[frameNumber].commandBuffer;
+	// With more contexts than images, or images handed out of order, another context may still be rendering to the image
+	vkutil::SwapChainFrame& image = swapchainFrames[imageIndex];
+	if (image.renderedBy && image.renderedBy != frame.inFlight)
+		std::ignore = device.waitForFences(1, &image.renderedBy, VK_TRUE, UINT64_MAX);
+	image.renderedBy = frame.inFlight;
+
+	// Only reset once a submission is certain to signal it again
+	std::ignore = device.resetFences(1, &frame.inFlight);
+
+	vk::CommandBuffer commandBuffer = frame.commandBuffer;
 
 	commandBuffer.reset();
 
-	prepareFrame(imageIndex, scene);
+	prepareFrame(frame, scene);
 
 	vk::CommandBufferBeginInfo beginInfo = {};
 
@@ -566,8 +866,15 @@ void Engine::render(Scene* scene)
 		vklogging::Logger::getLogger()->print("Failed to begin recording command buffer!");
 	}
 
-	recordDrawCommandsSky(commandBuffer, imageIndex, scene);
-	recordDrawCommandsScene(commandBuffer, imageIndex, scene);
+	if (frame.timestamps)
+	{
+		commandBuffer.resetQueryPool(frame.timestamps, 0, 2);
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.timestamps, 0);
+	}
+	recordDrawCommandsSky(commandBuffer, frame, imageIndex, scene);
+	if (frame.timestamps)
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestamps, 1);
+	recordDrawCommandsScene(commandBuffer, frame, imageIndex, scene);
 
 	try
 	{
@@ -580,22 +887,29 @@ void Engine::render(Scene* scene)
 
 	vk::SubmitInfo submitInfo = {};
 
-	vk::Semaphore waitSemaphores[] = { swapchainFrames[frameNumber].imageAvailable };
-	vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-	submitInfo.waitSemaphoreCount = 1;
+	// Until the first frame is submitted, the uploads on the transfer queue are waited for as well
+	vk::Semaphore waitSemaphores[] = { frame.imageAvailable, uploadsDone };
+	vk::PipelineStageFlags waitStages[] = {
+		vk::PipelineStageFlagBits::eColorAttachmentOutput,
+		vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eFragmentShader
+	};
+	submitInfo.waitSemaphoreCount = uploadsPending ? 2 : 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	vk::Semaphore signalSemaphores[] = { swapchainFrames[frameNumber].renderFinished };
+	vk::Semaphore signalSemaphores[] = { image.renderFinished };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
 	try
 	{
-		graphicsQueue.submit(submitInfo, swapchainFrames[frameNumber].inFlight);
+		graphicsQueue.submit(submitInfo, frame.inFlight);
+		frame.submitTime = std::chrono::steady_clock::now();
+		frame.submitted = true;
+		uploadsPending = false;
 	}
 	catch (vk::SystemError err)
 	{
@@ -623,14 +937,25 @@ void Engine::render(Scene* scene)
 		present = vk::Result::eErrorOutOfDateKHR;
 	}
 
+	// The frame was submitted, so the next one moves on to the next context either way
+	frameNumber = (frameNumber + 1) % static_cast<int>(frameContexts.size());
+
 	if (present == vk::Result::eErrorOutOfDateKHR || present == vk::Result::eSuboptimalKHR)
 	{
 		std::cout << "Recreate" << std::endl;
 		recreateSwapchain();
-		return;
 	}
+}
 
-	frameNumber = (frameNumber + 1) % maxFramesInFlight;
+void Engine::destroyPipelines()
+{
+	for (pipelineType pipeline_type : pipelineTypes)
+	{
+		destroy_pipeline(device, pipeline[pipeline_type], pipelineVariants[pipeline_type]);
+		pipelineVariants[pipeline_type].clear();
+		device.destroyPipelineLayout(pipelineLayout[pipeline_type]);
+		device.destroyRenderPass(renderpass[pipeline_type]);
+	}
 }
 
 // Free the memory associated with the swapchain objects
@@ -640,23 +965,21 @@ void Engine::cleanupSwapchain()
 		frame.destroy();
 
 	device.destroySwapchainKHR(swapchain);
-	device.destroyDescriptorPool(frameDescriptorPool);
 }
 
 Engine::~Engine()
 {
+	endWorkerThreads();
 	device.waitIdle();
 	vklogging::Logger::getLogger()->print("The app has been closed.");
 	device.destroyCommandPool(commandPool);
 
-	for (pipelineType pipeline_type : pipelineTypes)
-	{
-		device.destroyPipeline(pipeline[pipeline_type]);
-		device.destroyPipelineLayout(pipelineLayout[pipeline_type]);
-		device.destroyRenderPass(renderpass[pipeline_type]);
-	}
+	destroyPipelines();
 
 	cleanupSwapchain();
+	for (vkutil::FrameContext& frame : frameContexts)
+		frame.destroy();
+	device.destroyDescriptorPool(frameDescriptorPool);
 	for (pipelineType pipeline_type : pipelineTypes)
 	{
 		device.destroyDescriptorSetLayout(frameSetLayout[pipeline_type]);
@@ -669,7 +992,12 @@ Engine::~Engine()
 	for (const auto& [key, texture] : materials)
 		delete texture;
 	delete cubemap;
+	delete stagingRing;
+	device.destroySemaphore(uploadsDone);
+	delete pipelineCache;
+	delete shaderCompiler;
 
+	vkutil::MemoryAllocator::getAllocator()->destroy();
 	device.destroy();
 
 	instance.destroySurfaceKHR(surface);
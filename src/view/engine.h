@@ -2,24 +2,61 @@
 #include "camera.h"
 #include "../config.h"
 #include "vkUtil/frame.h"
+#include "vkUtil/frame_context.h"
+#include "vkUtil/shader_compiler.h"
 #include "../model/scene.h"
 #include "../model/vertex_menagerie.h"
 #include "vkImage/texture.h"
 #include "vkImage/cubemap.h"
 #include "vkJob/job.h"
 #include "vkJob/worker_thread.h"
+#include "../preprocessing/bake.h"
+#include "../preprocessing/baked_mesh.h"
+
+// Timings of the frames rendered since they were last taken, averaged per frame
+struct FrameStatistics {
+	// Spent filling the uniforms and instances of a frame
+	double prepareSeconds;
+	// Spent blocked until a frame context was free again
+	double fenceWaitSeconds;
+	// From submitting a frame until its context was found done, an upper bound of when the GPU finished it
+	double latencySeconds;
+	// Spent recreating the swapchain, per resize
+	double resizeSeconds;
+	int resizes;
+	// GPU time of the sky pass, 0 if the device can't time it
+	double skyPassSeconds;
+};
+
+// What the sky ray marches. The sky pipeline has a variant for every distance calculation mode with
+// these folded in, so none of them is branched on per pixel.
+struct RayMarchSettings {
+	// 0 box, 1 sphere, 2 tilted cylinder, 3 upright cylinder, 4 cone
+	uint32_t shape = 1;
+	uint32_t maxSteps = 100;
+	float surfaceDistance = 0.001f;
+	float refractiveIndex = IOR;
+};
 
 class Engine {
 
 public:
 
-	Engine(int width, int height, GLFWwindow* window);
+	// \param framesInFlight how many frames the CPU may record ahead of the GPU, clamped to 1-3
+	Engine(int width, int height, GLFWwindow* window, int framesInFlight = 2, RayMarchSettings rayMarch = {});
 
 	~Engine();
 
 	void render(Scene* scene);
 	void updateCameraData(Camera& camera);
 	void setDistanceCalculationMode(int mode);
+	// \param enabled whether the sky uses the variant branching on the mode at runtime, for comparing its cost
+	void setUniformBranching(bool enabled);
+
+	// \returns the timings of the frames rendered since the last call
+	FrameStatistics takeFrameStatistics();
+
+	int getFramesInFlight() const { return static_cast<int>(frameContexts.size()); }
 
 private:
 
@@ -39,8 +76,20 @@ private:
 	vk::Device device{ nullptr };
 	vk::Queue graphicsQueue{ nullptr };
 	vk::Queue presentQueue{ nullptr };
+	// Uploads go to a dedicated transfer queue when the device has one, otherwise this is the graphics queue
+	vk::Queue transferQueue{ nullptr };
+	uint32_t transferQueueFamily;
+	// Families sharing the resources uploaded on the transfer queue, empty when it is the graphics queue
+	std::vector<uint32_t> uploadQueueFamilies;
+	// Every upload is staged here and submitted to the transfer queue in batches
+	vkutil::StagingRing* stagingRing;
+	// Signalled once the assets are uploaded, the first frame waits on it before reading them
+	vk::Semaphore uploadsDone{ nullptr };
+	bool uploadsPending = false;
 	vk::SwapchainKHR swapchain{ nullptr };
 	std::vector<vkutil::SwapChainFrame> swapchainFrames;
+	// One per frame in flight, recorded in turn
+	std::vector<vkutil::FrameContext> frameContexts;
 	vk::Format swapchainFormat;
 	vk::Extent2D swapchainExtent;
 
@@ -49,6 +98,18 @@ private:
 	std::unordered_map<pipelineType,vk::PipelineLayout> pipelineLayout;
 	std::unordered_map<pipelineType, vk::RenderPass> renderpass;
 	std::unordered_map<pipelineType, vk::Pipeline> pipeline;
+	// Specialized variants of the pipelines, pipeline holds the first of them
+	std::unordered_map<pipelineType, vkinit::PipelineVariants> pipelineVariants;
+	// Kept on disk, so that pipelines built before are only looked up
+	vkutil::PipelineCache* pipelineCache;
+	// The vertex and fragment shader of every pipeline
+	std::unordered_map<pipelineType, std::vector<std::string>> pipelineShaders = {
+		{ pipelineType::SKY, { "simple_skybox.vert", "refraction.frag" } },
+		{ pipelineType::STANDARD, { "transparency.vert", "transparency.frag" } }
+	};
+	// Keeps the SPIR-V up to date with the GLSL sources, also while running
+	vkutil::ShaderCompiler* shaderCompiler;
+	std::chrono::steady_clock::time_point lastShaderCheck;
 
 	// descriptor-related variables
 	std::unordered_map<pipelineType, vk::DescriptorSetLayout> frameSetLayout;
@@ -61,15 +122,17 @@ private:
 	vk::CommandBuffer mainCommandBuffer;
 
 	// Synchronization objects
-	int maxFramesInFlight, frameNumber;
+	int frameNumber;
 
 	// Asset pointers
 	VertexMenagerie* meshes;
 	std::unordered_map<meshTypes, vkimage::Texture*> materials;
 	vkimage::CubeMap* cubemap;
 
+	// Preprocessing
+	BakeSettings bakeSettings;
+
 	// Job System
-	bool done = false;
 	vkjob::WorkQueue workQueue;
 	std::vector<std::thread> workers;
 
@@ -79,6 +142,12 @@ private:
 
 	// Render-related variables
 	uint32_t distanceCalculationMode = 1;
+	RayMarchSettings rayMarch;
+	bool uniformBranching = false;
+	FrameStatistics frameTotals = {};
+	int preparedFrames = 0, retiredFrames = 0, resizes = 0, timedFrames = 0;
+	// Nanoseconds per timestamp tick, 0 if timestamps aren't supported
+	float timestampPeriod = 0.f;
 
 	//Iinstance setup
 	void makeInstance();
@@ -90,24 +159,38 @@ private:
 
 	// Pipeline setup
 	void makeDescriptorSetLayouts();
+	void makeShaders();
+	// \returns a builder configured for a pipeline
+	std::unique_ptr<vkinit::PipelineBuilder> configurePipeline(pipelineType type);
+	// \param mode the distance calculation mode, 0 for the variant reading it from the uniforms
+	// \returns the specialization constants of the sky variant for a mode
+	vkinit::SpecializationValues skyVariant(uint32_t mode) const;
+	// Queue the pipelines to be built on the worker threads, they are ready once the work queue is done.
 	void makePipelines();
+	void destroyPipelines();
+	// Recompile the shaders changed on disk and swap the pipelines using them.
+	void reloadChangedShaders();
 
 	// Final setup steps
 	void finalizeSetup();
 	void make_framebuffers();
 	void makeFrameResources();
 
-	// Asset creation
+	// Asset creation, the worker threads live as long as the engine
 	void makeWorkerThreads();
 	void makeAssets();
 	void endWorkerThreads();
 
-	void prepareFrame(uint32_t imageIndex, Scene* scene);
+	// Wait until the GPU is done with the last frame recorded into a context.
+	void waitForFrameContext(vkutil::FrameContext& frame);
+	void prepareFrame(vkutil::FrameContext& frame, Scene* scene);
 	void prepareScene(vk::CommandBuffer commandBuffer);
-	void recordDrawCommandsSky(vk::CommandBuffer commandBuffer, uint32_t imageIndex, Scene* scene);
-	void recordDrawCommandsScene(vk::CommandBuffer commandBuffer, uint32_t imageIndex, Scene* scene);
+	void recordDrawCommandsSky(vk::CommandBuffer commandBuffer, const vkutil::FrameContext& frame, uint32_t imageIndex, Scene* scene);
+	void recordDrawCommandsScene(vk::CommandBuffer commandBuffer, const vkutil::FrameContext& frame, uint32_t imageIndex, Scene* scene);
+	// The pipelines leave these to the command buffer, so that they work with any swapchain size.
+	void setViewportAndScissor(vk::CommandBuffer commandBuffer);
 	void renderObjects(
-		vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance, uint32_t instanceCount);
+		vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t firstInstance, uint32_t instanceCount);
 
 	// Cleanup functions
 	void cleanupSwapchain();
@@ -1,6 +1,7 @@
 #include "cubemap.h"
 #include "stb_image.h"
 #include "../vkUtil/memory.h"
+#include "../vkUtil/allocator.h"
 #include "../../control/logging.h"
 #include "../vkInit/descriptors.h"
 
@@ -9,8 +10,6 @@ vkimage::CubeMap::CubeMap(TextureInputChunk input)
 	logicalDevice = input.logicalDevice;
 	physicalDevice = input.physicalDevice;
 	filenames = input.filenames;
-	commandBuffer = input.commandBuffer;
-	queue = input.queue;
 	layout = input.layout;
 	descriptorPool = input.descriptorPool;
 	load();
@@ -25,10 +24,11 @@ vkimage::CubeMap::CubeMap(TextureInputChunk input)
 	imageInput.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
 	imageInput.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
 	imageInput.flags = vk::ImageCreateFlagBits::eCubeCompatible;
-	
+	imageInput.queueFamilyIndices = input.queueFamilyIndices;
+
 	image = make_image(imageInput);
 	imageMemory = make_image_memory(imageInput, image);
-	populate();
+	input.stagingRing->uploadImage(reinterpret_cast<const void* const*>(pixels), 6, image, width, height);
 	for (int i = 0; i < 6; ++i)
 		free(pixels[i]);
 
@@ -39,8 +39,8 @@ vkimage::CubeMap::CubeMap(TextureInputChunk input)
 
 vkimage::CubeMap::~CubeMap()
 {
-	logicalDevice.freeMemory(imageMemory);
 	logicalDevice.destroyImage(image);
+	vkutil::MemoryAllocator::getAllocator()->free(imageMemory);
 	logicalDevice.destroyImageView(imageView);
 	logicalDevice.destroySampler(sampler);
 }
@@ -55,56 +55,6 @@ void vkimage::CubeMap::load()
 	}
 }
 
-void vkimage::CubeMap::populate()
-{
-	// First create a CPU-visible buffer...
-	BufferInputChunk input;
-	input.logicalDevice = logicalDevice;
-	input.physicalDevice = physicalDevice;
-	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible;
-	input.usage = vk::BufferUsageFlagBits::eTransferSrc;
-	size_t image_size = width * height * 4;
-	input.size = image_size * 6;
-
-	Buffer stagingBuffer = vkutil::create_buffer(input);
-
-	// ...then fill it,
-	for (int i = 0; i < 6; ++i)
-	{
-		void* writeLocation = logicalDevice.mapMemory(stagingBuffer.bufferMemory, image_size * i, image_size);
-		memcpy(writeLocation, pixels[i], image_size);
-		logicalDevice.unmapMemory(stagingBuffer.bufferMemory);
-	}
-
-	// then transfer it to image memory
-	ImageLayoutTransitionJob transitionJob;
-	transitionJob.commandBuffer = commandBuffer;
-	transitionJob.queue = queue;
-	transitionJob.image = image;
-	transitionJob.oldLayout = vk::ImageLayout::eUndefined;
-	transitionJob.newLayout = vk::ImageLayout::eTransferDstOptimal;
-	transitionJob.arrayCount = 6;
-	transition_image_layout(transitionJob);
-
-	BufferImageCopyJob copyJob;
-	copyJob.commandBuffer = commandBuffer;
-	copyJob.queue = queue;
-	copyJob.srcBuffer = stagingBuffer.buffer;
-	copyJob.dstImage = image;
-	copyJob.width = width;
-	copyJob.height = height;
-	copyJob.arrayCount = 6;
-	copy_buffer_to_image(copyJob);
-
-	transitionJob.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-	transitionJob.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-	transition_image_layout(transitionJob);
-
-	//Now the staging buffer can be destroyed
-	logicalDevice.freeMemory(stagingBuffer.bufferMemory);
-	logicalDevice.destroyBuffer(stagingBuffer.buffer);
-}
-
 void vkimage::CubeMap::makeView()
 {
 	imageView = make_image_view(
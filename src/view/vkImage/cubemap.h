@@ -24,7 +24,7 @@ namespace vkimage {
 
 		// Resources
 		vk::Image image;
-		vk::DeviceMemory imageMemory;
+		MemoryAllocation imageMemory;
 		vk::ImageView imageView;
 		vk::Sampler sampler;
 
@@ -33,16 +33,9 @@ namespace vkimage {
 		vk::DescriptorSet descriptorSet;
 		vk::DescriptorPool descriptorPool;
 
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
-
 		// Load the raw image data from the internally set filepath.
 		void load();
 
-		// Send loaded data to the image. The image must be loaded before calling
-		// this function.
-		void populate();
-
 		// Create a view of the texture. The image must be populated before calling this function.
 		void makeView();
 
@@ -2,8 +2,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "../vkUtil/memory.h"
+#include "../vkUtil/allocator.h"
 #include "../../control/logging.h"
-#include "../vkUtil/single_time_commands.h"
 #include "../vkInit/descriptors.h"
 
 vk::Image vkimage::make_image(ImageInputChunk input)
@@ -36,7 +36,14 @@ vk::Image vkimage::make_image(ImageInputChunk input)
 	imageInfo.tiling = input.tiling;
 	imageInfo.initialLayout = vk::ImageLayout::eUndefined;
 	imageInfo.usage = input.usage;
-	imageInfo.sharingMode = vk::SharingMode::eExclusive;
+	if (input.queueFamilyIndices.size() > 1)
+	{
+		imageInfo.sharingMode = vk::SharingMode::eConcurrent;
+		imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(input.queueFamilyIndices.size());
+		imageInfo.pQueueFamilyIndices = input.queueFamilyIndices.data();
+	}
+	else
+		imageInfo.sharingMode = vk::SharingMode::eExclusive;
 	imageInfo.samples = vk::SampleCountFlagBits::e1;
 
 	try
@@ -50,132 +57,22 @@ vk::Image vkimage::make_image(ImageInputChunk input)
 	return nullptr;
 }
 
-vk::DeviceMemory vkimage::make_image_memory(ImageInputChunk input, vk::Image image)
+MemoryAllocation vkimage::make_image_memory(ImageInputChunk input, vk::Image image)
 {
 	vk::MemoryRequirements requirements = input.logicalDevice.getImageMemoryRequirements(image);
 
-	vk::MemoryAllocateInfo allocation;
-	allocation.allocationSize = requirements.size;
-	allocation.memoryTypeIndex = vkutil::find_memory_type_index(
-		input.physicalDevice, requirements.memoryTypeBits, input.memoryProperties
+	MemoryAllocation imageMemory = vkutil::MemoryAllocator::getAllocator()->allocate(
+		requirements, input.memoryProperties,
+		input.tiling == vk::ImageTiling::eLinear
 	);
-
-	try
-	{
-		vk::DeviceMemory imageMemory = input.logicalDevice.allocateMemory(allocation);
-		input.logicalDevice.bindImageMemory(image, imageMemory, 0);
-		return imageMemory;
-	}
-	catch (vk::SystemError err)
+	if (!imageMemory.memory)
 	{
 		vklogging::Logger::getLogger()->print("Unable to allocate memory for image");
+		return imageMemory;
 	}
-	return nullptr;
-}
-
-void vkimage::transition_image_layout(ImageLayoutTransitionJob transitionJob)
-{
-	vkutil::start_job(transitionJob.commandBuffer);
-
-	// typedef struct VkImageSubresourceRange {
-	// 	VkImageAspectFlags    aspectMask;
-	// 	uint32_t              baseMipLevel;
-	// 	uint32_t              levelCount;
-	// 	uint32_t              baseArrayLayer;
-	// 	uint32_t              layerCount;
-	// } VkImageSubresourceRange;
-
-	vk::ImageSubresourceRange access;
-	access.aspectMask = vk::ImageAspectFlagBits::eColor;
-	access.baseMipLevel = 0;
-	access.levelCount = 1;
-	access.baseArrayLayer = 0;
-	access.layerCount = transitionJob.arrayCount;
-
-	// typedef struct VkImageMemoryBarrier {
-	// 	VkStructureType            sType;
-	// 	const void* pNext;
-	// 	VkAccessFlags              srcAccessMask;
-	// 	VkAccessFlags              dstAccessMask;
-	// 	VkImageLayout              oldLayout;
-	// 	VkImageLayout              newLayout;
-	// 	uint32_t                   srcQueueFamilyIndex;
-	// 	uint32_t                   dstQueueFamilyIndex;
-	// 	VkImage                    image;
-	// 	VkImageSubresourceRange    subresourceRange;
-	// } VkImageMemoryBarrier;
-
-	vk::ImageMemoryBarrier barrier;
-	barrier.oldLayout = transitionJob.oldLayout;
-	barrier.newLayout = transitionJob.newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = transitionJob.image;
-	barrier.subresourceRange = access;
-
-	vk::PipelineStageFlags sourceStage, destinationStage;
-
-	if (transitionJob.oldLayout == vk::ImageLayout::eUndefined
-		&& transitionJob.newLayout == vk::ImageLayout::eTransferDstOptimal)
-	{
-
-		barrier.srcAccessMask = vk::AccessFlagBits::eNoneKHR;
-		barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-
-		sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-		destinationStage = vk::PipelineStageFlagBits::eTransfer;
-	}
-	else
-	{
-		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-		barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-		sourceStage = vk::PipelineStageFlagBits::eTransfer;
-		destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
-	}
-	
-	transitionJob.commandBuffer.pipelineBarrier(sourceStage, destinationStage, vk::DependencyFlags(), nullptr, nullptr, barrier);
-
-	vkutil::end_job(transitionJob.commandBuffer, transitionJob.queue);
-}
-
-void vkimage::copy_buffer_to_image(BufferImageCopyJob copyJob)
-{
-	vkutil::start_job(copyJob.commandBuffer);
-
-	// typedef struct VkBufferImageCopy {
-	// 	VkDeviceSize                bufferOffset;
-	// 	uint32_t                    bufferRowLength;
-	// 	uint32_t                    bufferImageHeight;
-	// 	VkImageSubresourceLayers    imageSubresource;
-	// 	VkOffset3D                  imageOffset;
-	// 	VkExtent3D                  imageExtent;
-	// } VkBufferImageCopy;
-
-	vk::BufferImageCopy copy;
-	copy.bufferOffset = 0;
-	copy.bufferRowLength = 0;
-	copy.bufferImageHeight = 0;
-
-	vk::ImageSubresourceLayers access;
-	access.aspectMask = vk::ImageAspectFlagBits::eColor;
-	access.mipLevel = 0;
-	access.baseArrayLayer = 0;
-	access.layerCount = copyJob.arrayCount;
-	copy.imageSubresource = access;
-
-	copy.imageOffset = vk::Offset3D( 0, 0, 0 );
-	copy.imageExtent = vk::Extent3D(
-		copyJob.width,
-		copyJob.height,
-		1
-	);
-
-	copyJob.commandBuffer.copyBufferToImage(
-		copyJob.srcBuffer, copyJob.dstImage, vk::ImageLayout::eTransferDstOptimal, copy
-	);
 
-	vkutil::end_job(copyJob.commandBuffer, copyJob.queue);
+	input.logicalDevice.bindImageMemory(image, imageMemory.memory, imageMemory.offset);
+	return imageMemory;
 }
 
 vk::ImageView vkimage::make_image_view(
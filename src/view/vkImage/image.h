@@ -1,6 +1,7 @@
 #pragma once
 #include "stb_image.h"
 #include "../../config.h"
+#include "../vkUtil/staging.h"
 
 namespace vkimage {
 
@@ -9,10 +10,12 @@ namespace vkimage {
 		vk::Device logicalDevice;
 		vk::PhysicalDevice physicalDevice;
 		std::vector<const char*> filenames;
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
+		// Pixels are staged here, they have arrived once the ring is finished
+		vkutil::StagingRing* stagingRing;
 		vk::DescriptorSetLayout layout;
 		vk::DescriptorPool descriptorPool;
+		// Queue families using the image, left empty for the family of the upload queue alone
+		std::vector<uint32_t> queueFamilyIndices;
 	};
 
 	// For making individual vulkan images
@@ -26,44 +29,16 @@ namespace vkimage {
 		vk::Format format;
 		uint32_t arrayCount;
 		vk::ImageCreateFlags flags;
-	};
-
-	// For transitioning image layouts
-	struct ImageLayoutTransitionJob {
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
-		vk::Image image;
-		vk::ImageLayout oldLayout, newLayout;
-		uint32_t arrayCount;
-	};
-
-	// For copying a buffer to an image
-	struct BufferImageCopyJob {
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
-		vk::Buffer srcBuffer;
-		vk::Image dstImage;
-		int width, height;
-		uint32_t arrayCount;
+		// Queue families using the image, with more than one it is shared concurrently
+		std::vector<uint32_t> queueFamilyIndices;
 	};
 
 	// Make a Vulkan Image
 	vk::Image make_image(ImageInputChunk input);
 
-	// Allocate and bind the backing memory for a Vulkan Image, this memory must
-	// be freed upon image destruction.
-	vk::DeviceMemory make_image_memory(ImageInputChunk input, vk::Image image);
-
-	// Transition the layout of an image.
-	//
-	// Currently supports:
-	//
-	// undefined -> transfer_dst_optimal,
-	// transfer_dst_optimal -> shader_read_only_optimal
-	void transition_image_layout(ImageLayoutTransitionJob transitionJob);
-
-	// Copy from a buffer to an image. Image must be in the transfer_dst_optimal layout.
-	void copy_buffer_to_image(BufferImageCopyJob copyJob);
+	// Sub-allocate and bind the backing memory for a Vulkan Image, this memory must
+	// be returned to vkutil::MemoryAllocator upon image destruction.
+	MemoryAllocation make_image_memory(ImageInputChunk input, vk::Image image);
 
 	// Create a view of a vulkan image.
 	vk::ImageView make_image_view(
@@ -1,21 +1,31 @@
 #include "texture.h"
 #include "stb_image.h"
 #include "../vkUtil/memory.h"
+#include "../vkUtil/allocator.h"
 #include "../../control/logging.h"
 #include "../vkInit/descriptors.h"
 
 void vkimage::Texture::load(TextureInputChunk input)
+{
+	decode(input);
+	upload(input.stagingRing);
+	makeDescriptorSet();
+}
+
+void vkimage::Texture::decode(TextureInputChunk input)
 {
 	logicalDevice = input.logicalDevice;
 	physicalDevice = input.physicalDevice;
 	filename = input.filenames[0];
-	commandBuffer = input.commandBuffer;
-	queue = input.queue;
 	layout = input.layout;
 	descriptorPool = input.descriptorPool;
+	queueFamilyIndices = input.queueFamilyIndices;
 
 	load();
+}
 
+void vkimage::Texture::upload(vkutil::StagingRing* stagingRing)
+{
 	ImageInputChunk imageInput;
 	imageInput.logicalDevice = logicalDevice;
 	imageInput.physicalDevice = physicalDevice;
@@ -26,24 +36,23 @@ void vkimage::Texture::load(TextureInputChunk input)
 	imageInput.tiling = vk::ImageTiling::eOptimal;
 	imageInput.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
 	imageInput.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+	imageInput.queueFamilyIndices = queueFamilyIndices;
 	image = make_image(imageInput);
 	imageMemory = make_image_memory(imageInput, image);
 
-	populate();
+	stagingRing->uploadImage(reinterpret_cast<const void* const*>(&pixels), 1, image, width, height);
 
 	free(pixels);
 
 	makeView();
 
 	makeSampler();
-
-	makeDescriptorSet();
 }
 
 vkimage::Texture::~Texture()
 {
-	logicalDevice.freeMemory(imageMemory);
 	logicalDevice.destroyImage(image);
+	vkutil::MemoryAllocator::getAllocator()->free(imageMemory);
 	logicalDevice.destroyImageView(imageView);
 	logicalDevice.destroySampler(sampler);
 }
@@ -55,52 +64,6 @@ void vkimage::Texture::load()
 		vklogging::Logger::getLogger()->printList({ "Unable to load: ", filename });
 }
 
-void vkimage::Texture::populate()
-{
-	// First create a CPU-visible buffer...
-	BufferInputChunk input;
-	input.logicalDevice = logicalDevice;
-	input.physicalDevice = physicalDevice;
-	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible;
-	input.usage = vk::BufferUsageFlagBits::eTransferSrc;
-	input.size = width * height * 4;
-
-	Buffer stagingBuffer = vkutil::create_buffer(input);
-
-	// ...then fill it,
-	void* writeLocation = logicalDevice.mapMemory(stagingBuffer.bufferMemory, 0, input.size);
-	memcpy(writeLocation, pixels, input.size);
-	logicalDevice.unmapMemory(stagingBuffer.bufferMemory);
-
-	// then transfer it to image memory
-	ImageLayoutTransitionJob transitionJob;
-	transitionJob.commandBuffer = commandBuffer;
-	transitionJob.queue = queue;
-	transitionJob.image = image;
-	transitionJob.oldLayout = vk::ImageLayout::eUndefined;
-	transitionJob.newLayout = vk::ImageLayout::eTransferDstOptimal;
-	transitionJob.arrayCount = 1;
-	transition_image_layout(transitionJob);
-
-	BufferImageCopyJob copyJob;
-	copyJob.commandBuffer = commandBuffer;
-	copyJob.queue = queue;
-	copyJob.srcBuffer = stagingBuffer.buffer;
-	copyJob.dstImage = image;
-	copyJob.width = width;
-	copyJob.height = height;
-	copyJob.arrayCount = 1;
-	copy_buffer_to_image(copyJob);
-
-	transitionJob.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-	transitionJob.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-	transition_image_layout(transitionJob);
-
-	// Now the staging buffer can be destroyed
-	logicalDevice.freeMemory(stagingBuffer.bufferMemory);
-	logicalDevice.destroyBuffer(stagingBuffer.buffer);
-}
-
 void vkimage::Texture::makeView()
 {
 	imageView = make_image_view(
@@ -8,8 +8,20 @@ namespace vkimage {
 
 	public:
 
+		// Decode, upload and describe the texture in one go.
 		void load(TextureInputChunk input);
 
+		// Decode the image file. Only touches the CPU, so any number of textures can decode at once.
+		void decode(TextureInputChunk input);
+
+		// Create the image, stage the decoded pixels for it and make its view and sampler.
+		// The texture must be decoded before calling this function, and the ring finished before it is used.
+		void upload(vkutil::StagingRing* stagingRing);
+
+		// Allocate and write the descriptor set. Currently, this is only being done once.
+		// This must be called after the texture has been uploaded.
+		void makeDescriptorSet();
+
 		void use(vk::CommandBuffer commandBuffer, vk::PipelineLayout pipelineLayout);
 
 		~Texture();
@@ -24,7 +36,7 @@ namespace vkimage {
 
 		// Resources
 		vk::Image image;
-		vk::DeviceMemory imageMemory;
+		MemoryAllocation imageMemory;
 		vk::ImageView imageView;
 		vk::Sampler sampler;
 
@@ -33,24 +45,15 @@ namespace vkimage {
 		vk::DescriptorSet descriptorSet;
 		vk::DescriptorPool descriptorPool;
 
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
+		std::vector<uint32_t> queueFamilyIndices;
 
 		// Load the raw image data from the internally set filepath.
 		void load();
 
-		// Send loaded data to the image. The image must be loaded before calling
-		// this function.
-		void populate();
-
 		// Create a view of the texture. The image must be populated before calling this function.
 		void makeView();
 
 		// Configure and create a sampler for the texture.
 		void makeSampler();
-
-		// Allocate and write the descriptor set. Currently, this is only being done once.
-		// This must be called after the image view and sampler have been made.
-		void makeDescriptorSet();
 	};
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 #include "../../config.h"
 #include "../vkUtil/queue_families.h"
-#include "../vkUtil/frame.h"
+#include "../vkUtil/frame_context.h"
 
 namespace vkinit {
 
@@ -9,7 +9,7 @@ namespace vkinit {
 	struct commandBufferInputChunk {
 		vk::Device device; 
 		vk::CommandPool commandPool;
-		std::vector<vkutil::SwapChainFrame>& frames;
+		std::vector<vkutil::FrameContext>& frames;
 	};
 
 	// Make a command pool.
@@ -35,7 +35,7 @@ namespace vkinit {
 			return nullptr;
 		}
 	}
-	
+
 	// Make a main command buffer.
 	// \param inputChunk the required input info
 	// \returns the main command buffer
@@ -61,7 +61,7 @@ namespace vkinit {
 		}
 	}
 
-	// Make a command buffer for each frame
+	// Make a command buffer for each frame context
 	// \param inputChunk the required input info
 	void make_frame_command_buffers(commandBufferInputChunk inputChunk)
 	{
@@ -1,5 +1,6 @@
 #pragma once
 #include "../../config.h"
+#include <algorithm>
 #include "../vkUtil/queue_families.h"
 
 // Vulkan separates the concept of physical and logical devices. 
@@ -118,6 +119,10 @@ namespace vkinit {
 		uniqueIndices.push_back(indices.graphicsFamily.value());
 		if (indices.graphicsFamily.value() != indices.presentFamily.value())
 			uniqueIndices.push_back(indices.presentFamily.value());
+		// A family other than the graphics one may also be the one presenting, it is only listed once
+		if (indices.transferFamily.has_value()
+			&& std::find(uniqueIndices.begin(), uniqueIndices.end(), indices.transferFamily.value()) == uniqueIndices.end())
+			uniqueIndices.push_back(indices.transferFamily.value());
 
 		// VULKAN_HPP_CONSTEXPR DeviceQueueCreateInfo( VULKAN_HPP_NAMESPACE::DeviceQueueCreateFlags flags_            = {},
     //                                             uint32_t                                     queueFamilyIndex_ = {},
@@ -182,13 +187,15 @@ namespace vkinit {
 	// \param physicalDevice the physical device
 	// \param device the logical device
 	// \param surface the window surface
-	// \returns the queues
-	std::array<vk::Queue,2> get_queues(vk::PhysicalDevice physicalDevice, vk::Device device, vk::SurfaceKHR surface)
+	// \returns the graphics, present and transfer queues, the transfer queue is the graphics queue
+	// unless the device has a dedicated transfer family
+	std::array<vk::Queue,3> get_queues(vk::PhysicalDevice physicalDevice, vk::Device device, vk::SurfaceKHR surface)
 	{
 		vkutil::QueueFamilyIndices indices = vkutil::find_queue_families(physicalDevice, surface);
 		return { {
 				device.getQueue(indices.graphicsFamily.value(), 0),
 				device.getQueue(indices.presentFamily.value(), 0),
+				device.getQueue(indices.transferFamily.value_or(indices.graphicsFamily.value()), 0),
 			} };
 	}
 
@@ -1,4 +1,5 @@
 #include "pipeline.h"
+#include <algorithm>
 #include "../../control/logging.h"
 
 vkinit::PipelineBuilder::PipelineBuilder(vk::Device device)
@@ -24,6 +25,7 @@ void vkinit::PipelineBuilder::reset()
 	resetShaderModules();
 	resetRenderpassAttachments();
 	resetDescriptorSetLayouts();
+	variants.clear();
 }
 
 void vkinit::PipelineBuilder::resetVertexFormat()
@@ -57,6 +59,14 @@ void vkinit::PipelineBuilder::specifyVertexFormat (
 
 void vkinit::PipelineBuilder::setOverwriteMode(bool mode) {	overwrite = mode; }
 
+void vkinit::PipelineBuilder::setPipelineCache(vk::PipelineCache cache) { pipelineCache = cache; }
+
+void vkinit::PipelineBuilder::addVariant(const SpecializationValues& values)
+{
+	if (std::find(variants.begin(), variants.end(), values) == variants.end())
+		variants.push_back(values);
+}
+
 void vkinit::PipelineBuilder::resetShaderModules()
 {
 	if (vertexShader)
@@ -111,8 +121,6 @@ vk::PipelineShaderStageCreateInfo vkinit::PipelineBuilder::makeShaderInfo(
 	return shaderInfo;
 }
 
-void vkinit::PipelineBuilder::specifySwapchainExtent(vk::Extent2D screen_size) { swapchainExtent = screen_size; }
-
 void vkinit::PipelineBuilder::specifyDepthAttachment(
 	const vk::Format& depthFormat, uint32_t attachment_index
 ) {
@@ -214,6 +222,7 @@ vkinit::GraphicsPipelineOutBundle vkinit::PipelineBuilder::build()
 		// Viewport and Scissor
 		makeViewportState();
 		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pDynamicState = &dynamicState;
 
 		// Rasterizer
 		pipelineInfo.pRasterizationState = &rasterizer;
@@ -241,26 +250,68 @@ vkinit::GraphicsPipelineOutBundle vkinit::PipelineBuilder::build()
 		pipelineInfo.renderPass = renderpass;
 		pipelineInfo.subpass = 0;
 
+		GraphicsPipelineOutBundle output;
+		output.layout = pipelineLayout;
+		output.renderpass = renderpass;
+
 		// Make the Pipeline
-		vklogging::Logger::getLogger()->print("Create Graphics Pipeline");
-		vk::Pipeline graphicsPipeline;
-		try
+		if (variants.empty())
 		{
-			graphicsPipeline = (device.createGraphicsPipeline(nullptr, pipelineInfo)).value;
+			output.pipeline = makePipeline();
+			return output;
 		}
-		catch (vk::SystemError err)
+
+		// Make every variant, the driver compiles each with its constants folded in
+		std::vector<vk::SpecializationMapEntry> entries;
+		vk::SpecializationInfo specializationInfo = {};
+		for (vk::PipelineShaderStageCreateInfo& stage : shaderStages)
+			if (stage.stage == vk::ShaderStageFlagBits::eFragment)
+				stage.pSpecializationInfo = &specializationInfo;
+
+		for (const SpecializationValues& values : variants)
 		{
-			vklogging::Logger::getLogger()->print("Failed to create Pipeline");
+			entries.resize(values.size());
+			for (uint32_t i = 0; i < values.size(); i++)
+				entries[i] = vk::SpecializationMapEntry(i, i * sizeof(uint32_t), sizeof(uint32_t));
+			specializationInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+			specializationInfo.pMapEntries = entries.data();
+			specializationInfo.dataSize = values.size() * sizeof(uint32_t);
+			specializationInfo.pData = values.data();
+
+			vk::Pipeline variant = makePipeline();
+			if (variant)
+				output.variants[values] = variant;
+			if (values == variants.front())
+				output.pipeline = variant;
 		}
 
-		GraphicsPipelineOutBundle output;
-		output.layout = pipelineLayout;
-		output.renderpass = renderpass;
-		output.pipeline = graphicsPipeline;
+		for (vk::PipelineShaderStageCreateInfo& stage : shaderStages)
+			stage.pSpecializationInfo = nullptr;
 
 		return output;
 	}
 
+vk::Pipeline vkinit::PipelineBuilder::makePipeline()
+{
+	vklogging::Logger::getLogger()->print("Create Graphics Pipeline");
+	// A shader whose SPIR-V couldn't be loaded fails the build instead of reaching the driver
+	for (const vk::PipelineShaderStageCreateInfo& stage : shaderStages)
+		if (!stage.module)
+		{
+			vklogging::Logger::getLogger()->print("Failed to create Pipeline, a shader module is missing");
+			return nullptr;
+		}
+	try
+	{
+		return (device.createGraphicsPipeline(pipelineCache, pipelineInfo)).value;
+	}
+	catch (vk::SystemError err)
+	{
+		vklogging::Logger::getLogger()->print("Failed to create Pipeline");
+	}
+	return nullptr;
+}
+
 void vkinit::PipelineBuilder::configureInputAssembly()
 {
 	inputAssemblyInfo.flags = vk::PipelineInputAssemblyStateCreateFlags();
@@ -269,22 +320,16 @@ void vkinit::PipelineBuilder::configureInputAssembly()
 
 vk::PipelineViewportStateCreateInfo vkinit::PipelineBuilder::makeViewportState()
 {
-	viewport.x = 0.f;
-	viewport.y = 0.f;
-	viewport.width = (float)swapchainExtent.width;
-	viewport.height = (float)swapchainExtent.height;
-	viewport.minDepth = 0.f;
-	viewport.maxDepth = 1.f;
-
-	scissor.offset.x = 0;
-	scissor.offset.y = 0;
-	scissor.extent = swapchainExtent;
-
 	viewportState.flags = vk::PipelineViewportStateCreateFlags();
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
+
+	dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+	dynamicState.flags = vk::PipelineDynamicStateCreateFlags();
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
 
 	return viewportState;
 }
@@ -2,15 +2,25 @@
 #include "../../config.h"
 #include "../vkUtil/shaders.h"
 #include "../vkUtil/render_structs.h"
+#include <map>
 
 namespace vkinit {
 
+	// Values of the specialization constants of the fragment shader, constant_id i takes values[i].
+	// Every constant is 4 bytes, floats are given by their bits.
+	using SpecializationValues = std::vector<uint32_t>;
+
+	// Pipelines which only differ in the specialization constants of their fragment shader
+	using PipelineVariants = std::map<SpecializationValues, vk::Pipeline>;
+
 	// Used for returning the pipeline, along with associated data structures,
 	// after creation.
 	struct GraphicsPipelineOutBundle {
 		vk::PipelineLayout layout;
 		vk::RenderPass renderpass;
 		vk::Pipeline pipeline;
+		// Every variant which was built, pipeline is the first one added. Empty if none were added.
+		PipelineVariants variants;
 	};
 
 	class PipelineBuilder {
@@ -34,8 +44,6 @@ namespace vkinit {
 
 		void specifyFragmentShader(const char* filename);
 
-		void specifySwapchainExtent(vk::Extent2D screen_size);
-
 		void specifyDepthAttachment(const vk::Format& depthFormat, uint32_t attachment_index);
 
 		void clearDepthAttachment();
@@ -44,6 +52,15 @@ namespace vkinit {
 
 		void setOverwriteMode(bool mode);
 
+		// Create pipelines through a cache, it is kept across resets.
+		// \param cache the pipeline cache, or nullptr for none
+		void setPipelineCache(vk::PipelineCache cache);
+
+		// Build a variant of the pipeline with its fragment shader specialized, instead of a single pipeline.
+		// The variants share the layout and renderpass, a combination added twice is built once.
+		// \param values the values of the specialization constants
+		void addVariant(const SpecializationValues& values);
+
 		// Make a graphics pipeline, along with renderpass and pipeline layout
 		// \param specification the struct holding input data, as specified at the top of the file.
 		// \returns the bundle of data structures created
@@ -66,10 +83,9 @@ namespace vkinit {
 		vk::ShaderModule vertexShader = nullptr, fragmentShader = nullptr;
 		vk::PipelineShaderStageCreateInfo vertexShaderInfo, fragmentShaderInfo;
 
-		vk::Extent2D swapchainExtent;
-		vk::Viewport viewport = {};
-		vk::Rect2D scissor = {};
 		vk::PipelineViewportStateCreateInfo viewportState = {};
+		std::vector<vk::DynamicState> dynamicStates;
+		vk::PipelineDynamicStateCreateInfo dynamicState = {};
 
 		vk::PipelineRasterizationStateCreateInfo rasterizer = {};
 
@@ -86,11 +102,16 @@ namespace vkinit {
 
 		std::vector<vk::DescriptorSetLayout> descriptorSetLayouts;
 		bool overwrite;
+		vk::PipelineCache pipelineCache = nullptr;
+		std::vector<SpecializationValues> variants;
 
 		void resetVertexFormat();
 
 		void resetShaderModules();
 
+		// \returns a pipeline made with the current state, or nullptr if that failed
+		vk::Pipeline makePipeline();
+
 		void resetRenderpassAttachments();
 
 		// Make an attachment description.
@@ -115,9 +136,8 @@ namespace vkinit {
 		vk::PipelineShaderStageCreateInfo makeShaderInfo(
 			const vk::ShaderModule& shaderModule, const vk::ShaderStageFlagBits& stage);
 		
-		// Configure the pipeline's viewport stage.
-		// \param viewport the viewport specification
-		// \param scissor the scissor rectangle to apply
+		// Configure the pipeline's viewport stage. The viewport and scissor are dynamic and set when drawing,
+		// so that the pipeline doesn't depend on the size of the swapchain.
 		// \returns the viewport state creation info
 		vk::PipelineViewportStateCreateInfo makeViewportState();
 
@@ -1,86 +1,217 @@
 #include "job.h"
+#include "../../control/logging.h"
+
+void vkjob::Job::then(Job* continuation)
+{
+	continuations.emplace_back(continuation, continuation->dependencyPaths.size());
+	continuation->dependencyPaths.emplace_back();
+	continuation->pendingDependencies.fetch_add(1, std::memory_order_relaxed);
+}
 
 vkjob::MakeModel::MakeModel(vkmesh::ObjMesh& mesh, const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform)
 	: mesh(mesh)
 	, objFilepath(objFilepath)
 	, mtlFilepath(mtlFilepath)
 	, preTransform(preTransform)
-{}
+{
+	name = std::string("parse ") + objFilepath;
+}
+
+void vkjob::MakeModel::execute()
+{
+	// A broken mesh is left empty and drawn as nothing, the other models still load.
+	// One thread per file, the other workers parse the other files.
+	if (!mesh.load(objFilepath, mtlFilepath, preTransform, 1))
+		vklogging::Logger::getLogger()->print("Failed to load " + mesh.error);
+}
+
+vkjob::BakeModels::BakeModels(std::vector<MeshBakeInput> meshes, const BakeSettings& settings)
+	: meshes(std::move(meshes))
+	, settings(settings)
+{
+	name = "bake " + std::to_string(this->meshes.size()) + " meshes";
+}
+
+void vkjob::BakeModels::execute()
+{
+	bake_sh_terms(meshes, settings);
+}
+
+vkjob::UploadMeshes::UploadMeshes(VertexMenagerie* meshes, std::vector<std::pair<meshTypes, vkmesh::ObjMesh*>> models,
+	vertexBufferFinalizationChunk finalizationInfo)
+	: meshes(meshes)
+	, models(std::move(models))
+	, finalizationInfo(finalizationInfo)
+{
+	name = "upload meshes";
+}
 
-void vkjob::MakeModel::execute(vk::CommandBuffer commandBuffer, vk::Queue queue)
+void vkjob::UploadMeshes::execute()
 {
-	mesh.load(objFilepath, mtlFilepath, preTransform);
-	status = JobStatus::COMPLETE;
+	for (auto& [type, model] : models)
+		meshes->consume(type, model->vertices, model->indices);
+
+	meshes->finalize(finalizationInfo);
 }
 
 vkjob::MakeTexture::MakeTexture(vkimage::Texture* texture, vkimage::TextureInputChunk textureInfo)
 	: texture(texture)
 	, textureInfo(textureInfo)
-{}
+{
+	name = std::string("decode ") + textureInfo.filenames[0];
+}
+
+void vkjob::MakeTexture::execute()
+{
+	texture->decode(textureInfo);
+}
+
+vkjob::UploadTexture::UploadTexture(vkimage::Texture* texture, vkimage::TextureInputChunk textureInfo)
+	: texture(texture)
+	, textureInfo(textureInfo)
+{
+	name = std::string("upload ") + textureInfo.filenames[0];
+}
+
+void vkjob::UploadTexture::execute()
+{
+	texture->upload(textureInfo.stagingRing);
+}
+
+vkjob::WriteTextureDescriptor::WriteTextureDescriptor(vkimage::Texture* texture, const char* filename)
+	: texture(texture)
+{
+	name = std::string("describe ") + filename;
+}
+
+void vkjob::WriteTextureDescriptor::execute()
+{
+	texture->makeDescriptorSet();
+}
+
+vkjob::BuildPipeline::BuildPipeline(std::unique_ptr<vkinit::PipelineBuilder> builder, vk::PipelineLayout& layout,
+	vk::RenderPass& renderpass, vk::Pipeline& pipeline, vkinit::PipelineVariants& variants, const char* name)
+	: builder(std::move(builder))
+	, layout(layout)
+	, renderpass(renderpass)
+	, pipeline(pipeline)
+	, variants(variants)
+{
+	this->name = std::string("build pipeline ") + name;
+}
+
+void vkjob::BuildPipeline::execute()
+{
+	vkinit::GraphicsPipelineOutBundle output = builder->build();
+	layout = output.layout;
+	renderpass = output.renderpass;
+	pipeline = output.pipeline;
+	variants = std::move(output.variants);
 
-void vkjob::MakeTexture::execute(vk::CommandBuffer commandBuffer, vk::Queue queue)
+	// The shader modules are only needed while creating the pipeline
+	builder.reset();
+}
+
+vkjob::SavePipelineCache::SavePipelineCache(vkutil::PipelineCache* cache, size_t pipelineCount)
+	: cache(cache)
+	, pipelineCount(pipelineCount)
+	, buildStart(std::chrono::steady_clock::now())
 {
-	textureInfo.commandBuffer = commandBuffer;
-	textureInfo.queue = queue;
-	texture->load(textureInfo);
-	status = JobStatus::COMPLETE;
+	name = "save pipeline cache";
 }
 
+void vkjob::SavePipelineCache::execute()
+{
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+	vklogging::Logger::getLogger()->print("Built " + std::to_string(pipelineCount) + " pipelines in "
+		+ std::to_string(buildTime) + " ms with a " + (cache->isWarm() ? "warm" : "cold") + " pipeline cache");
+
+	if (!cache->save())
+		vklogging::Logger::getLogger()->print("Failed to save the pipeline cache");
+}
+
+vkjob::WorkQueue::WorkQueue(size_t capacity)
+	: jobs(capacity)
+{}
+
 void vkjob::WorkQueue::add(Job* job)
 {
-	if (length == 0)
-	{
-		first = job;
-		last = job;
-	}
-	else {
-		last->next = job;
-		last = job;
-	}
+	push(job);
+}
 
-	length += 1;
+void vkjob::WorkQueue::push(Job* job)
+{
+	outstanding.fetch_add(1, std::memory_order_relaxed);
+	while (!jobs.tryPush(job))
+		std::this_thread::yield();
+	available.release();
 }
 
-vkjob::Job* vkjob::WorkQueue::getNext()
+vkjob::Job* vkjob::WorkQueue::waitForJob()
 {
-	Job* current = first;
-	while (current)
-	{
-		if (current->status == JobStatus::PENDING)
-			return current;
-		current = current->next;
-	}
+	available.acquire();
+	if (stopping.load(std::memory_order_acquire))
+		return nullptr;
 
-	return nullptr;
+	// Every release follows a completed push, so a job is there, though another pop may still be finishing
+	Job* job;
+	while (!jobs.tryPop(job))
+		std::this_thread::yield();
+	job->started = std::chrono::steady_clock::now();
+	return job;
 }
 
-bool vkjob::WorkQueue::done()
+void vkjob::WorkQueue::finish(Job* job)
 {
-	Job* current = first;
-	while (current)
+	double duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job->started).count();
+
+	// The longest chain ending at this job runs through its longest dependency
+	Job::PathSegment path;
+	for (Job::PathSegment& dependencyPath : job->dependencyPaths)
+		if (dependencyPath.milliseconds >= path.milliseconds)
+			path = std::move(dependencyPath);
+	path.milliseconds += duration;
+	path.jobs += path.jobs.empty() ? job->name : " -> " + job->name;
+
+	// Ready continuations are counted as outstanding before this job is uncounted, so waitUntilDone can't return in between
+	for (auto& [continuation, slot] : job->continuations)
+	{
+		continuation->dependencyPaths[slot] = path;
+		if (continuation->pendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			push(continuation);
+	}
+
 	{
-		if (current->status != JobStatus::COMPLETE)
-			return false;
-		current = current->next;
+		std::lock_guard<std::mutex> lock(reportLock);
+		report.jobCount++;
+		report.busyMilliseconds += duration;
+		if (path.milliseconds > report.criticalPathMilliseconds)
+		{
+			report.criticalPathMilliseconds = path.milliseconds;
+			report.criticalPath = std::move(path.jobs);
+		}
 	}
 
-	return true;
+	delete job;
+	if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		outstanding.notify_all();
 }
 
-void vkjob::WorkQueue::clear()
+void vkjob::WorkQueue::waitUntilDone()
 {
-	if (length == 0)
-		return;
+	size_t remaining;
+	while ((remaining = outstanding.load(std::memory_order_acquire)) != 0)
+		outstanding.wait(remaining, std::memory_order_acquire);
+}
 
-	Job* current = first;
-	while (current)
-	{
-		Job* previous = current;
-		current = current->next;
-		delete previous;
-	}
+vkjob::JobGraphReport vkjob::WorkQueue::takeReport()
+{
+	std::lock_guard<std::mutex> lock(reportLock);
+	return std::exchange(report, JobGraphReport());
+}
 
-	first = nullptr;
-	last = nullptr;
-	length = 0;
-}
\ No newline at end of file
+void vkjob::WorkQueue::stop(size_t workerCount)
+{
+	stopping.store(true, std::memory_order_release);
+	available.release(static_cast<std::ptrdiff_t>(workerCount));
+}
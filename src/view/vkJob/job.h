@@ -1,22 +1,53 @@
 #pragma once
 #include "../../config.h"
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <semaphore>
+#include "mpmc_queue.h"
 #include "../vkMesh/obj_mesh.h"
 #include "../vkImage/image.h"
 #include "../vkImage/texture.h"
+#include "../../model/vertex_menagerie.h"
+#include "../vkInit/pipeline.h"
+#include "../vkUtil/pipeline_cache.h"
+#include "../../preprocessing/bake.h"
 
 namespace vkjob {
 
-	enum class JobStatus {
-		PENDING,
-		IN_PROGRESS,
-		COMPLETE
-	};
+	class WorkQueue;
 
+	// A unit of work for the worker threads. Jobs form a graph: a continuation is queued
+	// by the job which finishes its last dependency, so only jobs without dependencies are added directly.
 	class Job {
 	public:
-		JobStatus status = JobStatus::PENDING;
-		Job* next = nullptr;
-		virtual void execute(vk::CommandBuffer commandBuffer, vk::Queue queue) = 0;
+		virtual ~Job() = default;
+		virtual void execute() = 0;
+
+		// Run a job once this one and all its other dependencies have finished. The whole graph
+		// has to be linked before any of its jobs is added, and continuations must not be added themselves.
+		// \param continuation the dependent job, the queue takes ownership of it along with this job
+		void then(Job* continuation);
+
+		// Shown in the startup report
+		std::string name;
+
+	private:
+		friend class WorkQueue;
+
+		// Longest chain of job durations ending at a finished dependency
+		struct PathSegment {
+			double milliseconds = 0.0;
+			std::string jobs;
+		};
+
+		std::atomic<uint32_t> pendingDependencies = 0;
+		// Each continuation with the slot of its dependencyPaths this job fills in
+		std::vector<std::pair<Job*, size_t>> continuations;
+		// One slot per dependency, each written only by its own dependency before the count drops
+		std::vector<PathSegment> dependencyPaths;
+		std::chrono::steady_clock::time_point started;
 	};
 
 	class MakeModel: public Job {
@@ -26,25 +57,130 @@ namespace vkjob {
 		glm::mat4 preTransform;
 		vkmesh::ObjMesh& mesh;
 		MakeModel(vkmesh::ObjMesh& mesh, const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform);
-		virtual void execute(vk::CommandBuffer commandBuffer, vk::Queue queue) final;
+		virtual void execute() final;
 	};
 
+	// Bake the SH coefficients of all parsed models at once. The bake runs its own pool of threads
+	// over the vertices of every mesh, one job per mesh would start a pool per mesh next to the workers.
+	class BakeModels : public Job {
+	public:
+		std::vector<MeshBakeInput> meshes;
+		const BakeSettings& settings;
+		BakeModels(std::vector<MeshBakeInput> meshes, const BakeSettings& settings);
+		virtual void execute() final;
+	};
+
+	// Hand the baked models to the vertex menagerie and stage everything it holds.
+	class UploadMeshes : public Job {
+	public:
+		VertexMenagerie* meshes;
+		std::vector<std::pair<meshTypes, vkmesh::ObjMesh*>> models;
+		vertexBufferFinalizationChunk finalizationInfo;
+		UploadMeshes(VertexMenagerie* meshes, std::vector<std::pair<meshTypes, vkmesh::ObjMesh*>> models,
+			vertexBufferFinalizationChunk finalizationInfo);
+		virtual void execute() final;
+	};
+
+	// Decode a texture file on the CPU.
 	class MakeTexture : public Job {
 	public:
 		vkimage::TextureInputChunk textureInfo;
 		vkimage::Texture* texture;
 		MakeTexture(vkimage::Texture* texture, vkimage::TextureInputChunk textureInfo);
-		virtual void execute(vk::CommandBuffer commandBuffer, vk::Queue queue) final;
+		virtual void execute() final;
+	};
+
+	// Stage a decoded texture and make its view and sampler.
+	class UploadTexture : public Job {
+	public:
+		vkimage::TextureInputChunk textureInfo;
+		vkimage::Texture* texture;
+		UploadTexture(vkimage::Texture* texture, vkimage::TextureInputChunk textureInfo);
+		virtual void execute() final;
+	};
+
+	// Write the descriptor set of an uploaded texture.
+	class WriteTextureDescriptor : public Job {
+	public:
+		vkimage::Texture* texture;
+		WriteTextureDescriptor(vkimage::Texture* texture, const char* filename);
+		virtual void execute() final;
+	};
+
+	// Build a configured pipeline and its variants, along with its layout and renderpass.
+	class BuildPipeline : public Job {
+	public:
+		std::unique_ptr<vkinit::PipelineBuilder> builder;
+		// Receive the results, nothing else may touch them until the job has finished
+		vk::PipelineLayout& layout;
+		vk::RenderPass& renderpass;
+		vk::Pipeline& pipeline;
+		vkinit::PipelineVariants& variants;
+		BuildPipeline(std::unique_ptr<vkinit::PipelineBuilder> builder, vk::PipelineLayout& layout,
+			vk::RenderPass& renderpass, vk::Pipeline& pipeline, vkinit::PipelineVariants& variants, const char* name);
+		virtual void execute() final;
+	};
+
+	// Report how long the pipelines it continues took to build, then write the pipeline cache to disk.
+	class SavePipelineCache : public Job {
+	public:
+		vkutil::PipelineCache* cache;
+		size_t pipelineCount;
+		std::chrono::steady_clock::time_point buildStart;
+		SavePipelineCache(vkutil::PipelineCache* cache, size_t pipelineCount);
+		virtual void execute() final;
+	};
+
+	// Timing of the jobs finished since the last report
+	struct JobGraphReport {
+		size_t jobCount = 0;
+		// Sum of the time spent executing jobs
+		double busyMilliseconds = 0.0;
+		// Longest chain of dependent jobs, the lower bound of the wall time with any number of workers
+		double criticalPathMilliseconds = 0.0;
+		std::string criticalPath;
 	};
 
+	// Jobs waiting for the worker threads. Workers sleep on a semaphore until a job is added,
+	// and whoever waits for the work to finish sleeps until the count of outstanding jobs drops to zero.
+	// Nothing is polled and no lock is taken on the way from add to execute.
 	class WorkQueue {
 	public:
-		Job* first = nullptr, * last = nullptr;
-		size_t length = 0;
-		std::mutex lock;
+		// \param capacity maximum number of jobs queued at once, add waits for room beyond that
+		WorkQueue(size_t capacity = 1024);
+
+		// Queue a job without dependencies and wake a worker. The queue takes ownership,
+		// the job is deleted once executed and its continuations are queued as they become ready.
 		void add(Job* job);
-		Job* getNext();
-		bool done();
-		void clear();
+
+		// Block until a job is available.
+		// \returns the job, or nullptr once stop was called
+		Job* waitForJob();
+
+		// Report that a job returned by waitForJob was executed, queueing the continuations
+		// it was the last dependency of.
+		void finish(Job* job);
+
+		// Block until every added job and all of their continuations have finished.
+		void waitUntilDone();
+
+		// \returns the timing of the jobs finished since the previous call
+		JobGraphReport takeReport();
+
+		// Make every worker blocked in waitForJob return. Jobs still queued are not executed.
+		// \param workerCount number of threads waiting on the queue
+		void stop(size_t workerCount);
+
+	private:
+		void push(Job* job);
+
+		MPMCQueue<Job*> jobs;
+		std::counting_semaphore<> available{ 0 };
+		std::atomic<size_t> outstanding = 0;
+		std::atomic<bool> stopping = false;
+
+		// Only taken once per finished job, never on the way from add to execute
+		std::mutex reportLock;
+		JobGraphReport report;
 	};
 }
\ No newline at end of file
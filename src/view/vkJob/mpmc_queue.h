@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+namespace vkjob {
+
+	// Bounded lock-free multi-producer multi-consumer queue.
+	// Every cell carries a sequence number telling producers and consumers whose turn it is,
+	// so a push or pop is a single compare-and-swap on the shared position plus a release store.
+	template <typename T>
+	class MPMCQueue {
+	public:
+		// \param capacity maximum number of queued elements, rounded up to a power of two
+		explicit MPMCQueue(size_t capacity)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size *= 2;
+
+			cells = std::make_unique<Cell[]>(size);
+			mask = size - 1;
+			for (size_t i = 0; i < size; i++)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		MPMCQueue(const MPMCQueue&) = delete;
+		MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+		// \returns false if the queue is full
+		bool tryPush(const T& value)
+		{
+			size_t position = enqueuePosition.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = cells[position & mask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+				if (difference == 0)
+				{
+					if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						cell.value = value;
+						cell.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+					return false;
+				else
+					position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		// \returns false if the queue is empty
+		bool tryPop(T& value)
+		{
+			size_t position = dequeuePosition.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = cells[position & mask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+				if (difference == 0)
+				{
+					if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						value = cell.value;
+						cell.sequence.store(position + mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+					return false;
+				else
+					position = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<Cell[]> cells;
+		size_t mask;
+
+		// On separate cache lines, producers and consumers don't slow each other down
+		alignas(64) std::atomic<size_t> enqueuePosition = 0;
+		alignas(64) std::atomic<size_t> dequeuePosition = 0;
+	};
+}
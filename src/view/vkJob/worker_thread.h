@@ -4,13 +4,11 @@
 namespace vkjob {
 	class WorkerThread {
 	public:
-		bool& done;
 		WorkQueue& workQueue;
-		vk::CommandBuffer commandBuffer;
-		vk::Queue queue;
 
-		WorkerThread(WorkQueue& workQueue, bool& done, vk::CommandBuffer commandBuffer, vk::Queue queue);
+		WorkerThread(WorkQueue& workQueue);
 
+		// Execute jobs as they arrive until the queue is stopped.
 		void operator()();
 	};
 }
\ No newline at end of file
@@ -35,7 +35,7 @@ namespace vkmesh {
 
 		std::vector<vk::VertexInputAttributeDescription> attributes;
 		vk::VertexInputAttributeDescription dummy;
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < 4 + SH_COEFFS_NUM; i++)
 			attributes.push_back(dummy);
 
 		// Pos
@@ -62,71 +62,15 @@ namespace vkmesh {
 		attributes[3].format = vk::Format::eR32G32B32Sfloat;
 		attributes[3].offset = 8 * sizeof(float);
 
-		// Spherical harmonics expansion coefficients
-
-		// Width
-		attributes[4].binding = 0;
-		attributes[4].location = 4;
-		attributes[4].format = vk::Format::eR32G32B32Sfloat;
-		attributes[4].offset = 11 * sizeof(float);
-
-		attributes[5].binding = 0;
-		attributes[5].location = 5;
-		attributes[5].format = vk::Format::eR32G32B32Sfloat;
-		attributes[5].offset = 14 * sizeof(float);
-
-		attributes[6].binding = 0;
-		attributes[6].location = 6;
-		attributes[6].format = vk::Format::eR32G32B32Sfloat;
-		attributes[6].offset = 17 * sizeof(float);
-
-		// X-coordinate of a refracted vector
-		attributes[7].binding = 0;
-		attributes[7].location = 7;
-		attributes[7].format = vk::Format::eR32G32B32Sfloat;
-		attributes[7].offset = 20 * sizeof(float);
-
-		attributes[8].binding = 0;
-		attributes[8].location = 8;
-		attributes[8].format = vk::Format::eR32G32B32Sfloat;
-		attributes[8].offset = 23 * sizeof(float);
-
-		attributes[9].binding = 0;
-		attributes[9].location = 9;
-		attributes[9].format = vk::Format::eR32G32B32Sfloat;
-		attributes[9].offset = 26 * sizeof(float);
-
-		// Y-coordinate of a refracted vector
-		attributes[10].binding = 0;
-		attributes[10].location = 10;
-		attributes[10].format = vk::Format::eR32G32B32Sfloat;
-		attributes[10].offset = 29 * sizeof(float);
-
-		attributes[11].binding = 0;
-		attributes[11].location = 11;
-		attributes[11].format = vk::Format::eR32G32B32Sfloat;
-		attributes[11].offset = 32 * sizeof(float);
-
-		attributes[12].binding = 0;
-		attributes[12].location = 12;
-		attributes[12].format = vk::Format::eR32G32B32Sfloat;
-		attributes[12].offset = 35 * sizeof(float);
-
-		// Z-coordinate of a refracted vector
-		attributes[13].binding = 0;
-		attributes[13].location = 13;
-		attributes[13].format = vk::Format::eR32G32B32Sfloat;
-		attributes[13].offset = 38 * sizeof(float);
-
-		attributes[14].binding = 0;
-		attributes[14].location = 14;
-		attributes[14].format = vk::Format::eR32G32B32Sfloat;
-		attributes[14].offset = 41 * sizeof(float);
-
-		attributes[15].binding = 0;
-		attributes[15].location = 15;
-		attributes[15].format = vk::Format::eR32G32B32Sfloat;
-		attributes[15].offset = 44 * sizeof(float);
+		// Spherical harmonics expansion coefficients,
+		// every one holds the width and the x, y and z-coordinates of a refracted vector
+		for (int i = 0; i < SH_COEFFS_NUM; i++)
+		{
+			attributes[4 + i].binding = 0;
+			attributes[4 + i].location = 4 + i;
+			attributes[4 + i].format = vk::Format::eR32G32B32A32Sfloat;
+			attributes[4 + i].offset = (SH_COEFFS_OFFSET + 4 * i) * sizeof(float);
+		}
 
 		return attributes;
 	}
@@ -1,196 +1,399 @@
 #include "obj_mesh.h"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include "../../preprocessing/mapped_file.h"
+#include "../../preprocessing/thread_pool.h"
 
-static std::vector<std::string> split(std::string line, std::string delimiter)
+// The tokenizer works on views into the mapped file, nothing is copied.
+
+static bool is_blank(char character)
 {
-	std::vector<std::string> split_line;
+	return character == ' ' || character == '\t' || character == '\r';
+}
 
-	size_t pos = 0;
-	std::string token;
-	while ((pos = line.find(delimiter)) != std::string::npos)
-	{
-		token = line.substr(0, pos);
-		split_line.push_back(token);
-		line.erase(0, pos + delimiter.length());
-	}
-	if (!line.empty())
-		split_line.push_back(line);
+// \returns the next line of text without its line break, text is advanced past it
+static std::string_view next_line(std::string_view& text)
+{
+	size_t end = text.find('\n');
+	std::string_view line = text.substr(0, end);
+	text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+	return line;
+}
 
-	return split_line;
+// \returns the next whitespace separated word of a line, line is advanced past it
+static std::string_view next_word(std::string_view& line)
+{
+	size_t begin = 0;
+	while (begin < line.size() && is_blank(line[begin]))
+		begin++;
+	size_t end = begin;
+	while (end < line.size() && !is_blank(line[end]))
+		end++;
+
+	std::string_view word = line.substr(begin, end - begin);
+	line.remove_prefix(end);
+	return word;
 }
 
-void vkmesh::ObjMesh::load(const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform)
+// \returns the next word of a line as a float, 0 if it isn't one
+static float next_float(std::string_view& line)
 {
-	this->preTransform = preTransform;
+	std::string_view word = next_word(line);
+	if (!word.empty() && word.front() == '+')
+		word.remove_prefix(1);
+
+	float value = 0.f;
+	std::from_chars(word.data(), word.data() + word.size(), value);
+	return value;
+}
 
-	std::ifstream file;
-	file.open(mtlFilepath);
-	std::string line;
-	std::string materialName;
-	std::vector<std::string> words;
+// Read the index at the start of text, advancing text past the next slash.
+// \param index the index as written, negative ones count back from the last attribute, 0 if the field is empty
+// \returns false if the field is neither empty nor an integer
+static bool next_index(std::string_view& text, int32_t& index)
+{
+	size_t slash = text.find('/');
+	std::string_view field = text.substr(0, slash);
+	text.remove_prefix(slash == std::string_view::npos ? text.size() : slash + 1);
+
+	index = 0;
+	if (field.empty())
+		return true;
+	auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), index);
+	return error == std::errc() && end == field.data() + field.size();
+}
 
-	while (std::getline(file, line))
-	{
-		if (line.empty())
-			continue;
+// Read the corner of a face described as v, v/vt, v//vn or v/vt/vn
+// \returns false if one of the indices is malformed
+static bool parse_corner(std::string_view description, vkmesh::ObjCorner& corner)
+{
+	return next_index(description, corner.v) && next_index(description, corner.vt) && next_index(description, corner.vn);
+}
 
-		words = split(line, " ");
+void vkmesh::CornerTable::reserve(size_t count)
+{
+	// At most half of the slots are used, which keeps the probe sequences short
+	size_t capacity = 16;
+	while (capacity < 2 * count)
+		capacity *= 2;
+	if (capacity <= slots.size())
+		return;
 
-		if (!words[0].compare("newmtl"))
-			materialName = words[1];
+	std::vector<Slot> previous(capacity, Slot{ { 0, 0, 0 }, EMPTY });
+	previous.swap(slots);
+	this->count = 0;
+	for (const Slot& slot : previous)
+		if (slot.vertexNo != EMPTY)
+			insert(slot.corner, slot.vertexNo);
+}
 
-		if (!words[0].compare("Kd"))
+std::pair<uint32_t, bool> vkmesh::CornerTable::insert(const ObjCorner& corner, uint32_t vertexNo)
+{
+	if (2 * (count + 1) > slots.size())
+		reserve(2 * (count + 1));
+
+	// Fibonacci hashing of the packed triple, the top bits are the best mixed
+	uint64_t key = (uint64_t(corner.v) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(corner.vt) * 0xC2B2AE3D27D4EB4Full)
+		^ (uint64_t(corner.vn) * 0x165667B19E3779F9ull);
+	size_t mask = slots.size() - 1;
+	for (size_t slotNo = (key ^ (key >> 32)) & mask;; slotNo = (slotNo + 1) & mask)
+	{
+		Slot& slot = slots[slotNo];
+		if (slot.vertexNo == EMPTY)
 		{
-			brushColor = glm::vec3(std::stof(words[1]), std::stof(words[2]), std::stof(words[3]));
-			colorLookup.insert({ materialName,brushColor });
+			slot = { corner, vertexNo };
+			count++;
+			return { vertexNo, true };
 		}
+		if (slot.corner == corner)
+			return { slot.vertexNo, false };
 	}
+}
 
-	file.close();
-
-	size_t vertex_count = 0;
-	size_t texcoord_count = 0;
-	size_t normal_count = 0;
-	size_t corner_count = 0;
-
-	file.open(objFilepath);
-
-	while (std::getline(file, line))
-	{
-		if (line.empty())
-			continue;
-
-		words = split(line, " ");
+void vkmesh::CornerTable::release()
+{
+	std::vector<Slot>().swap(slots);
+	count = 0;
+}
 
-		if (!words[0].compare("v"))
-			vertex_count += 1;
+// Records of a newline-aligned piece of an OBJ file, parsed independently of the other pieces
+struct ObjChunk {
+	std::vector<glm::vec3> v, vn;
+	std::vector<glm::vec2> vt;
+	std::vector<vkmesh::ObjCorner> corners; // three per triangle
+	std::vector<std::pair<size_t, std::string_view>> materials; // the first corner a usemtl applies to and its name
+	// Corners with relative indices, which are numbered from the start of the chunk until the chunks are joined,
+	// and a mask of those indices: 1 for v, 2 for vt, 4 for vn
+	std::vector<std::pair<size_t, uint32_t>> relativeCorners;
+	bool malformed = false;
+};
+
+// Chunks smaller than this aren't worth a thread
+static constexpr size_t OBJ_CHUNK_MIN_BYTES = 1 << 20;
+
+static glm::vec3 read_vec3(std::string_view arguments, float w, const glm::mat4& preTransform)
+{
+	float x = next_float(arguments);
+	float y = next_float(arguments);
+	float z = next_float(arguments);
+	return glm::vec3(preTransform * glm::vec4(x, y, z, w));
+}
 
-		else if (!words[0].compare("vt"))
-			texcoord_count += 1;
+// Turn a negative index into a one-based index from the start of the chunk, which may be 0 or below
+// when it refers to an earlier chunk.
+// \returns whether the index was relative
+static bool number_from_chunk(int32_t& index, size_t count)
+{
+	if (index >= 0)
+		return false;
+	index = static_cast<int32_t>(std::clamp<int64_t>(int64_t(index) + int64_t(count) + 1, -INT32_MAX, INT32_MAX));
+	return true;
+}
 
-		else if (!words[0].compare("vn"))
-			normal_count += 1;
+// \returns the one-based index of an attribute numbered from the start of a chunk, -1 if it is before the file
+static int32_t number_from_file(int32_t index, size_t base)
+{
+	int64_t number = int64_t(index) + int64_t(base);
+	return number >= 1 && number <= INT32_MAX ? static_cast<int32_t>(number) : -1;
+}
 
-		else if (!words[0].compare("f"))
+static void parse_chunk(std::string_view text, const glm::mat4& preTransform, ObjChunk& chunk)
+{
+	// \returns the corner, its relative indices numbered from the start of the chunk, and their mask
+	auto parse = [&](std::string_view description)
+	{
+		vkmesh::ObjCorner corner;
+		if (!parse_corner(description, corner))
 		{
-			size_t triangle_count = words.size() - 3;
-			corner_count += 3 * triangle_count;
+			chunk.malformed = true;
+			return std::pair<vkmesh::ObjCorner, uint32_t>({ 0, 0, 0 }, 0);
 		}
-	}
-
-	file.close();
 
-	v.reserve(vertex_count);
-	vt.reserve(texcoord_count);
-	vn.reserve(normal_count);
-	vertices.reserve(corner_count);
-	indices.reserve(corner_count);
-
-	file.open(objFilepath);
+		uint32_t relative = (number_from_chunk(corner.v, chunk.v.size()) ? 1 : 0)
+			| (number_from_chunk(corner.vt, chunk.vt.size()) ? 2 : 0) | (number_from_chunk(corner.vn, chunk.vn.size()) ? 4 : 0);
+		return std::pair<vkmesh::ObjCorner, uint32_t>(corner, relative);
+	};
+	auto push = [&](const std::pair<vkmesh::ObjCorner, uint32_t>& corner)
+	{
+		if (corner.second != 0)
+			chunk.relativeCorners.push_back({ chunk.corners.size(), corner.second });
+		chunk.corners.push_back(corner.first);
+	};
 
-	while (std::getline(file, line))
+	while (!text.empty())
 	{
-		if (line.empty())
-			continue;
-			
-		words = split(line, " ");
+		std::string_view line = next_line(text);
+		std::string_view keyword = next_word(line);
 
-		if (!words[0].compare("v"))
-			readVertexData(words);
+		if (keyword == "v")
+			chunk.v.push_back(read_vec3(line, 1.f, preTransform));
 
-		else if (!words[0].compare("vt"))
-			readTexcoordData(words);
+		else if (keyword == "vt")
+		{
+			// To account for difference between Vulkan and OBJ coordinate systems, we need to flip Y coordinates
+			float u = next_float(line);
+			float v = next_float(line);
+			chunk.vt.push_back(glm::vec2(u, 1.f - v));
+		}
 
-		else if (!words[0].compare("vn"))
-			readNormalData(words);
+		else if (keyword == "vn")
+			chunk.vn.push_back(read_vec3(line, 0.f, preTransform));
 
-		else if (!words[0].compare("usemtl"))
+		else if (keyword == "usemtl")
+			chunk.materials.push_back({ chunk.corners.size(), next_word(line) });
+
+		else if (keyword == "f")
 		{
-			if (colorLookup.contains(words[1]))
-				brushColor = colorLookup[words[1]];
-			else
-				brushColor = glm::vec3(1.f);
+			// Polygons are triangulated as a fan around their first corner
+			auto first = parse(next_word(line));
+			auto previous = parse(next_word(line));
+			for (std::string_view word = next_word(line); !word.empty(); word = next_word(line))
+			{
+				auto corner = parse(word);
+				push(first);
+				push(previous);
+				push(corner);
+				previous = corner;
+			}
 		}
-		else if (!words[0].compare("f"))
-			readFaceData(words);
 	}
-
-	file.close();
 }
 
-void vkmesh::ObjMesh::readVertexData(const std::vector<std::string>& words)
+template <typename T>
+static void append(std::vector<T>& destination, std::vector<T>& source)
 {
-	glm::vec4 new_vertex = glm::vec4(std::stof(words[1]), std::stof(words[2]), std::stof(words[3]), 1.f);
-	glm::vec3 transformed_vertex = glm::vec3(preTransform * new_vertex);
-	v.push_back(transformed_vertex);
+	if (destination.empty())
+		destination = std::move(source);
+	else
+		destination.insert(destination.end(), source.begin(), source.end());
 }
 
-void vkmesh::ObjMesh::readTexcoordData(const std::vector<std::string>& words)
+bool vkmesh::ObjMesh::load(const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform, uint32_t threadCount)
 {
-	// To account for difference between Vulkan and OBJ coordinate systems, we need to flip Y coordinates
-	glm::vec2 new_texcoord = glm::vec2(std::stof(words[1]), 1.f - std::stof(words[2]));
-	vt.push_back(new_texcoord);
-}
+	this->preTransform = preTransform;
+	error.clear();
+
+	MappedFile file;
+	if (file.open(mtlFilepath))
+		readMaterials(std::string_view(reinterpret_cast<const char*>(file.data()), file.size()));
+
+	std::string_view text;
+	if (file.open(objFilepath))
+		text = std::string_view(reinterpret_cast<const char*>(file.data()), file.size());
+
+	// Every chunk ends after a line break, so no record is split between two of them
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkCount = std::clamp<size_t>(text.size() / OBJ_CHUNK_MIN_BYTES, 1, threadCount);
+	std::vector<size_t> boundaries = { 0 };
+	for (size_t chunkNo = 1; chunkNo < chunkCount; chunkNo++)
+	{
+		size_t lineBreak = text.find('\n', std::max(boundaries.back(), text.size() * chunkNo / chunkCount));
+		boundaries.push_back(lineBreak == std::string_view::npos ? text.size() : lineBreak + 1);
+	}
+	boundaries.push_back(text.size());
 
-void vkmesh::ObjMesh::readNormalData(const std::vector<std::string>& words)
-{
-	glm::vec4 new_normal = glm::vec4(std::stof(words[1]), std::stof(words[2]), std::stof(words[3]), 0.f);
-	glm::vec3 transformed_normal = glm::vec3(preTransform * new_normal);
-	vn.push_back(transformed_normal);
-}
+	std::vector<ObjChunk> chunks(chunkCount);
+	auto parse = [&](size_t begin, size_t end)
+	{
+		for (size_t chunkNo = begin; chunkNo < end; chunkNo++)
+			parse_chunk(text.substr(boundaries[chunkNo], boundaries[chunkNo + 1] - boundaries[chunkNo]), preTransform, chunks[chunkNo]);
+	};
+	if (chunkCount == 1)
+		parse(0, 1);
+	else
+		ThreadPool(static_cast<uint32_t>(chunkCount)).parallelFor(chunkCount, 1, parse);
+
+	// Attributes are numbered across the whole file, so they are joined before any face is resolved.
+	// Relative indices only count the attributes before them, which are those of the earlier chunks and their own.
+	for (ObjChunk& chunk : chunks)
+	{
+		for (auto [cornerNo, relative] : chunk.relativeCorners)
+		{
+			ObjCorner& corner = chunk.corners[cornerNo];
+			if (relative & 1)
+				corner.v = number_from_file(corner.v, v.size());
+			if (relative & 2)
+				corner.vt = number_from_file(corner.vt, vt.size());
+			if (relative & 4)
+				corner.vn = number_from_file(corner.vn, vn.size());
+		}
+		if (chunk.malformed)
+			error = "a face has an index which isn't an integer";
 
-void vkmesh::ObjMesh::readFaceData(const std::vector<std::string>& words)
-{
-	size_t triangleCount = words.size() - 3;
+		append(v, chunk.v);
+		append(vt, chunk.vt);
+		append(vn, chunk.vn);
+	}
 
-	for (int i = 0; i < triangleCount; ++i)
+	// A mesh has at least one vertex per position, texcoord and normal, usually not many more
+	size_t expectedVertexCount = std::max({ v.size(), vt.size(), vn.size() });
+	size_t cornerCount = 0;
+	for (const ObjChunk& chunk : chunks)
+		cornerCount += chunk.corners.size();
+	history.reserve(expectedVertexCount);
+	vertices.reserve(expectedVertexCount * SINGLE_VERTEX_FLOAT_NUM);
+	indices.reserve(cornerCount);
+
+	// Corners are deduplicated in file order, which makes the numbering of the vertices deterministic
+	for (ObjChunk& chunk : chunks)
 	{
-		readCorner(words[1]);
-		readCorner(words[2 + i]);
-		readCorner(words[3 + i]);
+		size_t materialNo = 0;
+		auto useMaterials = [&](size_t cornerNo)
+		{
+			for (; materialNo < chunk.materials.size() && chunk.materials[materialNo].first <= cornerNo; materialNo++)
+			{
+				auto material = colorLookup.find(std::string(chunk.materials[materialNo].second));
+				if (material != colorLookup.end())
+					brushColor = material->second;
+				else
+					brushColor = glm::vec3(1.f);
+			}
+		};
+
+		for (size_t cornerNo = 0; cornerNo < chunk.corners.size() && error.empty(); cornerNo++)
+		{
+			useMaterials(cornerNo);
+			const ObjCorner& corner = chunk.corners[cornerNo];
+			if (!readCorner(corner))
+				error = "a face refers to position " + std::to_string(corner.v) + ", texcoord " + std::to_string(corner.vt)
+					+ " and normal " + std::to_string(corner.vn) + " of " + std::to_string(v.size()) + ", "
+					+ std::to_string(vt.size()) + " and " + std::to_string(vn.size());
+		}
+		// Materials selected after the last face of a chunk apply to the next one
+		useMaterials(chunk.corners.size());
 	}
+
+	// Only the interleaved vertices and indices are kept
+	history.release();
+	std::vector<glm::vec3>().swap(v);
+	std::vector<glm::vec2>().swap(vt);
+	std::vector<glm::vec3>().swap(vn);
+
+	if (error.empty())
+		return true;
+	error = std::string(objFilepath) + ": " + error;
+	std::vector<float>().swap(vertices);
+	std::vector<uint32_t>().swap(indices);
+	return false;
 }
 
-void vkmesh::ObjMesh::readCorner(const std::string& vertex_description)
+void vkmesh::ObjMesh::readMaterials(std::string_view text)
 {
-	if (history.contains(vertex_description))
+	std::string_view materialName;
+	while (!text.empty())
 	{
-		indices.push_back(history[vertex_description]);
-		return;
-	}
-
-	uint32_t index = static_cast<uint32_t>(history.size());
-	history.insert({ vertex_description, index });
-	indices.push_back(index);
+		std::string_view line = next_line(text);
+		std::string_view keyword = next_word(line);
 
+		if (keyword == "newmtl")
+			materialName = next_word(line);
 
-	std::vector<std::string> v_vt_vn = split(vertex_description, "/");
+		else if (keyword == "Kd")
+		{
+			brushColor.r = next_float(line);
+			brushColor.g = next_float(line);
+			brushColor.b = next_float(line);
+			colorLookup.insert({ std::string(materialName), brushColor });
+		}
+	}
+}
 
-	// Position
-	glm::vec3 pos = v[std::stol(v_vt_vn[0]) - 1];
-	vertices.push_back(pos[0]);
-	vertices.push_back(pos[1]);
-	vertices.push_back(pos[2]);
+bool vkmesh::ObjMesh::readCorner(const ObjCorner& corner)
+{
+	// Positions are mandatory, texcoords and normals may be absent
+	if (corner.v < 1 || size_t(corner.v) > v.size() || corner.vt < 0 || size_t(corner.vt) > vt.size()
+		|| corner.vn < 0 || size_t(corner.vn) > vn.size())
+		return false;
 
-	// Color
-	vertices.push_back(brushColor.r);
-	vertices.push_back(brushColor.g);
-	vertices.push_back(brushColor.b);
+	auto [vertexNo, inserted] = history.insert(corner, static_cast<uint32_t>(history.size()));
+	indices.push_back(vertexNo);
+	if (!inserted)
+		return true;
 
-	// Texcoord
+	glm::vec3 pos = v[corner.v - 1];
 	glm::vec2 texcoord = glm::vec2(0.f, 0.f);
-	if (v_vt_vn.size() == 3 && v_vt_vn[1].size() > 0)
-		texcoord = vt[std::stol(v_vt_vn[1]) - 1];
-
-	vertices.push_back(texcoord[0]);
-	vertices.push_back(texcoord[1]);
-
-	// Normal
-	glm::vec3 normal = vn[std::stol(v_vt_vn[2]) - 1];
-	vertices.push_back(normal[0]);
-	vertices.push_back(normal[1]);
-	vertices.push_back(normal[2]);
-
-	static constexpr int SPHERICAL_HARMONICS_COEEFS_NUM = 9;
-	for (int i = 0; i < SPHERICAL_HARMONICS_COEEFS_NUM * 4; i++)
-		vertices.push_back(0);
-}
\ No newline at end of file
+	if (corner.vt > 0)
+		texcoord = vt[corner.vt - 1];
+	glm::vec3 normal = glm::vec3(0.f, 0.f, 0.f);
+	if (corner.vn > 0)
+		normal = vn[corner.vn - 1];
+
+	// The vertex is written in place, SH coefficients are left at zero for the bake
+	size_t offset = vertices.size();
+	vertices.resize(offset + SINGLE_VERTEX_FLOAT_NUM);
+	float* vertex = &vertices[offset];
+	vertex[0] = pos[0];
+	vertex[1] = pos[1];
+	vertex[2] = pos[2];
+	vertex[3] = brushColor.r;
+	vertex[4] = brushColor.g;
+	vertex[5] = brushColor.b;
+	vertex[6] = texcoord[0];
+	vertex[7] = texcoord[1];
+	vertex[8] = normal[0];
+	vertex[9] = normal[1];
+	vertex[10] = normal[2];
+	return true;
+}
@@ -1,29 +1,73 @@
 #pragma once
 #include "../../config.h"
+#include <string_view>
 
 namespace vkmesh {
 
+	// One-based indices of a face corner into the positions, texcoords and normals, 0 if absent.
+	// Relative (negative) indices of the file are resolved while loading, anything below 0 is invalid.
+	struct ObjCorner {
+		int32_t v, vt, vn;
+
+		bool operator==(const ObjCorner& other) const = default;
+	};
+
+	// Open addressing hash map with linear probing from corners to vertex numbers.
+	// Slots are stored inline, so neither lookups nor insertions allocate unless the table grows.
+	class CornerTable {
+	public:
+		// Make room for count corners without growing
+		void reserve(size_t count);
+
+		// \param vertexNo any number but EMPTY
+		// \returns the vertex number of the corner and whether it was inserted with vertexNo
+		std::pair<uint32_t, bool> insert(const ObjCorner& corner, uint32_t vertexNo);
+
+		size_t size() const { return count; }
+
+		// Free the slots
+		void release();
+
+		// Vertex number of the empty slots, so that any corner can be stored
+		static constexpr uint32_t EMPTY = UINT32_MAX;
+
+	private:
+		struct Slot {
+			ObjCorner corner;
+			uint32_t vertexNo;
+		};
+
+		std::vector<Slot> slots;
+		size_t count = 0;
+	};
+
 	class ObjMesh {
 	public:
 		std::vector<float> vertices;
 		std::vector<uint32_t> indices;
 		std::vector<glm::vec3> v, vn;
 		std::vector<glm::vec2> vt;
-		std::unordered_map<std::string, uint32_t> history;
+		// Vertex numbers of the corners seen so far. This and the attribute arrays are freed after loading.
+		CornerTable history;
 		std::unordered_map<std::string, glm::vec3> colorLookup;
-		glm::vec3 brushColor;
+		glm::vec3 brushColor = glm::vec3(1.f);
 		glm::mat4 preTransform;
+		// Why the last load failed
+		std::string error;
 
-		void load(const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform);
-
-		void readVertexData(const std::vector<std::string>& words);
-
-		void readTexcoordData(const std::vector<std::string>& words);
-
-		void readNormalData(const std::vector<std::string>& words);
+		// Load a mesh from the mapped files, without allocating per line.
+		// Newline-aligned chunks of the OBJ are parsed in parallel and merged in file order,
+		// so the result is the same for any number of threads.
+		// \param threadCount threads parsing the OBJ, 0 means one per hardware thread
+		// \returns false if a face has a malformed index or one past the attributes, the mesh is left empty then
+		bool load(const char* objFilepath, const char* mtlFilepath, glm::mat4 preTransform, uint32_t threadCount = 1);
 
-		void readFaceData(const std::vector<std::string>& words);
+		// Read the colors of the materials.
+		// \param text the whole MTL file
+		void readMaterials(std::string_view text);
 
-		void readCorner(const std::string& vertex_description);
+		// Append the vertex of a corner unless it was seen before, along with its index.
+		// \returns false if an index is out of range, nothing is appended then
+		bool readCorner(const ObjCorner& corner);
 	};
-}
\ No newline at end of file
+}
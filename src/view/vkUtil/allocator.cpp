@@ -0,0 +1,272 @@
+#include "allocator.h"
+#include <algorithm>
+#include <bit>
+#include "memory.h"
+#include "../../control/logging.h"
+
+namespace vkutil {
+	MemoryAllocator* MemoryAllocator::allocator;
+}
+
+// Smallest node of a buddy block, every allocation is rounded up to a power of two at least this large
+static constexpr vk::DeviceSize MIN_BUDDY_SIZE = 256;
+// Blocks are an eighth of their heap, within these bounds
+static constexpr vk::DeviceSize MIN_BLOCK_SIZE = 1ull << 20;
+static constexpr vk::DeviceSize MAX_BLOCK_SIZE = 64ull << 20;
+
+vkutil::MemoryAllocator* vkutil::MemoryAllocator::getAllocator()
+{
+	if (allocator == nullptr)
+		allocator = new MemoryAllocator();
+
+	return allocator;
+}
+
+void vkutil::MemoryAllocator::init(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	this->logicalDevice = logicalDevice;
+	this->physicalDevice = physicalDevice;
+	memoryProperties = physicalDevice.getMemoryProperties();
+	heaps.assign(memoryProperties.memoryHeapCount, HeapStatistics());
+}
+
+MemoryAllocation vkutil::MemoryAllocator::allocate(
+	const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, bool linear)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	uint32_t memoryTypeIndex = find_memory_type_index(physicalDevice, requirements.memoryTypeBits, properties);
+	poolKind pool = linear ? poolKind::LINEAR_RESOURCES : poolKind::OPTIMAL_IMAGES;
+	vk::DeviceSize size = blockSize(memoryTypeIndex);
+
+	Block* block = nullptr;
+	vk::DeviceSize offset = 0;
+	if (requirements.size > size / 2)
+	{
+		pool = poolKind::DEDICATED;
+		size = requirements.size;
+		block = makeBlock(memoryTypeIndex, size, pool);
+	}
+	else
+	{
+		// Buddy nodes are aligned to their own size, which covers the alignment of the resource
+		size = std::bit_ceil(std::max({ requirements.size, requirements.alignment, MIN_BUDDY_SIZE }));
+		for (Block* candidate : pools[{ memoryTypeIndex, pool }])
+			if (allocateBuddy(*candidate, size, offset))
+			{
+				block = candidate;
+				break;
+			}
+		if (!block && (block = makeBlock(memoryTypeIndex, blockSize(memoryTypeIndex), pool)))
+			allocateBuddy(*block, size, offset);
+	}
+
+	MemoryAllocation allocation;
+	if (!block)
+		return allocation;
+
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	if (block->mappedData)
+		allocation.mappedData = block->mappedData + offset;
+
+	HeapStatistics& heap = heaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+	heap.allocationCount++;
+	heap.allocatedBytes += size;
+	resourceAllocationCount++;
+	return allocation;
+}
+
+void vkutil::MemoryAllocator::free(const MemoryAllocation& allocation)
+{
+	if (!allocation.memory)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto found = blocks.find(static_cast<VkDeviceMemory>(allocation.memory));
+	if (found == blocks.end())
+	{
+		vklogging::Logger::getLogger()->print("Freed memory which was not allocated.");
+		return;
+	}
+	Block* block = found->second.get();
+
+	HeapStatistics& heap = heaps[memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex];
+	heap.allocationCount--;
+	heap.allocatedBytes -= allocation.size;
+
+	if (block->pool == poolKind::DEDICATED)
+	{
+		releaseBlock(block);
+		return;
+	}
+	freeBuddy(*block, allocation.offset, allocation.size);
+
+	// An empty block is kept while it is the only one, so that freeing and reallocating doesn't thrash
+	if (isEmpty(*block) && pools[{ block->memoryTypeIndex, block->pool }].size() > 1)
+		releaseBlock(block);
+}
+
+std::vector<vkutil::HeapStatistics> vkutil::MemoryAllocator::statistics()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return heaps;
+}
+
+void vkutil::MemoryAllocator::logStatistics()
+{
+	std::vector<HeapStatistics> heapStatistics;
+	size_t memoryObjects, resources;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		heapStatistics = heaps;
+		memoryObjects = memoryAllocationCount;
+		resources = resourceAllocationCount;
+	}
+
+	constexpr double MEBIBYTE = 1024.0 * 1024.0;
+	std::stringstream message;
+	message << "Memory: " << resources << " resources allocated with " << memoryObjects << " device memory allocations";
+	vklogging::Logger::getLogger()->print(message.str());
+	for (size_t heapNo = 0; heapNo < heapStatistics.size(); heapNo++)
+	{
+		const HeapStatistics& heap = heapStatistics[heapNo];
+		if (heap.blockCount == 0)
+			continue;
+
+		message.str("");
+		message << "    Heap " << heapNo
+			<< ((memoryProperties.memoryHeaps[heapNo].flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? " (device local): " : ": ")
+			<< heap.blockCount << " blocks of " << heap.blockBytes / MEBIBYTE << " MiB in total, "
+			<< heap.allocationCount << " allocations using " << heap.allocatedBytes / MEBIBYTE << " MiB";
+		vklogging::Logger::getLogger()->print(message.str());
+	}
+}
+
+void vkutil::MemoryAllocator::destroy()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (auto& [memory, block] : blocks)
+	{
+		if (block->mappedData)
+			logicalDevice.unmapMemory(block->memory);
+		logicalDevice.freeMemory(block->memory);
+	}
+	blocks.clear();
+	pools.clear();
+	heaps.assign(heaps.size(), HeapStatistics());
+}
+
+vkutil::MemoryAllocator::Block* vkutil::MemoryAllocator::makeBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, poolKind pool)
+{
+	vk::MemoryAllocateInfo allocInfo;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	std::unique_ptr<Block> block = std::make_unique<Block>();
+	try
+	{
+		block->memory = logicalDevice.allocateMemory(allocInfo);
+	}
+	catch (vk::SystemError err)
+	{
+		vklogging::Logger::getLogger()->print("Failed to allocate a device memory block.");
+		return nullptr;
+	}
+	memoryAllocationCount++;
+
+	block->size = size;
+	block->memoryTypeIndex = memoryTypeIndex;
+	block->pool = pool;
+	block->mappedData = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+		block->mappedData = static_cast<char*>(logicalDevice.mapMemory(block->memory, 0, VK_WHOLE_SIZE));
+
+	if (pool != poolKind::DEDICATED)
+	{
+		// The whole block starts out as a single free node of the highest order
+		block->freeOffsets.resize(std::countr_zero(size / MIN_BUDDY_SIZE) + 1);
+		block->freeOffsets.back().insert(0);
+	}
+
+	HeapStatistics& heap = heaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex];
+	heap.blockCount++;
+	heap.blockBytes += size;
+
+	Block* result = block.get();
+	blocks.emplace(static_cast<VkDeviceMemory>(result->memory), std::move(block));
+	if (pool != poolKind::DEDICATED)
+		pools[{ memoryTypeIndex, pool }].push_back(result);
+	return result;
+}
+
+void vkutil::MemoryAllocator::releaseBlock(Block* block)
+{
+	HeapStatistics& heap = heaps[memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex];
+	heap.blockCount--;
+	heap.blockBytes -= block->size;
+
+	if (block->pool != poolKind::DEDICATED)
+		std::erase(pools[{ block->memoryTypeIndex, block->pool }], block);
+
+	if (block->mappedData)
+		logicalDevice.unmapMemory(block->memory);
+	logicalDevice.freeMemory(block->memory);
+	blocks.erase(static_cast<VkDeviceMemory>(block->memory));
+}
+
+vk::DeviceSize vkutil::MemoryAllocator::blockSize(uint32_t memoryTypeIndex)
+{
+	vk::DeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	return std::clamp(std::bit_floor(heapSize / 8), MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+}
+
+bool vkutil::MemoryAllocator::allocateBuddy(Block& block, vk::DeviceSize size, vk::DeviceSize& offset)
+{
+	size_t order = std::countr_zero(size / MIN_BUDDY_SIZE);
+	for (size_t freeOrder = order; freeOrder < block.freeOffsets.size(); freeOrder++)
+	{
+		if (block.freeOffsets[freeOrder].empty())
+			continue;
+
+		offset = *block.freeOffsets[freeOrder].begin();
+		block.freeOffsets[freeOrder].erase(block.freeOffsets[freeOrder].begin());
+
+		// Split the node down to the requested order, the upper halves stay free
+		while (freeOrder > order)
+		{
+			freeOrder--;
+			block.freeOffsets[freeOrder].insert(offset + (MIN_BUDDY_SIZE << freeOrder));
+		}
+		return true;
+	}
+	return false;
+}
+
+void vkutil::MemoryAllocator::freeBuddy(Block& block, vk::DeviceSize offset, vk::DeviceSize size)
+{
+	size_t order = std::countr_zero(size / MIN_BUDDY_SIZE);
+
+	// Merge with the buddy for as long as it is free as well
+	while (order + 1 < block.freeOffsets.size())
+	{
+		vk::DeviceSize buddy = offset ^ (MIN_BUDDY_SIZE << order);
+		auto found = block.freeOffsets[order].find(buddy);
+		if (found == block.freeOffsets[order].end())
+			break;
+
+		block.freeOffsets[order].erase(found);
+		offset = std::min(offset, buddy);
+		order++;
+	}
+	block.freeOffsets[order].insert(offset);
+}
+
+bool vkutil::MemoryAllocator::isEmpty(const Block& block)
+{
+	return !block.freeOffsets.empty() && !block.freeOffsets.back().empty();
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "../../config.h"
+#include <map>
+#include <memory>
+
+namespace vkutil {
+
+	// Memory usage of one heap
+	struct HeapStatistics {
+		// Device memory objects and their total size
+		size_t blockCount = 0;
+		vk::DeviceSize blockBytes = 0;
+		// Live allocations and the bytes they requested
+		size_t allocationCount = 0;
+		vk::DeviceSize allocatedBytes = 0;
+	};
+
+	// Sub-allocates buffers and images from large device memory blocks, so that resources don't each cost
+	// a vkAllocateMemory call and count against maxMemoryAllocationCount. Blocks are kept per memory type
+	// and per kind of resource: long lived buffers and optimally tiled images live in separate buddy
+	// allocated blocks, which sidesteps bufferImageGranularity. Resources larger than half a block get
+	// a block of their own.
+	// Every method is thread safe.
+	class MemoryAllocator {
+	public:
+		static MemoryAllocator* getAllocator();
+
+		// Must be called before anything is allocated.
+		// \param logicalDevice the device to allocate from
+		// \param physicalDevice the GPU, for its memory types and heaps
+		void init(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice);
+
+		// Find memory for a resource. The caller binds it at the returned offset.
+		// \param requirements size, alignment and memory types of the resource
+		// \param properties properties the memory type must have
+		// \param linear whether the resource is a buffer or a linearly tiled image
+		// \returns the allocation, with a null memory handle if the device is out of memory
+		MemoryAllocation allocate(
+			const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, bool linear);
+
+		// Return an allocation. Empty blocks are released, except for the last block of each pool.
+		void free(const MemoryAllocation& allocation);
+
+		// \returns the usage of every memory heap
+		std::vector<HeapStatistics> statistics();
+
+		// Print the usage of every memory heap which has blocks.
+		void logStatistics();
+
+		// Release every block, all allocations must have been freed before.
+		void destroy();
+
+	private:
+		static MemoryAllocator* allocator;
+
+		// Kinds of resources which get blocks of their own
+		enum class poolKind {
+			LINEAR_RESOURCES,
+			OPTIMAL_IMAGES,
+			DEDICATED
+		};
+
+		struct Block {
+			vk::DeviceMemory memory;
+			vk::DeviceSize size;
+			char* mappedData;
+			uint32_t memoryTypeIndex;
+			poolKind pool;
+			// Buddy blocks: free offsets of every order, order 0 nodes are MIN_BUDDY_SIZE bytes
+			std::vector<std::set<vk::DeviceSize>> freeOffsets;
+		};
+
+		// Blocks with the same memory type and kind of resource
+		using PoolKey = std::pair<uint32_t, poolKind>;
+
+		Block* makeBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, poolKind pool);
+		void releaseBlock(Block* block);
+		vk::DeviceSize blockSize(uint32_t memoryTypeIndex);
+		static bool allocateBuddy(Block& block, vk::DeviceSize size, vk::DeviceSize& offset);
+		static void freeBuddy(Block& block, vk::DeviceSize offset, vk::DeviceSize size);
+		static bool isEmpty(const Block& block);
+
+		std::mutex lock;
+		vk::Device logicalDevice;
+		vk::PhysicalDevice physicalDevice;
+		vk::PhysicalDeviceMemoryProperties memoryProperties;
+		// Every block, by its memory handle
+		std::unordered_map<VkDeviceMemory, std::unique_ptr<Block>> blocks;
+		std::map<PoolKey, std::vector<Block*>> pools;
+		std::vector<HeapStatistics> heaps;
+		// Totals since init, how many resources were served by how many vkAllocateMemory calls
+		size_t memoryAllocationCount = 0;
+		size_t resourceAllocationCount = 0;
+	};
+}
@@ -1,66 +1,7 @@
 #include "frame.h"
-#include "memory.h"
+#include "allocator.h"
 #include "../vkImage/image.h"
 
-void vkutil::SwapChainFrame::makeDescriptorResources()
-{
-	BufferInputChunk input;
-	input.logicalDevice = logicalDevice;
-	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
-	input.physicalDevice = physicalDevice;
-
-	input.size = sizeof(CameraVectors);
-	input.usage = vk::BufferUsageFlagBits::eUniformBuffer;
-	cameraVectorBuffer = create_buffer(input);
-
-	cameraVectorWriteLocation = logicalDevice.mapMemory(cameraVectorBuffer.bufferMemory, 0, sizeof(CameraVectors));
-
-	input.size = sizeof(RenderParams);
-	input.usage = vk::BufferUsageFlagBits::eUniformBuffer;
-	renderParamsBuffer = create_buffer(input);
-
-	renderParamsWriteLocation = logicalDevice.mapMemory(renderParamsBuffer.bufferMemory, 0, sizeof(RenderParams));
-
-	input.size = sizeof(CameraMatrices);
-	input.usage = vk::BufferUsageFlagBits::eUniformBuffer;
-	cameraMatrixBuffer = create_buffer(input);
-
-	cameraMatrixWriteLocation = logicalDevice.mapMemory(cameraMatrixBuffer.bufferMemory, 0, sizeof(CameraMatrices));
-
-	input.size = 1024 * sizeof(glm::mat4);
-	input.usage = vk::BufferUsageFlagBits::eStorageBuffer;
-	modelBuffer = create_buffer(input);
-
-	modelBufferWriteLocation = logicalDevice.mapMemory(modelBuffer.bufferMemory, 0, 1024 * sizeof(glm::mat4));
-
-	modelTransforms.reserve(1024);
-	for (int i = 0; i < 1024; ++i)
-		modelTransforms.push_back(glm::mat4(1.f));
-
-	// typedef struct VkDescriptorBufferInfo {
-	// 	VkBuffer        buffer;
-	// 	VkDeviceSize    offset;
-	// 	VkDeviceSize    range;
-	// } VkDescriptorBufferInfo;
-
-	cameraVectorDescriptor.buffer = cameraVectorBuffer.buffer;
-	cameraVectorDescriptor.offset = 0;
-	cameraVectorDescriptor.range = sizeof(CameraVectors);
-
-	renderParamsDescriptor.buffer = renderParamsBuffer.buffer;
-	renderParamsDescriptor.offset = 0;
-	renderParamsDescriptor.range = sizeof(RenderParams);
-
-	cameraMatrixDescriptor.buffer = cameraMatrixBuffer.buffer;
-	cameraMatrixDescriptor.offset = 0;
-	cameraMatrixDescriptor.range = sizeof(CameraMatrices);
-
-	ssboDescriptor.buffer = modelBuffer.buffer;
-	ssboDescriptor.offset = 0;
-	ssboDescriptor.range = 1024 * sizeof(glm::mat4);
-
-}
-
 void vkutil::SwapChainFrame::makeDepthResources()
 {
 	depthFormat = vkimage::find_supported_format(
@@ -88,88 +29,14 @@ void vkutil::SwapChainFrame::makeDepthResources()
 	);
 }
 
-void vkutil::SwapChainFrame::recordWriteOperations()
-{
-	// typedef struct VkWriteDescriptorSet {
-	// 	 VkStructureType                  sType;
-	// 	 const void* pNext;
-	// 	 VkDescriptorSet                  dstSet;
-	// 	 uint32_t                         dstBinding;
-	// 	 uint32_t                         dstArrayElement;
-	// 	 uint32_t                         descriptorCount;
-	// 	 VkDescriptorType                 descriptorType;
-	// 	 const VkDescriptorImageInfo*     pImageInfo;
-	// 	 const VkDescriptorBufferInfo*    pBufferInfo;
-	// 	 const VkBufferView*              pTexelBufferView;
-	// } VkWriteDescriptorSet;
-
-	vk::WriteDescriptorSet cameraVectorWriteOp, cameraMatrixWriteOp, ssboWriteOp, renderParamsWriteOp,
-		cameraVectorModelWriteOp;
-
-	cameraVectorWriteOp.dstSet = descriptorSet[pipelineType::SKY];
-	cameraVectorWriteOp.dstBinding = 0;
-	cameraVectorWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
-	cameraVectorWriteOp.descriptorCount = 1;
-	cameraVectorWriteOp.descriptorType = vk::DescriptorType::eUniformBuffer;
-	cameraVectorWriteOp.pBufferInfo = &cameraVectorDescriptor;
-
-	// When making this automatic, don't forget about increasing dstBinding
-	renderParamsWriteOp.dstSet = descriptorSet[pipelineType::SKY];
-	renderParamsWriteOp.dstBinding = 1;
-	renderParamsWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
-	renderParamsWriteOp.descriptorCount = 1;
-	renderParamsWriteOp.descriptorType = vk::DescriptorType::eUniformBuffer;
-	renderParamsWriteOp.pBufferInfo = &renderParamsDescriptor;
-
-	cameraMatrixWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
-	cameraMatrixWriteOp.dstBinding = 0;
-	cameraMatrixWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
-	cameraMatrixWriteOp.descriptorCount = 1;
-	cameraMatrixWriteOp.descriptorType = vk::DescriptorType::eUniformBuffer;
-	cameraMatrixWriteOp.pBufferInfo = &cameraMatrixDescriptor;
-
-	cameraVectorModelWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
-	cameraVectorModelWriteOp.dstBinding = 1;
-	cameraVectorModelWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
-	cameraVectorModelWriteOp.descriptorCount = 1;
-	cameraVectorModelWriteOp.descriptorType = vk::DescriptorType::eUniformBuffer;
-	cameraVectorModelWriteOp.pBufferInfo = &cameraVectorDescriptor;
-
-	ssboWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
-	ssboWriteOp.dstBinding = 2;
-	ssboWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
-	ssboWriteOp.descriptorCount = 1;
-	ssboWriteOp.descriptorType = vk::DescriptorType::eStorageBuffer;
-	ssboWriteOp.pBufferInfo = &ssboDescriptor;
-
-	writeOps = { cameraVectorWriteOp, cameraMatrixWriteOp, ssboWriteOp, renderParamsWriteOp, cameraVectorModelWriteOp };
-
-}
-
-void vkutil::SwapChainFrame::writeDescriptorSet() { logicalDevice.updateDescriptorSets(writeOps, nullptr); }
-
-void vkutil::SwapChainFrame::destroyBufferAndFreeMemory(Buffer buffer)
-{
-	logicalDevice.unmapMemory(buffer.bufferMemory);
-	logicalDevice.freeMemory(buffer.bufferMemory);
-	logicalDevice.destroyBuffer(buffer.buffer);
-}
-
 void vkutil::SwapChainFrame::destroy()
 {
 	logicalDevice.destroyImageView(imageView);
 	logicalDevice.destroyFramebuffer(framebuffer[pipelineType::SKY]);
 	logicalDevice.destroyFramebuffer(framebuffer[pipelineType::STANDARD]);
-	logicalDevice.destroyFence(inFlight);
-	logicalDevice.destroySemaphore(imageAvailable);
 	logicalDevice.destroySemaphore(renderFinished);
 
-	destroyBufferAndFreeMemory(cameraVectorBuffer);
-	destroyBufferAndFreeMemory(renderParamsBuffer);
-	destroyBufferAndFreeMemory(cameraMatrixBuffer);
-	destroyBufferAndFreeMemory(modelBuffer);
-
 	logicalDevice.destroyImage(depthBuffer);
-	logicalDevice.freeMemory(depthBufferMemory);
+	MemoryAllocator::getAllocator()->free(depthBufferMemory);
 	logicalDevice.destroyImageView(depthBufferView);
 }
\ No newline at end of file
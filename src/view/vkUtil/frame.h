@@ -4,7 +4,8 @@
 
 namespace vkutil
 {
-	// Holds the data structures associated with a "Frame"
+	// Holds the data structures associated with a swapchain image. What a frame writes to while it is
+	// being recorded lives in a FrameContext, of which there are only as many as frames in flight.
 	class SwapChainFrame {
 
 	public:
@@ -18,57 +19,18 @@ namespace vkutil
 		vk::ImageView imageView;
 		std::unordered_map<pipelineType,vk::Framebuffer> framebuffer;
 		vk::Image depthBuffer;
-		vk::DeviceMemory depthBufferMemory;
+		MemoryAllocation depthBufferMemory;
 		vk::ImageView depthBufferView;
 		vk::Format depthFormat;
 		int width, height;
 
-		vk::CommandBuffer commandBuffer;
-
-		// Sync objects
-		vk::Semaphore imageAvailable, renderFinished;
-		vk::Fence inFlight;
-
-		// Resources
-		CameraMatrices cameraMatrixData;
-		Buffer cameraMatrixBuffer;
-		void* cameraMatrixWriteLocation;
-
-		CameraVectors cameraVectorData;
-		Buffer cameraVectorBuffer;
-		void* cameraVectorWriteLocation;
-
-		RenderParams renderParamsData = {
-			.aspectRatio = 9.f / 16.f,
-			.distanceCalculationMode = 1
-		};
-		Buffer renderParamsBuffer;
-		void* renderParamsWriteLocation;
-		
-		std::vector<glm::mat4> modelTransforms;
-		Buffer modelBuffer;
-		void* modelBufferWriteLocation;
-
-		// Resource Descriptors
-		vk::DescriptorBufferInfo cameraVectorDescriptor, cameraMatrixDescriptor;
-		vk::DescriptorBufferInfo ssboDescriptor;
-		vk::DescriptorBufferInfo renderParamsDescriptor;
-		vk::DescriptorBufferInfo shTermsDescriptor;
-		std::unordered_map<pipelineType, vk::DescriptorSet> descriptorSet;
-
-		// Write Operations
-		std::vector<vk::WriteDescriptorSet> writeOps;
-
-		void makeDescriptorResources();
-
-		void recordWriteOperations();
+		// Signaled when rendering to the image is done, presenting waits for it
+		vk::Semaphore renderFinished;
+		// Fence of the frame context which rendered to the image last, null if none has yet
+		vk::Fence renderedBy;
 
 		void makeDepthResources();
 
-		void writeDescriptorSet();
-
-		void destroyBufferAndFreeMemory(Buffer buffer);
-
 		void destroy();
 	};
 
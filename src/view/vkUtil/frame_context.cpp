@@ -0,0 +1,150 @@
+#include "frame_context.h"
+#include "memory.h"
+#include <bit>
+
+void vkutil::FrameContext::makeDescriptorResources()
+{
+	uniforms.make(logicalDevice, physicalDevice);
+	makeInstanceBuffer(1024);
+
+	// typedef struct VkDescriptorBufferInfo {
+	// 	VkBuffer        buffer;
+	// 	VkDeviceSize    offset;
+	// 	VkDeviceSize    range;
+	// } VkDescriptorBufferInfo;
+
+	cameraVectorDescriptor = uniforms.descriptor(sizeof(CameraVectors));
+	renderParamsDescriptor = uniforms.descriptor(sizeof(RenderParams));
+	cameraMatrixDescriptor = uniforms.descriptor(sizeof(CameraMatrices));
+}
+
+void vkutil::FrameContext::makeInstanceBuffer(uint32_t capacity)
+{
+	BufferInputChunk input;
+	input.logicalDevice = logicalDevice;
+	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	input.physicalDevice = physicalDevice;
+	input.size = capacity * sizeof(InstanceTransform);
+	input.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+	instanceBuffer = create_buffer(input);
+
+	instanceWriteLocation = static_cast<InstanceTransform*>(instanceBuffer.bufferMemory.mappedData);
+	instanceCapacity = capacity;
+
+	ssboDescriptor.buffer = instanceBuffer.buffer;
+	ssboDescriptor.offset = 0;
+	ssboDescriptor.range = input.size;
+}
+
+void vkutil::FrameContext::recordWriteOperations()
+{
+	// typedef struct VkWriteDescriptorSet {
+	// 	 VkStructureType                  sType;
+	// 	 const void* pNext;
+	// 	 VkDescriptorSet                  dstSet;
+	// 	 uint32_t                         dstBinding;
+	// 	 uint32_t                         dstArrayElement;
+	// 	 uint32_t                         descriptorCount;
+	// 	 VkDescriptorType                 descriptorType;
+	// 	 const VkDescriptorImageInfo*     pImageInfo;
+	// 	 const VkDescriptorBufferInfo*    pBufferInfo;
+	// 	 const VkBufferView*              pTexelBufferView;
+	// } VkWriteDescriptorSet;
+
+	vk::WriteDescriptorSet cameraVectorWriteOp, cameraMatrixWriteOp, ssboWriteOp, renderParamsWriteOp,
+		cameraVectorModelWriteOp;
+
+	cameraVectorWriteOp.dstSet = descriptorSet[pipelineType::SKY];
+	cameraVectorWriteOp.dstBinding = 0;
+	cameraVectorWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
+	cameraVectorWriteOp.descriptorCount = 1;
+	cameraVectorWriteOp.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+	cameraVectorWriteOp.pBufferInfo = &cameraVectorDescriptor;
+
+	// When making this automatic, don't forget about increasing dstBinding
+	renderParamsWriteOp.dstSet = descriptorSet[pipelineType::SKY];
+	renderParamsWriteOp.dstBinding = 1;
+	renderParamsWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
+	renderParamsWriteOp.descriptorCount = 1;
+	renderParamsWriteOp.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+	renderParamsWriteOp.pBufferInfo = &renderParamsDescriptor;
+
+	cameraMatrixWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
+	cameraMatrixWriteOp.dstBinding = 0;
+	cameraMatrixWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
+	cameraMatrixWriteOp.descriptorCount = 1;
+	cameraMatrixWriteOp.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+	cameraMatrixWriteOp.pBufferInfo = &cameraMatrixDescriptor;
+
+	cameraVectorModelWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
+	cameraVectorModelWriteOp.dstBinding = 1;
+	cameraVectorModelWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
+	cameraVectorModelWriteOp.descriptorCount = 1;
+	cameraVectorModelWriteOp.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+	cameraVectorModelWriteOp.pBufferInfo = &cameraVectorDescriptor;
+
+	ssboWriteOp.dstSet = descriptorSet[pipelineType::STANDARD];
+	ssboWriteOp.dstBinding = 2;
+	ssboWriteOp.dstArrayElement = 0; //byte offset within binding for inline uniform blocks
+	ssboWriteOp.descriptorCount = 1;
+	ssboWriteOp.descriptorType = vk::DescriptorType::eStorageBuffer;
+	ssboWriteOp.pBufferInfo = &ssboDescriptor;
+
+	writeOps = { cameraVectorWriteOp, cameraMatrixWriteOp, ssboWriteOp, renderParamsWriteOp, cameraVectorModelWriteOp };
+
+}
+
+void vkutil::FrameContext::writeDescriptorSet() { logicalDevice.updateDescriptorSets(writeOps, nullptr); }
+
+void vkutil::FrameContext::pushUniforms()
+{
+	uniforms.reset();
+	cameraMatrixOffset = uniforms.push(cameraMatrixData);
+	cameraVectorOffset = uniforms.push(cameraVectorData);
+	renderParamsOffset = uniforms.push(renderParamsData);
+}
+
+void vkutil::FrameContext::uploadInstances(const Scene& scene)
+{
+	uint32_t count = static_cast<uint32_t>(scene.instanceCount());
+	if (count > instanceCapacity)
+	{
+		// A larger buffer gets everything, and the descriptor has to follow it
+		destroyBufferAndFreeMemory(instanceBuffer);
+		makeInstanceBuffer(std::bit_ceil(count));
+		for (const vk::WriteDescriptorSet& writeOp : writeOps)
+			if (writeOp.pBufferInfo == &ssboDescriptor)
+				logicalDevice.updateDescriptorSets(writeOp, nullptr);
+
+		scene.writeTransforms(0, count, instanceWriteLocation);
+	}
+	else
+		for (auto [first, end] : scene.dirtyRangesSince(instanceVersion))
+			scene.writeTransforms(first, end, instanceWriteLocation + first);
+
+	instanceVersion = scene.currentVersion();
+}
+
+std::array<uint32_t, 2> vkutil::FrameContext::dynamicOffsets(pipelineType type) const
+{
+	// Must follow the uniform bindings written in recordWriteOperations
+	if (type == pipelineType::SKY)
+		return { cameraVectorOffset, renderParamsOffset };
+	return { cameraMatrixOffset, cameraVectorOffset };
+}
+
+void vkutil::FrameContext::destroyBufferAndFreeMemory(Buffer buffer)
+{
+	destroy_buffer(logicalDevice, buffer);
+}
+
+void vkutil::FrameContext::destroy()
+{
+	logicalDevice.destroyFence(inFlight);
+	logicalDevice.destroySemaphore(imageAvailable);
+	if (timestamps)
+		logicalDevice.destroyQueryPool(timestamps);
+
+	uniforms.destroy();
+	destroyBufferAndFreeMemory(instanceBuffer);
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+#include "../../config.h"
+#include "../../common/common_definitions.h"
+#include "uniform_allocator.h"
+#include "../../model/scene.h"
+#include <chrono>
+
+namespace vkutil
+{
+	// Holds what a frame records and writes to. The engine cycles through a ring of these, one per
+	// frame in flight, independent of how many images the swapchain has. A context is only touched
+	// again once its fence says the GPU is done with the frame it was last used for.
+	class FrameContext {
+
+	public:
+
+		// For doing work
+		vk::Device logicalDevice;
+		vk::PhysicalDevice physicalDevice;
+
+		vk::CommandBuffer commandBuffer;
+
+		// Sync objects
+		vk::Semaphore imageAvailable;
+		vk::Fence inFlight;
+		// When the last frame of this context was submitted, if it was
+		std::chrono::steady_clock::time_point submitTime;
+		bool submitted = false;
+		// Timestamps around the sky pass, read back once the frame is done. Null if the device can't time.
+		vk::QueryPool timestamps = nullptr;
+
+		// Resources
+		CameraMatrices cameraMatrixData;
+		CameraVectors cameraVectorData;
+		RenderParams renderParamsData = {
+			.aspectRatio = 9.f / 16.f,
+			.distanceCalculationMode = 1
+		};
+
+		// Uniform data of the frame, pushed anew every frame, and where it landed
+		UniformAllocator uniforms;
+		uint32_t cameraMatrixOffset, cameraVectorOffset, renderParamsOffset;
+		
+		// Transforms of the scene instances, patched where the scene changed since the last upload
+		Buffer instanceBuffer;
+		InstanceTransform* instanceWriteLocation;
+		uint32_t instanceCapacity = 0;
+		uint64_t instanceVersion = 0;
+
+		// Resource Descriptors
+		vk::DescriptorBufferInfo cameraVectorDescriptor, cameraMatrixDescriptor;
+		vk::DescriptorBufferInfo ssboDescriptor;
+		vk::DescriptorBufferInfo renderParamsDescriptor;
+		vk::DescriptorBufferInfo shTermsDescriptor;
+		std::unordered_map<pipelineType, vk::DescriptorSet> descriptorSet;
+
+		// Write Operations
+		std::vector<vk::WriteDescriptorSet> writeOps;
+
+		void makeDescriptorResources();
+
+		void recordWriteOperations();
+
+		// Point the descriptor sets at the resources. Uniforms are bound with dynamic offsets,
+		// so this is only needed once.
+		void writeDescriptorSet();
+
+		// Copy the uniform data to the start of the uniform allocator.
+		void pushUniforms();
+
+		// Bring the instance buffer up to date with the scene, growing it if the scene outgrew it.
+		void uploadInstances(const Scene& scene);
+
+		// \returns the dynamic offsets for the descriptor set of a pipeline, in binding order
+		std::array<uint32_t, 2> dynamicOffsets(pipelineType type) const;
+
+		void makeInstanceBuffer(uint32_t capacity);
+
+		void destroyBufferAndFreeMemory(Buffer buffer);
+
+		void destroy();
+	};
+
+}
\ No newline at end of file
@@ -1,5 +1,5 @@
 #include "memory.h"
-#include "single_time_commands.h"
+#include "allocator.h"
 
 uint32_t vkutil::find_memory_type_index(vk::PhysicalDevice physicalDevice, uint32_t supportedMemoryIndices, vk::MemoryPropertyFlags requestedProperties)
 {
@@ -39,24 +39,12 @@ void vkutil::allocate_buffer_memory(Buffer& buffer, const BufferInputChunk& inpu
 	// } VkMemoryRequirements;
 	vk::MemoryRequirements memoryRequirements = input.logicalDevice.getBufferMemoryRequirements(buffer.buffer);
 
-	//Provided by VK_VERSION_1_0:
-	//
-	//typedef struct VkMemoryAllocateInfo {
-	//	VkStructureType    sType;
-	//	const void*        pNext;
-	//	VkDeviceSize       allocationSize;
-	//	uint32_t           memoryTypeIndex;
-	//} VkMemoryAllocateInfo;
-
-	vk::MemoryAllocateInfo allocInfo;
-	allocInfo.allocationSize = memoryRequirements.size;
-	allocInfo.memoryTypeIndex = find_memory_type_index(
-		input.physicalDevice, memoryRequirements.memoryTypeBits,
-		input.memoryProperties
+	buffer.bufferMemory = MemoryAllocator::getAllocator()->allocate(
+		memoryRequirements, input.memoryProperties, true
 	);
-
-	buffer.bufferMemory = input.logicalDevice.allocateMemory(allocInfo);
-	input.logicalDevice.bindBufferMemory(buffer.buffer, buffer.bufferMemory, 0);
+	if (!buffer.bufferMemory.memory)
+		return;
+	input.logicalDevice.bindBufferMemory(buffer.buffer, buffer.bufferMemory.memory, buffer.bufferMemory.offset);
 }
 
 Buffer vkutil::create_buffer(BufferInputChunk input)
@@ -78,7 +66,14 @@ Buffer vkutil::create_buffer(BufferInputChunk input)
 	bufferInfo.flags = vk::BufferCreateFlags();
 	bufferInfo.size = input.size;
 	bufferInfo.usage = input.usage;
-	bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+	if (input.queueFamilyIndices.size() > 1)
+	{
+		bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(input.queueFamilyIndices.size());
+		bufferInfo.pQueueFamilyIndices = input.queueFamilyIndices.data();
+	}
+	else
+		bufferInfo.sharingMode = vk::SharingMode::eExclusive;
 
 	Buffer buffer;
 	buffer.buffer = input.logicalDevice.createBuffer(bufferInfo);
@@ -87,23 +82,8 @@ Buffer vkutil::create_buffer(BufferInputChunk input)
 	return buffer;
 }
 
-void vkutil::copy_buffer(Buffer& srcBuffer, Buffer& dstBuffer, vk::DeviceSize size, vk::Queue queue, vk::CommandBuffer commandBuffer)
+void vkutil::destroy_buffer(vk::Device logicalDevice, Buffer& buffer)
 {
-	vkutil::start_job(commandBuffer);
-
-	// Provided by VK_VERSION_1_0:
-	//
-	// typedef struct VkBufferCopy {
-	// 	VkDeviceSize    srcOffset;
-	// 	VkDeviceSize    dstOffset;
-	// 	VkDeviceSize    size;
-	// } VkBufferCopy;
-
-	vk::BufferCopy copyRegion;
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = size;
-	commandBuffer.copyBuffer(srcBuffer.buffer, dstBuffer.buffer, 1, &copyRegion);
-
-	vkutil::end_job(commandBuffer, queue);
-}
\ No newline at end of file
+	logicalDevice.destroyBuffer(buffer.buffer);
+	MemoryAllocator::getAllocator()->free(buffer.bufferMemory);
+}
@@ -12,7 +12,7 @@ namespace vkutil {
 		vk::PhysicalDevice physicalDevice, uint32_t supportedMemoryIndices, 
 		vk::MemoryPropertyFlags requestedProperties);
 
-	// Allocate a memory block for the given buffer.
+	// Sub-allocate memory for the given buffer and bind it.
 	// \param buffer the buffer to allocate memory for
 	// \param input holds various parameters
 	void allocate_buffer_memory(Buffer& buffer, const BufferInputChunk& input);
@@ -22,11 +22,8 @@ namespace vkutil {
 	// \returns the created buffer
 	Buffer create_buffer(BufferInputChunk input);
 
-	// Copy a buffer.
-	// \param srcBuffer the buffer to copy from
-	// \param dstBuffer the buffer to copy to
-	// \param size the size (in bytes) to copy
-	// \param queue on which to submit the job
-	// \param commandBuffer the command buffer on which to record the job
-	void copy_buffer(Buffer& srcBuffer, Buffer& dstBuffer, vk::DeviceSize size, vk::Queue queue, vk::CommandBuffer commandBuffer);
+	// Destroy a buffer and return its memory to the allocator.
+	// \param logicalDevice the device owning the buffer
+	// \param buffer the buffer to destroy
+	void destroy_buffer(vk::Device logicalDevice, Buffer& buffer);
 }
\ No newline at end of file
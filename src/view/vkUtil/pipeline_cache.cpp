@@ -0,0 +1,136 @@
+#include "pipeline_cache.h"
+#include <cstring>
+#include <filesystem>
+#include "../../control/logging.h"
+
+// Bump whenever the layout of the file changes
+static constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+static constexpr char PIPELINE_CACHE_MAGIC[4] = { 'P', 'S', 'O', 'C' };
+
+struct PipelineCacheFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint32_t reserved;
+	uint64_t dataSize;
+	// 64-bit FNV-1a of the data, so that a damaged file is never handed to the driver
+	uint64_t checksum;
+};
+
+static uint64_t checksum(const std::vector<char>& data)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (char byte : data)
+		hash = (hash ^ static_cast<unsigned char>(byte)) * 0x100000001b3ull;
+	return hash;
+}
+
+vkutil::PipelineCache::PipelineCache(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, std::string path)
+	: logicalDevice(logicalDevice)
+	, properties(physicalDevice.getProperties())
+	, path(std::move(path))
+{
+	std::vector<char> data = load();
+	warm = !data.empty();
+
+	vk::PipelineCacheCreateInfo cacheInfo;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.data();
+	try
+	{
+		cache = logicalDevice.createPipelineCache(cacheInfo);
+	}
+	catch (vk::SystemError err)
+	{
+		// The driver didn't take the data after all, an empty cache still works
+		vklogging::Logger::getLogger()->print("Failed to create pipeline cache from " + this->path + ", starting empty");
+		warm = false;
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		cache = logicalDevice.createPipelineCache(cacheInfo);
+	}
+
+	vklogging::Logger::getLogger()->print(warm
+		? "Loaded " + std::to_string(data.size()) + " bytes of pipeline cache from " + this->path
+		: "Starting with an empty pipeline cache");
+}
+
+vkutil::PipelineCache::~PipelineCache()
+{
+	logicalDevice.destroyPipelineCache(cache);
+}
+
+std::vector<char> vkutil::PipelineCache::load()
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return {};
+
+	PipelineCacheFileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, PIPELINE_CACHE_MAGIC, sizeof(PIPELINE_CACHE_MAGIC)) != 0
+		|| header.version != PIPELINE_CACHE_VERSION)
+		return {};
+
+	if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID
+		|| header.driverVersion != properties.driverVersion
+		|| std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+	{
+		vklogging::Logger::getLogger()->print("Pipeline cache " + path + " was made by another device or driver, discarding it");
+		return {};
+	}
+
+	// The size is checked against the file before anything is allocated for it, the header was read so it is there
+	std::error_code error;
+	uintmax_t fileSize = std::filesystem::file_size(path, error);
+	if (error || header.dataSize != fileSize - sizeof(header))
+	{
+		vklogging::Logger::getLogger()->print("Pipeline cache " + path + " is damaged, discarding it");
+		return {};
+	}
+
+	std::vector<char> data(header.dataSize);
+	if (!file.read(data.data(), data.size()) || checksum(data) != header.checksum)
+	{
+		vklogging::Logger::getLogger()->print("Pipeline cache " + path + " is damaged, discarding it");
+		return {};
+	}
+	return data;
+}
+
+bool vkutil::PipelineCache::save()
+{
+	std::vector<uint8_t> cacheData = logicalDevice.getPipelineCacheData(cache);
+	std::vector<char> data(cacheData.begin(), cacheData.end());
+
+	PipelineCacheFileHeader header = {};
+	std::memcpy(header.magic, PIPELINE_CACHE_MAGIC, sizeof(PIPELINE_CACHE_MAGIC));
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+	header.dataSize = data.size();
+	header.checksum = checksum(data);
+
+	// Written under a temporary name first, so an interrupted write never leaves a truncated cache behind
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), data.size());
+		if (!file)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+		return false;
+
+	warm = true;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "../../config.h"
+
+namespace vkutil {
+
+	// A pipeline cache which outlives the process. The driver's cache data is stored behind a header naming
+	// the device and driver it came from, and is only handed back to a device and driver which match it,
+	// since some drivers don't reject foreign or damaged data themselves.
+	class PipelineCache {
+	public:
+		// Load the cache file if it matches this device and driver, otherwise start out empty.
+		// \param logicalDevice the device pipelines are created on
+		// \param physicalDevice the GPU, whose properties the file is checked against
+		// \param path the file the cache is loaded from and saved to
+		PipelineCache(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, std::string path);
+
+		~PipelineCache();
+
+		vk::PipelineCache handle() const { return cache; }
+
+		// \returns whether the cache holds the pipelines of an earlier build, loaded from the file or saved since
+		bool isWarm() const { return warm; }
+
+		// Write the current contents of the cache, replacing the previous file.
+		// \returns whether the file was written
+		bool save();
+
+	private:
+		// \returns the driver's data if the file holds a complete cache of this device and driver, empty otherwise
+		std::vector<char> load();
+
+		vk::Device logicalDevice;
+		vk::PhysicalDeviceProperties properties;
+		std::string path;
+		vk::PipelineCache cache;
+		bool warm = false;
+	};
+}
\ No newline at end of file
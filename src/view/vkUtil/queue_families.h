@@ -3,10 +3,12 @@
 
 namespace vkutil {
 
-	// Holds the indices of the graphics and presentation queue families.
+	// Holds the indices of the graphics and presentation queue families, and of a transfer
+	// queue family if the device has one which is separate from graphics.
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily;
 
 		bool isComplete() {	return graphicsFamily.has_value() && presentFamily.has_value(); }
 	};
@@ -61,27 +63,44 @@ namespace vkutil {
 			// 	VK_QUEUE_SPARSE_BINDING_BIT = 0x00000008,
 			// 	} VkQueueFlagBits;
 
-			if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics)
+			// Dedicated transfer families usually map to the DMA engines, so uploads on them run
+			// alongside rendering. A family without compute is preferred over an async compute one.
+			bool dedicatedTransfer = (queueFamily.queueFlags & vk::QueueFlagBits::eTransfer)
+				&& !(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics);
+			bool betterTransfer = !indices.transferFamily.has_value()
+				|| ((queueFamilies[indices.transferFamily.value()].queueFlags & vk::QueueFlagBits::eCompute)
+					&& !(queueFamily.queueFlags & vk::QueueFlagBits::eCompute));
+			if (dedicatedTransfer && betterTransfer)
 			{
-				indices.graphicsFamily = i;
+				indices.transferFamily = i;
 
-				message << "Queue Family " << i << " is suitable for graphics.";
+				message << "Queue Family " << i << " is suitable for dedicated transfers.";
 				vklogging::Logger::getLogger()->print(message.str());
 				message.str("");
 			}
 
-			if (device.getSurfaceSupportKHR(i, surface))
+			// Graphics and presentation are settled once both are found
+			if (!indices.isComplete())
 			{
-				indices.presentFamily = i;
-
-				message << "Queue Family " << i << " is suitable for presenting.";
-				vklogging::Logger::getLogger()->print(message.str());
-				message.str("");
+				if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics)
+				{
+					indices.graphicsFamily = i;
+
+					message << "Queue Family " << i << " is suitable for graphics.";
+					vklogging::Logger::getLogger()->print(message.str());
+					message.str("");
+				}
+
+				if (device.getSurfaceSupportKHR(i, surface))
+				{
+					indices.presentFamily = i;
+
+					message << "Queue Family " << i << " is suitable for presenting.";
+					vklogging::Logger::getLogger()->print(message.str());
+					message.str("");
+				}
 			}
 
-			if (indices.isComplete())
-				break;
-
 			i++;
 		}
 
@@ -0,0 +1,294 @@
+#include "shader_compiler.h"
+#include <algorithm>
+#include <cstring>
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+#include "../../control/logging.h"
+
+// Bump whenever the compile options change in a way which changes the SPIR-V
+static constexpr uint32_t SHADER_KEY_VERSION = 1;
+static constexpr char SHADER_KEY_MAGIC[4] = { 'S', 'P', 'V', 'K' };
+
+struct ShaderKeyHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t dependencyCount;
+	uint32_t reserved;
+};
+
+// \returns whether the whole file was read
+static bool read_text(const std::filesystem::path& path, std::string& text)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	std::stringstream contents;
+	contents << file.rdbuf();
+	text = contents.str();
+	return !file.bad();
+}
+
+// 64-bit FNV-1a of the paths and the texts of the files, in order
+static uint64_t make_key(const std::vector<std::pair<std::string, std::string>>& files)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto add = [&hash](const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	};
+
+	add(&SHADER_KEY_VERSION, sizeof(SHADER_KEY_VERSION));
+	for (const auto& [path, text] : files)
+	{
+		uint64_t sizes[2] = { path.size(), text.size() };
+		add(sizes, sizeof(sizes));
+		add(path.data(), path.size());
+		add(text.data(), text.size());
+	}
+	return hash;
+}
+
+// \returns whether the extension of the shader names a stage
+static bool find_stage(const std::string& name, EShLanguage& stage)
+{
+	static const std::unordered_map<std::string, EShLanguage> stages = {
+		{".vert", EShLangVertex}, {".frag", EShLangFragment}, {".comp", EShLangCompute},
+		{".geom", EShLangGeometry}, {".tesc", EShLangTessControl}, {".tese", EShLangTessEvaluation}
+	};
+
+	auto found = stages.find(std::filesystem::path(name).extension().string());
+	if (found == stages.end())
+		return false;
+	stage = found->second;
+	return true;
+}
+
+// Resolves includes relative to the including file and records every file it reads
+class SourceIncluder : public glslang::TShader::Includer {
+public:
+	SourceIncluder(std::vector<std::pair<std::filesystem::path, std::string>>& files)
+		: files(files)
+	{}
+
+	IncludeResult* includeLocal(const char* headerName, const char* includerName, size_t inclusionDepth) override
+	{
+		std::filesystem::path path = (std::filesystem::path(includerName).parent_path() / headerName).lexically_normal();
+		std::string* text = new std::string();
+		if (!read_text(path, *text))
+		{
+			delete text;
+			return nullptr;
+		}
+
+		if (std::none_of(files.begin(), files.end(), [&path](const auto& file) { return file.first == path; }))
+			files.emplace_back(path, *text);
+		return new IncludeResult(path.generic_string(), text->data(), text->size(), text);
+	}
+
+	void releaseInclude(IncludeResult* result) override
+	{
+		if (!result)
+			return;
+		delete static_cast<std::string*>(result->userData);
+		delete result;
+	}
+
+private:
+	std::vector<std::pair<std::filesystem::path, std::string>>& files;
+};
+
+vkutil::ShaderCompiler::ShaderCompiler(std::string sourceDirectory, std::string outputDirectory)
+	: sourceDirectory(std::move(sourceDirectory))
+	, outputDirectory(std::move(outputDirectory))
+{
+	glslang::InitializeProcess();
+}
+
+vkutil::ShaderCompiler::~ShaderCompiler()
+{
+	glslang::FinalizeProcess();
+}
+
+std::string vkutil::ShaderCompiler::outputPath(const std::string& name) const
+{
+	return (outputDirectory / (name + ".spv")).string();
+}
+
+bool vkutil::ShaderCompiler::update(const std::string& name)
+{
+	std::vector<std::filesystem::path> dependencies;
+	if (loadKey(name, dependencies))
+	{
+		cached++;
+		watch(name, dependencies);
+		return true;
+	}
+
+	std::vector<SourceFile> files;
+	bool success = compile(name, files);
+
+	// A shader which failed is watched as well, so that fixing it is picked up
+	dependencies.clear();
+	for (const auto& [path, text] : files)
+		dependencies.push_back(path);
+	if (dependencies.empty())
+		dependencies.push_back(sourceDirectory / name);
+	watch(name, dependencies);
+
+	if (!success)
+		return std::filesystem::exists(outputPath(name));
+
+	compiled++;
+	if (!storeKey(name, files))
+		vklogging::Logger::getLogger()->print("Failed to store the key of shader " + name);
+	return true;
+}
+
+std::vector<std::string> vkutil::ShaderCompiler::findChangedShaders()
+{
+	std::vector<std::string> changed;
+	for (const auto& [name, dependencies] : watched)
+		for (const Dependency& dependency : dependencies)
+		{
+			// A file being replaced by an editor may be missing for a moment, it counts once it is back
+			std::error_code error;
+			std::filesystem::file_time_type lastWrite = std::filesystem::last_write_time(dependency.path, error);
+			if (!error && lastWrite != dependency.lastWrite)
+			{
+				changed.push_back(name);
+				break;
+			}
+		}
+	return changed;
+}
+
+bool vkutil::ShaderCompiler::loadKey(const std::string& name, std::vector<std::filesystem::path>& dependencies) const
+{
+	std::ifstream file(outputPath(name) + ".key", std::ios::binary);
+	if (!file || !std::filesystem::exists(outputPath(name)))
+		return false;
+
+	ShaderKeyHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, SHADER_KEY_MAGIC, sizeof(SHADER_KEY_MAGIC)) != 0
+		|| header.version != SHADER_KEY_VERSION)
+		return false;
+
+	// Every listed file is read again, the key only matches if none of them changed
+	std::vector<std::pair<std::string, std::string>> files(header.dependencyCount);
+	dependencies.clear();
+	for (auto& [path, text] : files)
+	{
+		uint32_t length;
+		if (!file.read(reinterpret_cast<char*>(&length), sizeof(length)))
+			return false;
+		path.resize(length);
+		if (!file.read(path.data(), length) || !read_text(path, text))
+			return false;
+		dependencies.push_back(path);
+	}
+	return make_key(files) == header.key;
+}
+
+bool vkutil::ShaderCompiler::storeKey(const std::string& name, const std::vector<SourceFile>& files) const
+{
+	std::vector<std::pair<std::string, std::string>> keyFiles;
+	for (const auto& [path, text] : files)
+		keyFiles.emplace_back(path.generic_string(), text);
+
+	ShaderKeyHeader header = {};
+	std::memcpy(header.magic, SHADER_KEY_MAGIC, sizeof(SHADER_KEY_MAGIC));
+	header.version = SHADER_KEY_VERSION;
+	header.key = make_key(keyFiles);
+	header.dependencyCount = static_cast<uint32_t>(keyFiles.size());
+
+	std::string keyPath = outputPath(name) + ".key";
+	std::string temporaryPath = keyPath + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const auto& [path, text] : keyFiles)
+		{
+			uint32_t length = static_cast<uint32_t>(path.size());
+			file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			file.write(path.data(), length);
+		}
+		if (!file)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, keyPath, error);
+	return !error;
+}
+
+bool vkutil::ShaderCompiler::compile(const std::string& name, std::vector<SourceFile>& files) const
+{
+	// The includer records what it reads, the key is made from exactly the text which was compiled
+	files.assign(1, { (sourceDirectory / name).lexically_normal(), {} });
+	EShLanguage stage;
+	if (!read_text(files[0].first, files[0].second) || !find_stage(name, stage))
+	{
+		vklogging::Logger::getLogger()->print("Failed to read shader " + name);
+		return false;
+	}
+
+	glslang::TShader shader(stage);
+	const char* text = files[0].second.c_str();
+	std::string sourceName = files[0].first.generic_string();
+	const char* sourceNames = sourceName.c_str();
+	shader.setStringsWithLengthsAndNames(&text, nullptr, &sourceNames, 1);
+	shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 100);
+	shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_0);
+	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+
+	// The same rules glslangValidator -V applies
+	EShMessages messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+	SourceIncluder includer(files);
+	if (!shader.parse(GetDefaultResources(), 100, false, messages, includer))
+	{
+		vklogging::Logger::getLogger()->print("Failed to compile shader " + name + ":\n" + shader.getInfoLog());
+		return false;
+	}
+
+	glslang::TProgram program;
+	program.addShader(&shader);
+	if (!program.link(messages))
+	{
+		vklogging::Logger::getLogger()->print("Failed to link shader " + name + ":\n" + program.getInfoLog());
+		return false;
+	}
+
+	std::vector<uint32_t> spirv;
+	glslang::GlslangToSpv(*program.getIntermediate(stage), spirv);
+
+	// Written under a temporary name first, so that a pipeline never reads half a shader
+	std::string temporaryPath = outputPath(name) + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+		if (!file)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, outputPath(name), error);
+	return !error;
+}
+
+void vkutil::ShaderCompiler::watch(const std::string& name, const std::vector<std::filesystem::path>& dependencies)
+{
+	std::vector<Dependency>& watchedFiles = watched[name];
+	watchedFiles.clear();
+	for (const std::filesystem::path& path : dependencies)
+	{
+		std::error_code error;
+		std::filesystem::file_time_type lastWrite = std::filesystem::last_write_time(path, error);
+		watchedFiles.push_back({ path, error ? std::filesystem::file_time_type::min() : lastWrite });
+	}
+}
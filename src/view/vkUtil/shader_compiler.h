@@ -0,0 +1,62 @@
+#pragma once
+#include "../../config.h"
+#include <filesystem>
+
+namespace vkutil {
+
+	// Compiles GLSL shaders to SPIR-V in-process through glslang. Every SPIR-V file gets a key file next to it
+	// holding a hash of the source and of every file it included, so a shader is only compiled again when
+	// one of them changed. The compiler also remembers when those files were last written, so that edits
+	// made while the program runs can be picked up.
+	class ShaderCompiler {
+	public:
+		// \param sourceDirectory the directory holding the GLSL sources
+		// \param outputDirectory the directory the SPIR-V files are written to, as <shader>.spv
+		ShaderCompiler(std::string sourceDirectory, std::string outputDirectory);
+
+		~ShaderCompiler();
+
+		// Make sure the SPIR-V of a shader is up to date, compiling it if its key doesn't match.
+		// \param name the file name of the shader, its extension selects the stage
+		// \returns whether the SPIR-V file is usable, a failed compile keeps the previous one
+		bool update(const std::string& name);
+
+		// \returns the path of the SPIR-V file of a shader
+		std::string outputPath(const std::string& name) const;
+
+		// \returns the shaders passed to update whose source or includes were written to since, each of them once
+		std::vector<std::string> findChangedShaders();
+
+		// \returns the number of shaders compiled and the number taken from the cache so far
+		size_t compiledCount() const { return compiled; }
+		size_t cachedCount() const { return cached; }
+
+	private:
+		// A file read while compiling a shader, with the text which was read
+		using SourceFile = std::pair<std::filesystem::path, std::string>;
+
+		// A file which went into the SPIR-V of a shader, and when it was last written
+		struct Dependency {
+			std::filesystem::path path;
+			std::filesystem::file_time_type lastWrite;
+		};
+
+		// \param dependencies receives the files listed in the key file, the shader source first
+		// \returns whether the key file and the SPIR-V exist and the key matches the current files
+		bool loadKey(const std::string& name, std::vector<std::filesystem::path>& dependencies) const;
+
+		// \returns whether the key file was written
+		bool storeKey(const std::string& name, const std::vector<SourceFile>& files) const;
+
+		// \param files receives the source and every file it included, in the order they were first read
+		// \returns whether the shader compiled and its SPIR-V file was written
+		bool compile(const std::string& name, std::vector<SourceFile>& files) const;
+
+		// Remember when the files a shader depends on were last written.
+		void watch(const std::string& name, const std::vector<std::filesystem::path>& dependencies);
+
+		std::filesystem::path sourceDirectory, outputDirectory;
+		std::unordered_map<std::string, std::vector<Dependency>> watched;
+		size_t compiled = 0, cached = 0;
+	};
+}
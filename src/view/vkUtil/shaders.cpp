@@ -10,6 +10,7 @@ std::vector<char> vkutil::read_file(std::string filename)
     std::stringstream message;
     message << "Failed to load \"" << filename << "\"";
     vklogging::Logger::getLogger()->print(message.str());
+    return {};
   }
 
   size_t filesize{ static_cast<size_t>(file.tellg()) };
@@ -25,6 +26,8 @@ std::vector<char> vkutil::read_file(std::string filename)
 vk::ShaderModule vkutil::create_module(std::string filename, vk::Device device)
 {
   std::vector<char> sourceCode = read_file(filename);
+  if (sourceCode.empty())
+    return nullptr;
 
   vk::ShaderModuleCreateInfo moduleInfo = {};
   moduleInfo.flags = vk::ShaderModuleCreateFlags();
@@ -4,12 +4,12 @@
 namespace vkutil {
 	// Read a file.
 	// \param filename a string representing the path to the file
-	// \returns the contents as a vector of raw binary characters
+	// \returns the contents as a vector of raw binary characters, empty if the file couldn't be read
 	std::vector<char> read_file(std::string filename);
 
 	// Make a shader module.
 	// \param filename a string holding the filepath to the spir-v file.
 	// \param device the logical device
-	// \returns the created shader module
+	// \returns the created shader module, or a null handle if the file is missing or invalid
 	vk::ShaderModule create_module(std::string filename, vk::Device device);
 }
\ No newline at end of file
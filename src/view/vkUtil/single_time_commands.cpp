@@ -1,5 +1,8 @@
 #include "single_time_commands.h"
 
+// Queues are externally synchronized, and the loading threads all submit to the same one
+static std::mutex submissionLock;
+
 void vkutil::start_job(vk::CommandBuffer commandBuffer)
 {
 	commandBuffer.reset();
@@ -9,13 +12,8 @@ void vkutil::start_job(vk::CommandBuffer commandBuffer)
 	commandBuffer.begin(beginInfo);
 }
 
-void vkutil::end_job(vk::CommandBuffer commandBuffer, vk::Queue submissionQueue)
+void vkutil::submit(vk::Queue submissionQueue, const vk::SubmitInfo& submitInfo, vk::Fence fence)
 {
-	commandBuffer.end();
-
-	vk::SubmitInfo submitInfo;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	std::ignore = submissionQueue.submit(1, &submitInfo, nullptr);
-	submissionQueue.waitIdle();
-}
\ No newline at end of file
+	std::lock_guard<std::mutex> lock(submissionLock);
+	std::ignore = submissionQueue.submit(1, &submitInfo, fence);
+}
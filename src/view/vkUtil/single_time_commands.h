@@ -4,6 +4,9 @@ namespace vkutil {
 	// Begin recording a command buffer intended for a single submit.
 	void start_job(vk::CommandBuffer commandBuffer);
 
-	// Finish recording a command buffer and submit it.
-	void end_job(vk::CommandBuffer commandBuffer, vk::Queue submissionQueue);
-}
\ No newline at end of file
+	// Submit to a queue which other threads may submit to as well.
+	// \param submissionQueue the queue to submit to
+	// \param submitInfo the work to submit
+	// \param fence signalled once the work is done
+	void submit(vk::Queue submissionQueue, const vk::SubmitInfo& submitInfo, vk::Fence fence);
+}
@@ -0,0 +1,269 @@
+#include "staging.h"
+#include <algorithm>
+#include <cstring>
+#include "memory.h"
+#include "single_time_commands.h"
+#include "../../control/logging.h"
+
+// Single copies are split into pieces of at most this fraction of the ring, so that a large
+// upload can be submitted in parts while the rest is being staged
+static constexpr vk::DeviceSize MAX_PIECE_FRACTION = 4;
+
+vkutil::StagingRing::StagingRing(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice,
+	vk::Queue queue, uint32_t queueFamilyIndex, vk::DeviceSize capacity)
+	: logicalDevice(logicalDevice)
+	, queue(queue)
+	, capacity(capacity)
+{
+	// Copies to images need offsets which are a multiple of the texel size and of 4
+	alignment = std::max<vk::DeviceSize>(16, physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment);
+
+	BufferInputChunk input;
+	input.logicalDevice = logicalDevice;
+	input.physicalDevice = physicalDevice;
+	input.size = capacity;
+	input.usage = vk::BufferUsageFlagBits::eTransferSrc;
+	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	buffer = create_buffer(input);
+	mappedData = static_cast<char*>(buffer.bufferMemory.mappedData);
+
+	vk::CommandPoolCreateInfo poolInfo;
+	poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+	commandPool = logicalDevice.createCommandPool(poolInfo);
+}
+
+vkutil::StagingRing::~StagingRing()
+{
+	finish();
+
+	for (Batch& batch : idle)
+		logicalDevice.destroyFence(batch.fence);
+	logicalDevice.destroyCommandPool(commandPool);
+	destroy_buffer(logicalDevice, buffer);
+}
+
+void vkutil::StagingRing::uploadBuffer(const void* data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	const char* bytes = static_cast<const char*>(data);
+	vk::DeviceSize pieceSize = capacity / MAX_PIECE_FRACTION;
+	for (vk::DeviceSize done = 0; done < size; done += pieceSize)
+	{
+		vk::DeviceSize piece = std::min(pieceSize, size - done);
+		vk::DeviceSize offset = reserve(piece);
+		memcpy(mappedData + offset, bytes + done, piece);
+		bufferCopies.emplace_back(dstBuffer, vk::BufferCopy(offset, dstOffset + done, piece));
+	}
+}
+
+void vkutil::StagingRing::uploadImage(const void* const* layers, uint32_t layerCount, vk::Image image, uint32_t width, uint32_t height)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	vk::DeviceSize rowSize = static_cast<vk::DeviceSize>(width) * 4;
+	uint32_t rowsPerPiece = static_cast<uint32_t>(std::min<vk::DeviceSize>(height, capacity / MAX_PIECE_FRACTION / rowSize));
+	if (rowsPerPiece == 0)
+	{
+		vklogging::Logger::getLogger()->print("Image rows are too wide for the staging ring.");
+		return;
+	}
+
+	imageUploads.push_back({ image, layerCount, {}, true, false });
+	for (uint32_t layer = 0; layer < layerCount; layer++)
+		for (uint32_t row = 0; row < height; row += rowsPerPiece)
+		{
+			uint32_t rows = std::min(rowsPerPiece, height - row);
+			vk::DeviceSize offset = reserve(rows * rowSize);
+			memcpy(mappedData + offset, static_cast<const char*>(layers[layer]) + row * rowSize, rows * rowSize);
+
+			// A full ring submits the pieces staged so far, the rest continue in the next batch
+			if (imageUploads.empty())
+				imageUploads.push_back({ image, layerCount, {}, false, false });
+
+			vk::BufferImageCopy region;
+			region.bufferOffset = offset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, layer, 1);
+			region.imageOffset = vk::Offset3D(0, static_cast<int32_t>(row), 0);
+			region.imageExtent = vk::Extent3D(width, rows, 1);
+			imageUploads.back().regions.push_back(region);
+		}
+	imageUploads.back().endsUpload = true;
+}
+
+void vkutil::StagingRing::flush()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	submit();
+}
+
+void vkutil::StagingRing::finish(vk::Semaphore signalSemaphore)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	submit();
+
+	// Signalling comes after every batch in submission order, so it waits for all of their copies
+	if (signalSemaphore)
+	{
+		vk::SubmitInfo submitInfo;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &signalSemaphore;
+		vkutil::submit(queue, submitInfo, nullptr);
+	}
+	while (!inFlight.empty())
+		retire(true);
+}
+
+size_t vkutil::StagingRing::submissionCount()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return submissions;
+}
+
+vk::DeviceSize vkutil::StagingRing::reserve(vk::DeviceSize size)
+{
+	for (;;)
+	{
+		// Pieces never wrap around, the end of the ring is skipped instead
+		vk::DeviceSize offset = (head + alignment - 1) / alignment * alignment;
+		if (offset + size > capacity)
+			offset = 0;
+		vk::DeviceSize consumed = offset >= head ? offset + size - head : capacity - head + size;
+
+		if (used + consumed <= capacity)
+		{
+			used += consumed;
+			stagedBytes += consumed;
+			head = offset + size;
+			return offset;
+		}
+
+		// The ring is full. What is staged is submitted so that it drains as well, then the oldest batch is waited for.
+		submit();
+		if (!inFlight.empty())
+			retire(true);
+		else
+		{
+			// Nothing is in flight and nothing could be submitted, so only skipped bytes are left
+			used = stagedBytes = 0;
+			head = 0;
+		}
+	}
+}
+
+void vkutil::StagingRing::submit()
+{
+	if (bufferCopies.empty() && imageUploads.empty())
+		return;
+
+	retire(false);
+	Batch batch;
+	if (!idle.empty())
+	{
+		batch = idle.back();
+		idle.pop_back();
+		std::ignore = logicalDevice.resetFences(1, &batch.fence);
+	}
+	else
+	{
+		vk::CommandBufferAllocateInfo allocInfo;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = vk::CommandBufferLevel::ePrimary;
+		allocInfo.commandBufferCount = 1;
+		batch.commandBuffer = logicalDevice.allocateCommandBuffers(allocInfo)[0];
+		batch.fence = logicalDevice.createFence(vk::FenceCreateInfo());
+	}
+	start_job(batch.commandBuffer);
+
+	// All layout transitions, then all copies, then the transitions for sampling, each in one barrier
+	std::vector<vk::ImageMemoryBarrier> toTransfer, toShader;
+	for (const ImageUpload& upload : imageUploads)
+	{
+		vk::ImageMemoryBarrier barrier;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = upload.image;
+		barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, upload.layerCount);
+
+		// An upload continued from the previous batch only has to wait for its earlier pieces
+		barrier.oldLayout = upload.startsUpload ? vk::ImageLayout::eUndefined : vk::ImageLayout::eTransferDstOptimal;
+		barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+		barrier.srcAccessMask = upload.startsUpload ? vk::AccessFlagBits::eNoneKHR : vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+		toTransfer.push_back(barrier);
+
+		if (!upload.endsUpload)
+			continue;
+
+		// Shader stages may not exist on a transfer queue, the sampling queue waits on the semaphore from finish instead
+		barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+		barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eNoneKHR;
+		toShader.push_back(barrier);
+	}
+
+	if (!toTransfer.empty())
+		batch.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+
+	// Copies to the same buffer are issued together, as regions of one command
+	std::stable_sort(bufferCopies.begin(), bufferCopies.end(), [](const auto& a, const auto& b)
+	{
+		return static_cast<VkBuffer>(a.first) < static_cast<VkBuffer>(b.first);
+	});
+	std::vector<vk::BufferCopy> regions;
+	for (size_t first = 0, last; first < bufferCopies.size(); first = last)
+	{
+		regions.clear();
+		for (last = first; last < bufferCopies.size() && bufferCopies[last].first == bufferCopies[first].first; last++)
+			regions.push_back(bufferCopies[last].second);
+		batch.commandBuffer.copyBuffer(buffer.buffer, bufferCopies[first].first, regions);
+	}
+
+	for (const ImageUpload& upload : imageUploads)
+		if (!upload.regions.empty())
+			batch.commandBuffer.copyBufferToImage(buffer.buffer, upload.image, vk::ImageLayout::eTransferDstOptimal, upload.regions);
+
+	if (!toShader.empty())
+		batch.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+			vk::DependencyFlags(), nullptr, nullptr, toShader);
+
+	batch.commandBuffer.end();
+
+	vk::SubmitInfo submitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+	vkutil::submit(queue, submitInfo, batch.fence);
+
+	batch.bytes = stagedBytes;
+	stagedBytes = 0;
+	inFlight.push_back(batch);
+	submissions++;
+	bufferCopies.clear();
+	imageUploads.clear();
+}
+
+void vkutil::StagingRing::retire(bool wait)
+{
+	while (!inFlight.empty())
+	{
+		Batch& batch = inFlight.front();
+		if (wait)
+			std::ignore = logicalDevice.waitForFences(1, &batch.fence, VK_TRUE, UINT64_MAX);
+		else if (logicalDevice.getFenceStatus(batch.fence) != vk::Result::eSuccess)
+			break;
+
+		// Only the oldest batch is waited for, later ones are released if they happen to be done too
+		wait = false;
+		used -= batch.bytes;
+		idle.push_back(batch);
+		inFlight.pop_front();
+	}
+
+	if (used == 0)
+		head = 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "../../config.h"
+#include <deque>
+
+namespace vkutil {
+
+	// A persistently mapped staging buffer which uploads append to. Copies are only recorded when the ring
+	// is flushed, all of them into one command buffer with a single fence, so staging any number of assets
+	// costs one submission as long as they fit. When the ring runs full, what was staged so far is submitted
+	// and writing carries on behind the oldest batch still in flight.
+	// Uploads may be staged from any thread.
+	class StagingRing {
+	public:
+		// \param logicalDevice the device to upload to
+		// \param physicalDevice the GPU, for the copy alignment
+		// \param queue the queue copies are submitted to
+		// \param queueFamilyIndex the family of that queue
+		// \param capacity size of the ring in bytes
+		StagingRing(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice,
+			vk::Queue queue, uint32_t queueFamilyIndex, vk::DeviceSize capacity = 64ull << 20);
+
+		~StagingRing();
+
+		// Stage data for a buffer.
+		// \param data the bytes to upload, they are copied before this returns
+		// \param size the number of bytes
+		// \param dstBuffer the buffer to copy to
+		// \param dstOffset where in the buffer the data goes
+		void uploadBuffer(const void* data, vk::DeviceSize size, vk::Buffer dstBuffer, vk::DeviceSize dstOffset = 0);
+
+		// Stage the layers of an RGBA8 image. The image is transitioned from an undefined layout to
+		// transfer_dst_optimal for the copy and to shader_read_only_optimal after it.
+		// \param layers the pixels of every layer, they are copied before this returns
+		// \param layerCount the number of layers
+		// \param image the image to copy to
+		// \param width the width of the image
+		// \param height the height of the image
+		void uploadImage(const void* const* layers, uint32_t layerCount, vk::Image image, uint32_t width, uint32_t height);
+
+		// Submit everything staged so far, without waiting for it.
+		void flush();
+
+		// Submit everything staged so far and wait until all submitted copies are done.
+		// The wait only tells the host, another queue reading the uploads has to wait on the semaphore.
+		// \param signalSemaphore signalled on the upload queue once every submitted copy is done
+		void finish(vk::Semaphore signalSemaphore = nullptr);
+
+		// \returns the number of submissions made so far
+		size_t submissionCount();
+
+	private:
+		// A command buffer and fence, reused once its copies are done
+		struct Batch {
+			vk::CommandBuffer commandBuffer;
+			vk::Fence fence;
+			// Ring bytes the batch keeps alive, including the padding skipped at the end of the ring
+			vk::DeviceSize bytes;
+		};
+
+		// The pieces of an image staged into one batch. An image which didn't fit is continued in the next.
+		struct ImageUpload {
+			vk::Image image;
+			uint32_t layerCount;
+			std::vector<vk::BufferImageCopy> regions;
+			// Whether this batch holds the first and the last pieces of the image
+			bool startsUpload, endsUpload;
+		};
+
+		// Reserve ring space, submitting and waiting for older batches if the ring is full.
+		// \returns the offset of the space in the ring
+		vk::DeviceSize reserve(vk::DeviceSize size);
+		void submit();
+		// Release the oldest batches once they are done.
+		// \param wait whether to wait for the oldest batch if it isn't done yet
+		void retire(bool wait);
+
+		std::mutex lock;
+		vk::Device logicalDevice;
+		vk::Queue queue;
+		vk::CommandPool commandPool;
+		Buffer buffer;
+		char* mappedData;
+		vk::DeviceSize capacity, alignment;
+
+		// Next free byte, bytes in use by staged or in flight batches, and the bytes of the staged batch
+		vk::DeviceSize head = 0, used = 0, stagedBytes = 0;
+		std::vector<std::pair<vk::Buffer, vk::BufferCopy>> bufferCopies;
+		std::vector<ImageUpload> imageUploads;
+
+		std::deque<Batch> inFlight;
+		std::vector<Batch> idle;
+		size_t submissions = 0;
+	};
+}
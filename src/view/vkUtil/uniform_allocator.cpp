@@ -0,0 +1,54 @@
+#include "uniform_allocator.h"
+#include <algorithm>
+#include "memory.h"
+#include "../../control/logging.h"
+
+void vkutil::UniformAllocator::make(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::DeviceSize capacity)
+{
+	this->logicalDevice = logicalDevice;
+	this->capacity = capacity;
+	alignment = std::max<vk::DeviceSize>(1, physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment);
+	head = 0;
+
+	BufferInputChunk input;
+	input.logicalDevice = logicalDevice;
+	input.physicalDevice = physicalDevice;
+	input.size = capacity;
+	input.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+	input.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	buffer = create_buffer(input);
+	mappedData = static_cast<char*>(buffer.bufferMemory.mappedData);
+}
+
+void vkutil::UniformAllocator::reset()
+{
+	head = 0;
+}
+
+uint32_t vkutil::UniformAllocator::push(const void* data, vk::DeviceSize size)
+{
+	vk::DeviceSize offset = (head + alignment - 1) / alignment * alignment;
+	if (offset + size > capacity)
+	{
+		vklogging::Logger::getLogger()->print("Uniform allocator is out of space for this frame.");
+		return 0;
+	}
+
+	memcpy(mappedData + offset, data, size);
+	head = offset + size;
+	return static_cast<uint32_t>(offset);
+}
+
+vk::DescriptorBufferInfo vkutil::UniformAllocator::descriptor(vk::DeviceSize range) const
+{
+	vk::DescriptorBufferInfo info;
+	info.buffer = buffer.buffer;
+	info.offset = 0;
+	info.range = range;
+	return info;
+}
+
+void vkutil::UniformAllocator::destroy()
+{
+	destroy_buffer(logicalDevice, buffer);
+}
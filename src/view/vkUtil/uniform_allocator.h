@@ -0,0 +1,39 @@
+#pragma once
+#include "../../config.h"
+
+namespace vkutil {
+
+	// Hands out the uniform data of one frame from a single persistently mapped buffer. Every push lands
+	// at the next multiple of minUniformBufferOffsetAlignment and is bound through a dynamic offset, so
+	// the descriptors pointing into the buffer are written once and never change.
+	class UniformAllocator {
+	public:
+		// \param logicalDevice the device to make the buffer on
+		// \param physicalDevice the GPU, for the offset alignment
+		// \param capacity size of the buffer in bytes
+		void make(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::DeviceSize capacity = 64 * 1024);
+
+		// Start over from the beginning of the buffer. The GPU must be done with the previous contents.
+		void reset();
+
+		// Copy data to the buffer.
+		// \returns the dynamic offset of the copy
+		uint32_t push(const void* data, vk::DeviceSize size);
+
+		template<typename T>
+		uint32_t push(const T& data) { return push(&data, sizeof(T)); }
+
+		// \param range size of the data bound through the descriptor
+		// \returns a descriptor of the start of the buffer, to be moved by dynamic offsets
+		vk::DescriptorBufferInfo descriptor(vk::DeviceSize range) const;
+
+		void destroy();
+
+	private:
+		vk::Device logicalDevice;
+		Buffer buffer;
+		char* mappedData;
+		vk::DeviceSize capacity, alignment;
+		vk::DeviceSize head = 0;
+	};
+}